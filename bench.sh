@@ -0,0 +1,240 @@
+#!/bin/bash
+
+# 构建文件
+rebuild() {
+
+  #################################################
+  # 以 Release 方式构建qcc
+  cmake -Bbuild -DCMAKE_BUILD_TYPE=Release .
+  cd ./build
+  make
+  cd ../
+
+
+  #################################################
+  # 检查 tmp 文件夹是否存在
+  if [ ! -d "tmp" ]; then
+  # 不存在则创建 tmp 文件夹
+    mkdir tmp
+  fi
+}
+
+#############################################################################
+
+# 生成大规模输入文件
+# 参数1为生成文件路径，参数2为语句条数，参数3为使用的变量个数
+genInput() {
+  awk -v n="$2" -v v="$3" 'BEGIN {
+    print "{"
+    for (i = 0; i < n; i++)
+      printf "  var%d = var%d + 12 * (34 - var%d) / 5;\n", i % v, (i + 1) % v, (i + 2) % v
+    # 返回值依赖全部赋值，不使用的值不生成代码，返回 0 时代码生成无事可做
+    print "  return var0;"
+    print "}"
+  }' > "$1"
+}
+
+# 生成以标识符为主的输入文件，用于测试关键字识别
+# 参数1为生成文件路径，参数2为语句条数
+genIdentInput() {
+  awk -v n="$2" 'BEGIN {
+    print "{"
+    for (i = 0; i < n; i++)
+      printf "  counter = total + offset + value + result + buffer + length + index;\n"
+    print "  return 0;"
+    print "}"
+  }' > "$1"
+}
+
+# 生成缩进深、标识符长的输入文件，用于测试字符扫描器
+# 参数1为生成文件路径，参数2为语句条数
+genLongInput() {
+  awk -v n="$2" 'BEGIN {
+    print "{"
+    for (i = 0; i < n; i++)
+      printf "                                generated_identifier_%d = another_generated_identifier_%d;\n", i % 50, i % 50
+    print "  return 0;"
+    print "}"
+  }' > "$1"
+}
+
+# 生成局部变量很多的输入文件，用于测试变量查找
+# 参数1为生成文件路径，参数2为变量个数
+genLocalsInput() {
+  awk -v n="$2" 'BEGIN {
+    print "{"
+    print "  int v0 = 1;"
+    for (i = 1; i < n; i++)
+      printf "  int v%d = v%d + v%d;\n", i, i - 1, int(i / 2)
+    print "  { int v0 = 2; v1 = v0; }"
+    printf "  return v%d;\n", n - 1
+    print "}"
+  }' > "$1"
+}
+
+# 生成运算符密集的输入，用于测试语法分析的分派速度
+# 参数1为生成文件路径，参数2为语句条数
+genOpInput() {
+  awk -v n="$2" 'BEGIN {
+    print "{"
+    print "  int a = 1, b = 2, c = 3, d = 4;"
+    for (i = 0; i < n; i++)
+      printf "  a = -(b + ~c) * !d - (a ? b : c) << 2 | (b & c) ^ (d != a) && a >= -b;\n"
+    print "  return a;"
+    print "}"
+  }' > "$1"
+}
+
+# 生成深度嵌套的输入
+# 参数1为嵌套种类 unary|paren|block|cond|assign|sum，参数2为嵌套深度，参数3为生成文件路径
+genDeep() {
+  awk -v kind="$1" -v n="$2" 'BEGIN {
+    if (kind == "unary") {
+      printf "{ return "
+      for (i = 0; i < n; i++) printf "- "
+      print "1; }"
+    } else if (kind == "paren") {
+      printf "{ return "
+      for (i = 0; i < n; i++) printf "("
+      printf "1"
+      for (i = 0; i < n; i++) printf ")"
+      print "; }"
+    } else if (kind == "block") {
+      for (i = 0; i < n; i++) printf "{"
+      printf " return 1; "
+      for (i = 0; i < n; i++) printf "}"
+      print ""
+    } else if (kind == "cond") {
+      printf "{ return "
+      for (i = 0; i < n; i++) printf "1?"
+      printf "1"
+      for (i = 0; i < n; i++) printf ":0"
+      print "; }"
+    } else if (kind == "assign") {
+      printf "{ "
+      for (i = 0; i < n; i++) printf "a="
+      print "1; return a; }"
+    } else if (kind == "sum") {
+      printf "{ a=1; return a"
+      for (i = 1; i < n; i++) printf "+a"
+      print "; }"
+    }
+  }' > "$3"
+}
+
+# 生成大小不一的多个输入文件
+# 参数1为生成目录，参数2为文件个数
+genFiles() {
+  rm -rf "$1"
+  mkdir -p "$1"
+  for i in $(seq 1 "$2"); do
+    genInput "$1/$i.c" $((i % 50 * 40 + 20)) 20
+  done
+}
+
+# 从 test.sh 提取小程序，每行一个
+# 参数1为生成文件路径
+genSnippets() {
+  sed -n "s/^assert [0-9]* '\(.*\)'$/\1/p" ./test.sh > "$1"
+}
+
+# 启动编译服务，等到能连上为止
+# 参数1为套接字路径，其余参数传给 qcc --server
+startServer() {
+  sock="$1"
+  shift
+  ./bin/qcc --server "$sock" "$@" &
+  serverPid=$!
+  until echo '{ return 0; }' | ./bin/qcc --client "$sock" - > /dev/null 2>&1; do
+    kill -0 $serverPid 2> /dev/null || exit 1
+    sleep 0.05
+  done
+}
+
+# 停止编译服务
+stopServer() {
+  kill $serverPid
+  wait $serverPid
+}
+
+# 声明测试函数
+# 参数1为测试名称，其余参数传给qcc
+bench() {
+  name="$1"
+  shift
+  echo "[$name]"
+  # 汇编输出丢弃，仅保留 -ftime-report 报告
+  ./bin/qcc -ftime-report "$@" > /dev/null || exit
+}
+
+
+# 构建文件
+rebuild
+
+# 生成约 40MB 输入
+genInput ./tmp/bench.c 1000000 100
+
+# 文件输入读取速度 (mmap)
+bench "file input" ./tmp/bench.c
+
+# 各词法分析方式的耗时与词法单元内存峰值
+for mode in eager stream thread; do
+  bench "lex mode $mode" -flex-mode=$mode -fmem-report ./tmp/bench.c
+done
+
+# 并行词法分析随线程数的扩展性
+for jobs in $(seq 1 "$(nproc)"); do
+  bench "parallel lex $jobs jobs" -flex-mode=parallel -flex-jobs=$jobs ./tmp/bench.c
+done
+
+# 汇编注释与 -o 一次写出对代码生成的影响
+bench "verbose asm" -fverbose-asm ./tmp/bench.c
+bench "output file" -o ./tmp/bench.s ./tmp/bench.c
+
+# 管道输入读取速度 (read)
+cat ./tmp/bench.c | bench "pipe input" -
+
+# 标识符密集输入的词法分析速度
+genIdentInput ./tmp/ident.c 500000
+bench "identifier heavy" ./tmp/ident.c
+
+# 数千个局部变量的变量查找速度
+for n in 1000 10000 50000; do
+  genLocalsInput ./tmp/locals.c $n
+  bench "$n locals" ./tmp/locals.c
+done
+
+# 运算符密集输入的语法分析速度
+genOpInput ./tmp/ops.c 500000
+bench "operator heavy" ./tmp/ops.c
+
+# 百万层嵌套的语法分析与代码生成耗时
+for kind in unary paren block cond assign sum; do
+  genDeep $kind 1000000 ./tmp/deep.c
+  bench "deep $kind" ./tmp/deep.c
+done
+
+# 各字符扫描器对比
+genLongInput ./tmp/long.c 500000
+for scan in scalar sse2 avx2; do
+  bench "scanner $scan" -fscan=$scan ./tmp/long.c
+done
+
+# 大量小程序经编译服务与逐个启动 qcc 编译的吞吐量与延迟对比
+genSnippets ./tmp/snippets.txt
+startServer ./tmp/qcc.sock
+for clients in 1 "$(nproc)"; do
+  echo "[server, $clients clients]"
+  ./bin/qcc-bench -c $clients -n 100000 --server ./tmp/qcc.sock ./tmp/snippets.txt || exit
+  echo "[fork/exec, $clients clients]"
+  ./bin/qcc-bench -c $clients -n 5000 --exec ./bin/qcc ./tmp/snippets.txt || exit
+done
+stopServer
+
+# 数百个文件的多文件并行编译随线程数的扩展性
+genFiles ./tmp/multi 400
+TIMEFORMAT="  total    %Rs"
+for jobs in $(seq 1 "$(nproc)"); do
+  echo "[multi-file $jobs jobs]"
+  time ./bin/qcc -c -j $jobs ./tmp/multi/*.c || exit
+done
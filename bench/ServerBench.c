@@ -0,0 +1,206 @@
+// 编译服务压力测试：多个客户端线程反复提交小程序，统计吞吐量与延迟分布
+// 用法: qcc-bench [-c <clients>] [-n <requests>] --server <socket> <snippets>
+//       qcc-bench [-c <clients>] [-n <requests>] --exec <qcc> <snippets>
+// snippets 每行一个源程序；--server 经编译服务编译，--exec 每个请求启动一次 qcc
+
+// 使用了 pipe2 函数
+#define _GNU_SOURCE
+
+#include "qcc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// 压力测试的共享状态
+typedef struct {
+  const char *socket;   // 编译服务的套接字，为空时用 exec 方式
+  const char *qcc;      // exec 方式运行的 qcc
+  char **snippets;      // 源程序
+  unsigned snippetNum;  // 源程序个数
+  unsigned requests;    // 请求总数
+  unsigned clients;     // 客户端线程数
+  double *latency;      // 各请求的延迟，秒
+  atomic_uint next;     // 下一个待发出的请求编号
+  atomic_uint failures; // 失败的请求个数
+} Bench;
+
+/**
+ * @brief 获取当前单调时钟时间
+ *
+ * @return double 秒
+ */
+static double now(void) {
+  struct timespec TS;
+  clock_gettime(CLOCK_MONOTONIC, &TS);
+  return TS.tv_sec + TS.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 启动一次 qcc，源程序经管道从标准输入传入，读完汇编后等待其退出
+ *
+ * @param Qcc qcc 路径
+ * @param Src 源程序
+ * @return true 编译成功
+ * @return false 编译失败或无法启动
+ */
+static bool execOnce(const char *Qcc, const char *Src) {
+  // 管道不被并发启动的其他子进程继承，否则读端要等那些子进程退出才见到结尾
+  int In[2], Out[2];
+  if (pipe2(In, O_CLOEXEC))
+    return false;
+  if (pipe2(Out, O_CLOEXEC)) {
+    close(In[0]);
+    close(In[1]);
+    return false;
+  }
+
+  // 子进程的标准输入输出接到管道，标准错误丢弃
+  posix_spawn_file_actions_t FA;
+  posix_spawn_file_actions_init(&FA);
+  posix_spawn_file_actions_adddup2(&FA, In[0], 0);
+  posix_spawn_file_actions_adddup2(&FA, Out[1], 1);
+  posix_spawn_file_actions_addopen(&FA, 2, "/dev/null", 1, 0);
+  char *Argv[] = {(char *)Qcc, "-", NULL};
+  pid_t Pid;
+  int Err = posix_spawn(&Pid, Qcc, &FA, NULL, Argv, environ);
+  posix_spawn_file_actions_destroy(&FA);
+  close(In[0]);
+  close(Out[1]);
+
+  bool OK = !Err;
+  if (OK && write(In[1], Src, strlen(Src)) < 0)
+    OK = false;
+  close(In[1]);
+  char Buf[4096];
+  while (read(Out[0], Buf, sizeof(Buf)) > 0)
+    ;
+  close(Out[0]);
+
+  int Status;
+  if (!Err && waitpid(Pid, &Status, 0) == Pid)
+    OK = OK && WIFEXITED(Status) && WEXITSTATUS(Status) == 0;
+  return OK;
+}
+
+/**
+ * @brief 客户端线程，不断领取请求编号，记录每个请求的延迟
+ *
+ * @param Arg 共享状态
+ */
+static void *client(void *Arg) {
+  Bench *B = Arg;
+  QccClient *Client = NULL;
+  if (B->socket && !(Client = qccConnect(B->socket))) {
+    fprintf(stderr, "cannot connect to %s: %s\n", B->socket, strerror(errno));
+    exit(1);
+  }
+
+  unsigned I;
+  while ((I = atomic_fetch_add(&B->next, 1)) < B->requests) {
+    const char *Src = B->snippets[I % B->snippetNum];
+    double T = now();
+    bool OK = Client ? qccRemoteCompile(Client, "snippet.c", Src,
+                                        strlen(Src)) == QCC_OK
+                     : execOnce(B->qcc, Src);
+    B->latency[I] = now() - T;
+    if (!OK)
+      atomic_fetch_add(&B->failures, 1);
+  }
+
+  qccDisconnect(Client);
+  return NULL;
+}
+
+/**
+ * @brief 读入源程序，每行一个，忽略空行
+ *
+ * @param B 共享状态
+ * @param Path 文件路径
+ */
+static void readSnippets(Bench *B, const char *Path) {
+  FILE *FP = fopen(Path, "r");
+  if (!FP) {
+    fprintf(stderr, "cannot open %s: %s\n", Path, strerror(errno));
+    exit(1);
+  }
+  char *Line = NULL;
+  size_t Cap = 0;
+  unsigned Num = 0;
+  ssize_t Len;
+  while ((Len = getline(&Line, &Cap, FP)) > 0) {
+    if (Line[0] == '\n')
+      continue;
+    if ((Num & (Num - 1)) == 0)
+      B->snippets = realloc(B->snippets, (Num ? Num * 2 : 1) * sizeof(char *));
+    B->snippets[Num++] = strdup(Line);
+  }
+  free(Line);
+  fclose(FP);
+  if (!Num) {
+    fprintf(stderr, "no snippets in %s\n", Path);
+    exit(1);
+  }
+  B->snippetNum = Num;
+}
+
+// 延迟升序排列
+static int cmpDouble(const void *A, const void *B) {
+  double X = *(const double *)A, Y = *(const double *)B;
+  return (X > Y) - (X < Y);
+}
+
+int main(int args, char **argv) {
+  Bench B = {.requests = 10000, .clients = 4};
+  atomic_init(&B.next, 0);
+  atomic_init(&B.failures, 0);
+  const char *Path = NULL;
+  for (int i = 1; i < args; i++) {
+    if (i + 1 < args && !strcmp(argv[i], "-c"))
+      B.clients = atoi(argv[++i]);
+    else if (i + 1 < args && !strcmp(argv[i], "-n"))
+      B.requests = atoi(argv[++i]);
+    else if (i + 1 < args && !strcmp(argv[i], "--server"))
+      B.socket = argv[++i];
+    else if (i + 1 < args && !strcmp(argv[i], "--exec"))
+      B.qcc = argv[++i];
+    else
+      Path = argv[i];
+  }
+  if (!Path || !B.clients || !B.requests || !B.socket == !B.qcc) {
+    fprintf(stderr, "usage: %s [-c <clients>] [-n <requests>] "
+                    "--server <socket> | --exec <qcc> <snippets>\n",
+            argv[0]);
+    return 1;
+  }
+  readSnippets(&B, Path);
+  B.latency = calloc(B.requests, sizeof(double));
+
+  pthread_t *Tids = calloc(B.clients, sizeof(pthread_t));
+  double T = now();
+  for (unsigned i = 0; i < B.clients; i++)
+    pthread_create(&Tids[i], NULL, client, &B);
+  for (unsigned i = 0; i < B.clients; i++)
+    pthread_join(Tids[i], NULL);
+  T = now() - T;
+
+  qsort(B.latency, B.requests, sizeof(double), cmpDouble);
+  double P50 = B.latency[B.requests / 2];
+  double P99 = B.latency[(size_t)B.requests * 99 / 100];
+  printf("  %u requests, %u clients, %u failed (%s)\n", B.requests, B.clients,
+         atomic_load(&B.failures), B.socket ? "server" : "exec");
+  printf("  throughput %10.0f requests/s\n", B.requests / T);
+  printf("  latency    p50 %8.3fms  p99 %8.3fms  max %8.3fms\n", P50 * 1e3,
+         P99 * 1e3, B.latency[B.requests - 1] * 1e3);
+  return atomic_load(&B.failures) != 0;
+}
@@ -0,0 +1,71 @@
+#include "Compiler.h"
+
+// 首块大小，之后每块倍增，直到上限
+#define ARENA_CHUNK_MIN (64 * 1024)
+#define ARENA_CHUNK_MAX (4 * 1024 * 1024)
+
+struct ArenaChunk {
+  ArenaChunk *next;                  // 下一块
+  size_t cap;                        // 数据区字节数
+  _Alignas(ARENA_ALIGN) char data[]; // 数据区
+};
+
+void *arenaAllocSlow(Arena *A, size_t Size) {
+  // 新块大小为上一块的两倍，超大的分配单独成块
+  size_t Cap = A->chunks ? A->chunks->cap * 2 : ARENA_CHUNK_MIN;
+  if (Cap > ARENA_CHUNK_MAX)
+    Cap = ARENA_CHUNK_MAX;
+  if (Cap < Size)
+    Cap = Size;
+
+  ArenaChunk *Chunk = malloc(sizeof(ArenaChunk) + Cap);
+  if (!Chunk)
+    error("out of memory");
+  Chunk->next = A->chunks;
+  Chunk->cap = Cap;
+  A->chunks = Chunk;
+  A->chunkCount++;
+  A->reserved += Cap;
+
+  A->ptr = Chunk->data + Size;
+  A->end = Chunk->data + Cap;
+  return memset(Chunk->data, 0, Size);
+}
+
+void arenaReset(Arena *A) {
+  if (!A->chunks)
+    return;
+  // 保留当前块，即最大的块，释放其余
+  ArenaChunk *Keep = A->chunks;
+  ArenaChunk *Chunk = Keep->next;
+  while (Chunk) {
+    ArenaChunk *Next = Chunk->next;
+    free(Chunk);
+    Chunk = Next;
+  }
+  Keep->next = NULL;
+  *A = (Arena){.chunks = Keep,
+               .ptr = Keep->data,
+               .end = Keep->data + Keep->cap,
+               .chunkCount = 1,
+               .reserved = Keep->cap};
+}
+
+void arenaFree(Arena *A) {
+  arenaReset(A);
+  free(A->chunks);
+  *A = (Arena){0};
+}
+
+void *growStack(void *Stack, unsigned int *Cap, unsigned int Top,
+                size_t Size) {
+  if (Top < *Cap)
+    return Stack;
+  // 扩容失败时原栈与容量不变，上下文之后仍可复用
+  unsigned int NewCap = *Cap ? *Cap * 2 : 16;
+  Stack = realloc(Stack, NewCap * Size);
+  if (!Stack)
+    error("out of memory");
+  *Cap = NewCap;
+  return Stack;
+}
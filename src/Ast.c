@@ -0,0 +1,84 @@
+#include "Compiler.h"
+
+// 语法树初始容量
+#define AST_INIT_CAP 1024
+
+/**
+ * @brief 按容量在内存块中划分各列，按对齐要求从大到小排列
+ *
+ * @param ast 语法树
+ * @param Buf 内存块
+ * @param Cap 容量
+ */
+static void layout(Ast *ast, void *Buf, unsigned int Cap) {
+  ast->Buf = Buf;
+  ast->Cap = Cap;
+  ast->Data = Buf;
+  ast->LHS = (NodeId *)(ast->Data + Cap);
+  ast->RHS = ast->LHS + Cap;
+  ast->Loc = ast->RHS + Cap;
+  ast->Kind = (unsigned char *)(ast->Loc + Cap);
+}
+
+/**
+ * @brief 容量翻倍，各列分别复制到新内存块中
+ *
+ * @param ast 语法树
+ */
+static void grow(Ast *ast) {
+  Ast Old = *ast;
+  unsigned int Cap = Old.Cap ? Old.Cap * 2 : AST_INIT_CAP;
+  void *Buf = malloc(Cap * AST_NODE_BYTES);
+  if (!Buf)
+    error("out of memory");
+  layout(ast, Buf, Cap);
+  if (!Old.Buf)
+    return;
+  memcpy(ast->Data, Old.Data, Old.Len * sizeof(NodeData));
+  memcpy(ast->LHS, Old.LHS, Old.Len * sizeof(NodeId));
+  memcpy(ast->RHS, Old.RHS, Old.Len * sizeof(NodeId));
+  memcpy(ast->Loc, Old.Loc, Old.Len * sizeof(unsigned int));
+  memcpy(ast->Kind, Old.Kind, Old.Len);
+  free(Old.Buf);
+}
+
+NodeId astNew(Ast *ast, NodeKind Kind) {
+  if (ast->Len == ast->Cap)
+    grow(ast);
+  // 0 号为空节点
+  if (ast->Len == 0) {
+    ast->Len = 1;
+    ast->Data[0] = (NodeData){0};
+    ast->LHS[0] = ast->RHS[0] = ast->Loc[0] = 0;
+    ast->Kind[0] = BLOCK;
+  }
+  NodeId Id = ast->Len++;
+  ast->Data[Id] = (NodeData){0};
+  ast->LHS[Id] = ast->RHS[Id] = ast->Loc[Id] = 0;
+  ast->Kind[Id] = Kind;
+  return Id;
+}
+
+void astCopy(Ast *Dst, const Ast *Src) {
+  *Dst = (Ast){0};
+  if (!Src->Buf)
+    return;
+  size_t Size = Src->Cap * AST_NODE_BYTES;
+  void *Buf = malloc(Size);
+  if (!Buf)
+    error("out of memory");
+  layout(Dst, memcpy(Buf, Src->Buf, Size), Src->Cap);
+  Dst->Len = Src->Len;
+}
+
+void astReset(Ast *ast) { ast->Len = 0; }
+
+void astFree(Ast *ast) {
+  free(ast->Buf);
+  *ast = (Ast){0};
+}
+
+void astVisit(Ast *ast, AstVisitor Fn, void *Arg) {
+  for (NodeId Id = 1; Id < ast->Len; Id++)
+    Fn(ast, Id, Arg);
+}
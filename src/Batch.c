@@ -0,0 +1,297 @@
+#include "Compiler.h"
+#include "qcc.h"
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+// 多文件编译的共享状态
+typedef struct {
+  const char *const *paths; // 源文件
+  char **outPaths;          // 各源文件的汇编文件
+  unsigned num;             // 源文件个数
+  unsigned *order;          // 领取顺序，按文件大小降序
+  char **diags;             // 各源文件的诊断信息，全部完成后按输入顺序输出
+  bool *failed;             // 各源文件是否编译失败
+  QccContext **ctxs;        // 各工作线程的编译上下文
+  atomic_uint next;         // 下一个待领取的位置
+  atomic_bool oom;          // 是否有诊断信息因内存不足而丢失
+} Batch;
+
+// 排序用的源文件大小与编号
+typedef struct {
+  off_t size;
+  unsigned idx;
+} FileSize;
+
+/**
+ * @brief 比较源文件大小，大文件在前，大小相同时按输入顺序
+ *
+ * @param A 源文件
+ * @param B 源文件
+ * @return int 比较结果，同 qsort
+ */
+static int cmpFileSize(const void *A, const void *B) {
+  const FileSize *X = A, *Y = B;
+  if (X->size != Y->size)
+    return X->size < Y->size ? 1 : -1;
+  return X->idx < Y->idx ? -1 : X->idx > Y->idx;
+}
+
+/**
+ * @brief 按格式生成字符串，同 sprintf
+ *
+ * @param Fmt 格式
+ * @return char* 字符串，由调用方释放，内存不足时为 NULL
+ */
+static char *format(const char *Fmt, ...) {
+  va_list VA;
+  va_start(VA, Fmt);
+  int Len = vsnprintf(NULL, 0, Fmt, VA);
+  va_end(VA);
+  char *Str = Len < 0 ? NULL : malloc(Len + 1);
+  if (Str) {
+    va_start(VA, Fmt);
+    vsnprintf(Str, Len + 1, Fmt, VA);
+    va_end(VA);
+  }
+  return Str;
+}
+
+/**
+ * @brief 汇编文件路径，a.c 为 a.s，其余追加 .s
+ *
+ * @param Path 源文件路径
+ * @return char* 汇编文件路径，内存不足时为 NULL
+ */
+static char *outputPath(const char *Path) {
+  size_t Len = strlen(Path);
+  char *Out = malloc(Len + 3);
+  if (!Out)
+    return NULL;
+  memcpy(Out, Path, Len);
+  if (Len > 2 && !strcmp(Path + Len - 2, ".c"))
+    Len -= 2;
+  strcpy(Out + Len, ".s");
+  return Out;
+}
+
+// 汇编文件的身份：所在目录的设备号与 inode 加文件名，
+// 使 x.s 与 ./x.s 等指向同一文件的写法相同
+typedef struct {
+  dev_t dev;
+  ino_t ino;
+  const char *name; // 文件名，目录不存在时为整个路径
+} OutputId;
+
+/**
+ * @brief 求汇编文件的身份，目录不存在时以整个路径代替，写入时自会报错
+ *
+ * @param Path 汇编文件路径
+ * @param Id 返回身份
+ * @return true 成功
+ * @return false 内存不足
+ */
+static bool outputId(const char *Path, OutputId *Id) {
+  const char *Name = strrchr(Path, '/');
+  char *Dir = Name ? strndup(Path, Name == Path ? 1 : Name - Path) : NULL;
+  if (Name && !Dir)
+    return false;
+  struct stat St;
+  if (stat(Dir ? Dir : ".", &St)) {
+    *Id = (OutputId){0, 0, Path};
+  } else {
+    *Id = (OutputId){St.st_dev, St.st_ino, Name ? Name + 1 : Path};
+  }
+  free(Dir);
+  return true;
+}
+
+/**
+ * @brief 检查各汇编文件是否重名，否则多个线程会同时写入同一文件
+ *
+ * @param B 共享状态
+ * @param Diag 重名时返回原因
+ * @return true 没有重名
+ * @return false 重名或内存不足
+ */
+static bool checkOutputs(Batch *B, char **Diag) {
+  OutputId *Ids = calloc(B->num, sizeof(OutputId));
+  bool Ok = Ids != NULL;
+  for (unsigned i = 0; i < B->num && Ok; i++) {
+    Ok = outputId(B->outPaths[i], &Ids[i]);
+    for (unsigned j = 0; j < i && Ok; j++) {
+      if (Ids[i].dev == Ids[j].dev && Ids[i].ino == Ids[j].ino &&
+          !strcmp(Ids[i].name, Ids[j].name)) {
+        *Diag = format("qcc: %s and %s both write %s\n", B->paths[j],
+                       B->paths[i], B->outPaths[i]);
+        Ok = false;
+      }
+    }
+  }
+  free(Ids);
+  return Ok;
+}
+
+/**
+ * @brief 编译一个源文件，成功时汇编一次写入其汇编文件
+ *
+ * @param Ctx 编译上下文
+ * @param Path 源文件路径
+ * @param OutPath 汇编文件路径
+ * @param Diag 返回诊断信息，没有时为 NULL
+ * @return true 成功
+ * @return false 失败
+ */
+static bool compileFile(QccContext *Ctx, const char *Path,
+                        const char *OutPath, char **Diag) {
+  QccStatus Status = qccCompileFile(Ctx, Path, NULL);
+  if (Status == QCC_OK)
+    Status = qccWriteOutput(Ctx, OutPath);
+
+  const char *Msg = qccDiagnostics(Ctx);
+  *Diag = *Msg ? strdup(Msg) : NULL;
+  return Status == QCC_OK;
+}
+
+/**
+ * @brief 工作线程，按大小降序领取源文件，用自己的编译上下文编译
+ *
+ * @param Arg 共享状态
+ * @param Job 工作线程编号
+ */
+static void batchWorker(void *Arg, unsigned int Job) {
+  Batch *B = Arg;
+  unsigned I;
+  while ((I = atomic_fetch_add(&B->next, 1)) < B->num) {
+    unsigned F = B->order[I];
+    B->failed[F] = !compileFile(B->ctxs[Job], B->paths[F], B->outPaths[F],
+                                &B->diags[F]);
+    if (!B->diags[F] && *qccDiagnostics(B->ctxs[Job]))
+      atomic_store(&B->oom, true);
+  }
+}
+
+/**
+ * @brief 将各段诊断信息依次拼接，内存不足而丢失的信息以一行说明代替
+ *
+ * @param Parts 各段诊断信息，可为 NULL
+ * @param N 段数
+ * @param Oom 是否有信息因内存不足而丢失
+ * @return char* 诊断信息，由调用方释放，没有或内存不足时为 NULL
+ */
+static char *joinDiags(char *const *Parts, unsigned N, bool Oom) {
+  static const char OomMsg[] = "qcc: out of memory\n";
+  size_t Len = Oom ? sizeof(OomMsg) - 1 : 0;
+  for (unsigned i = 0; i < N; i++)
+    Len += Parts[i] ? strlen(Parts[i]) : 0;
+  if (!Len)
+    return NULL;
+
+  char *Diag = malloc(Len + 1);
+  if (!Diag)
+    return NULL;
+  char *P = Diag;
+  for (unsigned i = 0; i < N; i++) {
+    if (Parts[i]) {
+      size_t L = strlen(Parts[i]);
+      memcpy(P, Parts[i], L);
+      P += L;
+    }
+  }
+  if (Oom) {
+    memcpy(P, OomMsg, sizeof(OomMsg) - 1);
+    P += sizeof(OomMsg) - 1;
+  }
+  *P = '\0';
+  return Diag;
+}
+
+/**
+ * @brief 准备编译：生成汇编文件路径并检查重名，按大小排序，生成编译上下文
+ *
+ * @param B 共享状态
+ * @param Jobs 线程数
+ * @param Opts 编译选项
+ * @param NOpts 编译选项个数
+ * @param Msg 失败时返回原因，内存不足时为 NULL
+ * @return true 成功
+ * @return false 失败
+ */
+static bool prepareBatch(Batch *B, unsigned Jobs, const char *const *Opts,
+                         int NOpts, char **Msg) {
+  B->outPaths = calloc(B->num, sizeof(char *));
+  B->order = calloc(B->num, sizeof(unsigned));
+  B->diags = calloc(B->num, sizeof(char *));
+  B->failed = calloc(B->num, sizeof(bool));
+  if (!B->outPaths || !B->order || !B->diags || !B->failed)
+    return false;
+  for (unsigned i = 0; i < B->num; i++) {
+    if (!(B->outPaths[i] = outputPath(B->paths[i])))
+      return false;
+  }
+  if (!checkOutputs(B, Msg))
+    return false;
+
+  // 先编译大文件，最后剩下的都是小文件，各线程几乎同时结束
+  FileSize *Sizes = calloc(B->num, sizeof(FileSize));
+  if (!Sizes)
+    return false;
+  for (unsigned i = 0; i < B->num; i++) {
+    struct stat St;
+    Sizes[i] = (FileSize){stat(B->paths[i], &St) ? 0 : St.st_size, i};
+  }
+  qsort(Sizes, B->num, sizeof(FileSize), cmpFileSize);
+  for (unsigned i = 0; i < B->num; i++)
+    B->order[i] = Sizes[i].idx;
+  free(Sizes);
+
+  B->ctxs = newContexts(Jobs, Opts, NOpts, Msg);
+  return B->ctxs != NULL;
+}
+
+int qccCompileFiles(const char *const *Paths, int NPaths, unsigned Jobs,
+                    const char *const *Opts, int NOpts, char **Diag) {
+  Batch B = {.paths = Paths, .num = NPaths};
+  atomic_init(&B.next, 0);
+  atomic_init(&B.oom, false);
+  *Diag = NULL;
+  if (!B.num)
+    return 0;
+
+  // 线程数不超过文件数，每个线程一个编译上下文
+  if (!Jobs)
+    Jobs = cpuCount();
+  if (Jobs > B.num)
+    Jobs = B.num;
+
+  // 出错原因与诊断信息都经 Diag 返回，不直接输出
+  int Ret = 1;
+  char *Msg = NULL;
+  if (prepareBatch(&B, Jobs, Opts, NOpts, &Msg)) {
+    parallelFor(Jobs, Jobs, batchWorker, &B);
+    freeContexts(B.ctxs, Jobs);
+
+    // 诊断信息按输入顺序拼接，与线程数无关
+    Ret = 0;
+    for (unsigned i = 0; i < B.num; i++) {
+      if (B.failed[i])
+        Ret = 1;
+    }
+    *Diag = joinDiags(B.diags, B.num, atomic_load(&B.oom));
+  } else {
+    *Diag = joinDiags(&Msg, 1, !Msg);
+    free(Msg);
+  }
+
+  for (unsigned i = 0; i < B.num; i++) {
+    if (B.outPaths)
+      free(B.outPaths[i]);
+    if (B.diags)
+      free(B.diags[i]);
+  }
+  free(B.outPaths);
+  free(B.order);
+  free(B.diags);
+  free(B.failed);
+  return Ret;
+}
@@ -1,267 +1,1167 @@
 #include "Compiler.h"
+#include <limits.h>
+
+// 由中间表示生成汇编
+// 寄存器按线性扫描分配：指令按布局顺序编号，值从定义到最后一次使用占用一个寄存器，
+// 块只向后跳转，这一区间覆盖了值可能存活的所有位置
+// φ 从第一个前驱的终结指令起占用寄存器，各前驱在终结指令之前把流入的值移入
+
+// 参与分配的寄存器，分配时取编号最小的空闲寄存器
+// a0 在最前，返回值常可直接留在 a0；s 寄存器由被调用者保存，用到时在前言中保存
+static const unsigned char Regs[] = {
+    R_A0, R_A1, R_A2, R_A3, R_A4, R_A5, R_A6, R_A7, R_T0, R_T1, R_T2, R_T3,
+    R_T4, R_S1, R_S2, R_S3, R_S4, R_S5, R_S6, R_S7, R_S8, R_S9, R_S10, R_S11,
+};
+#define REG_NUM (sizeof(Regs) / sizeof(*Regs))
+// 第一个 s 寄存器在 Regs 中的下标
+#define FIRST_SAVED 13
+// t5、t6 不参与分配，用于读写溢出的值与打破 φ 移动的环
+#define SCRATCH0 R_T5
+#define SCRATCH1 R_T6
+
+// 寄存器在 Regs 中的下标，不参与分配的为 -1
+static const signed char RegIndex[] = {
+    -1, -1, -1, -1, 0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10,
+    11, 12, -1, -1, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23,
+};
+
+// 值的位置：不小于 0 时为寄存器，undef 与常数 0 为 zero 寄存器；
+// 分配时溢出的值记为 -(槽号 + 1)，分配完成后改为溢出槽相对 fp 的偏移量
+
+// φ 的一次移动，目标与来源为值的位置，来源为常数时 Src 为 LOC_IMM
+typedef struct {
+  int Dst;  // 目标位置
+  int Src;  // 来源位置
+  long Imm; // 来源常数
+} Move;
+
+// 来源为常数
+#define LOC_IMM INT_MIN
+
+// 指令选择的结果：一侧操作数为常数时改用立即数形式 Op Rd, Args[Arg], Imm，
+// 常数不再占用寄存器；Then 不为 0 时再对 Rd 做一次 Then，OP_XORI 为与 1 异或
+typedef struct {
+  unsigned char Op;   // 立即数形式的指令
+  unsigned char Then; // 之后对结果的运算：OP_XORI、OP_SEQZ、OP_SNEZ 或 0
+  unsigned char Arg;  // 留在寄存器中的操作数
+  long Imm;           // 立即数
+} ImmTile;
+
+// 常数装入寄存器最多用的指令条数，超过时从常数池读取
+#define MAX_IMM_SEQ 3
+
+// 寄存器名，下标为 Register
+static const char *const RegNames[] = {
+    "zero", "ra", "sp", "fp", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6",   "a7", "t0", "t1", "t2", "t3", "t4", "t5", "t6", "s1",
+    "s2",   "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11",
+};
+
+// 指令助记符，下标为 Opcode
+static const char *const OpNames[] = {
+    [OP_ADD] = "add",   [OP_SUB] = "sub",   [OP_MUL] = "mul",
+    [OP_DIV] = "div",   [OP_REM] = "rem",   [OP_SLL] = "sll",
+    [OP_SRA] = "sra",   [OP_AND] = "and",   [OP_OR] = "or",
+    [OP_XOR] = "xor",   [OP_SLT] = "slt",   [OP_ADDI] = "addi",
+    [OP_ADDIW] = "addiw", [OP_ANDI] = "andi", [OP_ORI] = "ori",
+    [OP_XORI] = "xori", [OP_SLTI] = "slti", [OP_SLLI] = "slli",
+    [OP_SRAI] = "srai", [OP_MV] = "mv",     [OP_NEG] = "neg",
+    [OP_NOT] = "not",   [OP_SEQZ] = "seqz", [OP_SNEZ] = "snez",
+    [OP_LI] = "li",     [OP_LUI] = "lui",   [OP_LA] = "la",
+    [OP_LD] = "ld",     [OP_SD] = "sd",     [OP_BEQZ] = "beqz",
+    [OP_BNEZ] = "bnez", [OP_J] = "j",
+};
+
+// 二元运算对应的指令，比较运算另行处理
+static const unsigned char BinInsts[] = {
+    [IR_ADD] = OP_ADD, [IR_SUB] = OP_SUB, [IR_MUL] = OP_MUL,
+    [IR_DIV] = OP_DIV, [IR_REM] = OP_REM, [IR_SHL] = OP_SLL,
+    [IR_SHR] = OP_SRA, [IR_AND] = OP_AND, [IR_OR] = OP_OR,
+    [IR_XOR] = OP_XOR,
+};
+
+// 指令序列达到这个长度后，在中间表示的指令之间优化并输出，不必整个函数留在内存
+#define INST_FLUSH 4096
+
+// 代码生成器，一个编译单元内的生成状态，数组各编译单元复用
+struct Codegener {
+  StrBuf *out;    // 汇编输出
+  InstList insts; // 待优化与输出的指令
+  StrBuf text;    // -fverbose-asm 时中间表示指令的文本
+  bool verbose;   // 是否输出注释，-fverbose-asm 时为真
+  bool peephole;  // 是否进行窥孔优化，-fno-peephole 时为假
+
+  // 寄存器分配，值的数组以值编号为下标
+  IrInst **order;         // 按布局顺序排列的指令，下标即位置
+  unsigned int orderCap;  // order 的容量
+  IrBlock **blocks;       // 各块，以块编号为下标
+  unsigned int blockCap;  // blocks 的容量
+  unsigned int *termPos;  // 各块终结指令的位置，以块编号为下标
+  unsigned int termCap;   // termPos 的容量
+  unsigned int *start;    // 值开始占用寄存器的位置
+  unsigned int *end;      // 值最后一次使用的位置，为 0 时值不被使用
+  int *loc;               // 值的位置
+  unsigned char *hint;    // 值希望分配到的寄存器，没有时为 R_ZERO
+  unsigned int valueCap;  // 值的数组的容量
+  unsigned int owner[REG_NUM]; // 各寄存器上的值
+  uint32_t freeRegs;      // 空闲寄存器的集合，以 Regs 中的下标为位
+  unsigned int usedRegs;  // 用到的寄存器在 Regs 中的最大下标加一
+  unsigned int *slotEnd;  // 各溢出槽上最后一个值的结束位置
+  unsigned int slotNum;   // 溢出槽个数
+  unsigned int slotCap;   // slotEnd 的容量
+  Move *moves;            // 一条边上待完成的 φ 移动
+  unsigned int moveCap;   // moves 的容量
+  long *pool;             // 常数池，装入指令过多的 64 位常数
+  unsigned int poolLen;   // 常数池项数
+  unsigned int poolCap;   // pool 的容量
+
+  // 栈帧中 fp 之下依次为保存的 s 寄存器与溢出槽，偏移量相对于 fp
+  unsigned int savedNum; // 用到的 s 寄存器个数
+  int spillOffset;       // 第一个溢出槽之上
+};
 
-static unsigned int Depth;
 
 /**
- * @brief 将 a0 压栈
+ * @brief 输出一段汇编文本
+ * 汇编由固定文本与整数拼成，直接追加到输出缓冲区，不经过 printf 解析格式
  *
+ * @param codegener 代码生成器
+ * @param Str 文本
  */
-static void push(void) {
-  printf("    # 将 a0 压栈\n");
-  printf("    addi sp, sp, -8\n");
-  printf("    sd a0, 0(sp)\n");
-  Depth++;
+static inline void emit(Codegener *codegener, const char *Str) {
+  strBufAppend(codegener->out, Str, strlen(Str));
 }
 
 /**
- * @brief 弹栈到指定寄存器
+ * @brief 依次输出 Head、十进制整数 Val 与 Tail
  *
- * @param reg 目标寄存器 reg
+ * @param codegener 代码生成器
+ * @param Head 整数之前的文本
+ * @param Val 整数
+ * @param Tail 整数之后的文本
  */
-static void pop(char *reg) {
-  printf("    # 弹栈入 %s \n", reg);
-  printf("    ld %s, 0(sp)\n", reg);
-  printf("    addi sp, sp, 8\n");
-  Depth--;
+static void emitNum(Codegener *codegener, const char *Head, long Val,
+                    const char *Tail) {
+  // 从低位起倒序写入，取绝对值时避免 LONG_MIN 溢出
+  char Buf[24];
+  char *P = Buf + sizeof(Buf);
+  unsigned long U = Val < 0 ? -(unsigned long)Val : (unsigned long)Val;
+  do {
+    *--P = '0' + U % 10;
+    U /= 10;
+  } while (U);
+  if (Val < 0)
+    *--P = '-';
+
+  emit(codegener, Head);
+  strBufAppend(codegener->out, P, Buf + sizeof(Buf) - P);
+  emit(codegener, Tail);
 }
 
 /**
- * @brief 生成变量节点绝对地址
+ * @brief 输出标签名
  *
- * @param node 变量节点
+ * @param codegener 代码生成器
+ * @param Label 标签编号
+ * @param Tail 标签名之后的文本
  */
-static void genAddr(Node *node) {
-  if (node->Kind == VAR) {
-    // 偏移量是相对于fp的
-    printf("    # 令 a0 = %s 的地址\n", node->Var->Name);
-    printf("    addi a0, fp, %ld\n", node->Var->Offset);
-    return;
+static void emitLabel(Codegener *codegener, long Label, const char *Tail) {
+  if (Label == LABEL_RETURN) {
+    emit(codegener, ".L.return");
+    emit(codegener, Tail);
+  } else {
+    emitNum(codegener, ".L.bb.", Label - 1, Tail);
   }
-
-  error("Not Assignable\n");
 }
 
 /**
- * @brief 生成节点表达式语句值
+ * @brief 将一条指令输出为汇编文本
  *
- * @param node 表达式语句节点
+ * @param codegener 代码生成器
+ * @param I 指令
  */
-static void genExpr(Node *node) {
-  switch (node->Kind) {
-
-  // 常数节点
-  case NUM:
-    printf("    # 将立即数 %d 写入 a0\n", node->Val);
-    printf("    li a0, %d\n", node->Val);
-    return;
-  // 变量节点
-  case VAR:
-    genAddr(node);
-    printf("    # 读取变量值\n");
-    printf("    ld a0, 0(a0)\n");
+static void emitInst(Codegener *codegener, const Inst *I) {
+  switch (I->Op) {
+  case OP_LABEL:
+    emitLabel(codegener, I->Imm, ":\n");
     return;
-  // 取反节点
-  case NEG:
-    genExpr(node->LHS);
-    printf("    # a0 中的值取反放入 a0\n");
-    printf("    neg a0, a0\n");
+  case OP_RET:
+    emit(codegener, "  ret\n");
     return;
-  // 赋值节点
-  case ASSIGN:
-    // 左部是左值，保存值到的地址
-    genAddr(node->LHS);
-    push();
-    // 右部是右值，为表达式的值
-    genExpr(node->RHS);
-    pop("a1");
-    printf("    # 将 a0 值 存入 a1 指向的内存地址\n");
-    printf("    sd a0, 0(a1)\n");
+  case OP_COMMENT:
+    emit(codegener, "    # ");
+    emit(codegener, codegener->insts.notes.buf + I->Imm);
+    emit(codegener, "\n");
     return;
   default:
     break;
   }
 
-  // 递归至最右节点
-  genExpr(node->RHS);
-  // 右节点值压栈
-  push();
-  // 产生左节点值至 a0
-  genExpr(node->LHS);
-  // 弹栈右节点值至 a1
-  pop("a1");
-
-  // 运算符节点
-  switch (node->Kind) {
-  case ADD:
-    printf("    # 令 a0 = a0 + a1\n");
-    printf("    add a0, a0, a1\n");
-    return;
-  case SUB:
-    printf("    # 令 a0 = a0 - a1\n");
-    printf("    sub a0, a0, a1\n");
+  emit(codegener, "    ");
+  emit(codegener, OpNames[I->Op]);
+  emit(codegener, " ");
+  switch (I->Op) {
+  case OP_J:
+    emitLabel(codegener, I->Imm, "\n");
     return;
-  case MUL:
-    printf("    # 令 a0 = a0 * a1\n");
-    printf("    mul a0, a0, a1\n");
+  case OP_BEQZ:
+  case OP_BNEZ:
+    emit(codegener, RegNames[I->Rs1]);
+    emit(codegener, ", ");
+    emitLabel(codegener, I->Imm, "\n");
     return;
-  case DIV:
-    printf("    # 令 a0 = a0 / a1\n");
-    printf("    div a0, a0, a1\n");
+  case OP_SD:
+    emit(codegener, RegNames[I->Rs2]);
+    emitNum(codegener, ", ", I->Imm, "(");
+    emit(codegener, RegNames[I->Rs1]);
+    emit(codegener, ")\n");
     return;
-  case EQ:
-  case NE:
-    printf("    # 令 a0 = a0 ^ a1\n");
-    printf("    xor a0, a0, a1\n");
-    if (node->Kind == EQ) {
-      printf("    # 令 a0 = (a0 == 0)\n");
-      printf("    seqz a0, a0\n");
-    } else {
-      printf("    # 令 a0 = (a0 != 0)\n");
-      printf("    snez a0, a0\n");
-    }
-    return;
-  case LT:
-    printf("    # 令 a0 = a0 < a1\n");
-    printf("    slt a0, a0, a1\n");
-    return;
-  case GT:
-    printf("    # 令 a0 = a0 > a1\n");
-    printf("    slt a0, a1, a0\n");
+  case OP_LD:
+    emit(codegener, RegNames[I->Rd]);
+    emitNum(codegener, ", ", I->Imm, "(");
+    emit(codegener, RegNames[I->Rs1]);
+    emit(codegener, ")\n");
     return;
-  case LE:
-    printf("    # 令 a0 = a0 <= a1\n");
-    printf("    slt a0, a1, a0\n");
-    printf("    xori a0, a0, 1\n");
+  case OP_LI:
+  case OP_LUI:
+    emit(codegener, RegNames[I->Rd]);
+    emitNum(codegener, ", ", I->Imm, "\n");
     return;
-  case GE:
-    printf("    # 令 a0 = a0 >= a1\n");
-    printf("    slt a0, a0, a1\n");
-    printf("    xori a0, a0, 1\n");
+  case OP_LA:
+    emit(codegener, RegNames[I->Rd]);
+    emitNum(codegener, ", .L.const.", I->Imm, "\n");
     return;
   default:
     break;
   }
-  error("invalid expresion");
+
+  // 算术指令：目标寄存器、源寄存器，再跟第二个源寄存器或立即数
+  emit(codegener, RegNames[I->Rd]);
+  emit(codegener, ", ");
+  emit(codegener, RegNames[I->Rs1]);
+  if (I->Op <= OP_SLT) {
+    emit(codegener, ", ");
+    emit(codegener, RegNames[I->Rs2]);
+    emit(codegener, "\n");
+  } else if (I->Op <= OP_SRAI) {
+    emitNum(codegener, ", ", I->Imm, "\n");
+  } else {
+    emit(codegener, "\n");
+  }
+}
+
+/**
+ * @brief 优化已生成的指令并输出为汇编文本，然后清空指令序列
+ *
+ * @param codegener 代码生成器
+ */
+static void flushInsts(Codegener *codegener) {
+  InstList *L = &codegener->insts;
+  if (codegener->peephole)
+    peephole(L);
+  for (unsigned int i = 0; i < L->len; i++)
+    emitInst(codegener, &L->buf[i]);
+  L->len = 0;
+  strBufClear(&L->notes);
+}
+
+/**
+ * @brief 在指令序列末尾追加一条指令
+ *
+ * @param codegener 代码生成器
+ * @param Op 指令种类
+ * @param Rd 目标寄存器
+ * @param Rs1 第一个源寄存器
+ * @param Rs2 第二个源寄存器
+ * @param Imm 立即数、偏移量或标签编号
+ */
+static void inst(Codegener *codegener, Opcode Op, Register Rd, Register Rs1,
+                 Register Rs2, long Imm) {
+  InstList *L = &codegener->insts;
+  L->buf = growStack(L->buf, &L->cap, L->len, sizeof(Inst));
+  L->buf[L->len++] = (Inst){Op, Rd, Rs1, Rs2, Imm};
+}
+
+/**
+ * @brief 生成 op Rd, Rs1, Rs2 或 op Rd, Rs1
+ *
+ * @param codegener 代码生成器
+ * @param Op 指令种类
+ * @param Rd 目标寄存器
+ * @param Rs1 第一个源寄存器
+ * @param Rs2 第二个源寄存器，单操作数指令为 R_ZERO
+ */
+static void instR(Codegener *codegener, Opcode Op, Register Rd, Register Rs1,
+                  Register Rs2) {
+  inst(codegener, Op, Rd, Rs1, Rs2, 0);
 }
 
 /**
- * @brief 生成语句节点汇编
+ * @brief 生成 op Rd, Rs1, Imm、li Rd, Imm 与访存指令 ld Rd, Imm(Rs1)
  *
- * @param Nd 待生成节点
+ * @param codegener 代码生成器
+ * @param Op 指令种类
+ * @param Rd 目标寄存器
+ * @param Rs1 源寄存器或基址
+ * @param Imm 立即数或偏移量
  */
-static void genStmt(Node *node) {
-  switch (node->Kind) {
-    // 表达式节点
-  case EXPR_STMT:
-    genExpr(node->LHS);
+static void instI(Codegener *codegener, Opcode Op, Register Rd, Register Rs1,
+                  long Imm) {
+  inst(codegener, Op, Rd, Rs1, R_ZERO, Imm);
+}
+
+/**
+ * @brief 生成 sd Rs2, Imm(Rs1)
+ *
+ * @param codegener 代码生成器
+ * @param Rs2 存入的值
+ * @param Rs1 基址
+ * @param Imm 偏移量
+ */
+static void instStore(Codegener *codegener, Register Rs2, Register Rs1,
+                      long Imm) {
+  inst(codegener, OP_SD, R_ZERO, Rs1, Rs2, Imm);
+}
+
+/**
+ * @brief 生成跳转与标签：beqz Rs1, 标签、j 标签与标签位置
+ *
+ * @param codegener 代码生成器
+ * @param Op OP_BEQZ、OP_BNEZ、OP_J 或 OP_LABEL
+ * @param Rs1 条件跳转判断的寄存器，其余为 R_ZERO
+ * @param Label 标签编号
+ */
+static void instLabel(Codegener *codegener, Opcode Op, Register Rs1,
+                      long Label) {
+  inst(codegener, Op, R_ZERO, Rs1, R_ZERO, Label);
+}
+
+/**
+ * @brief 生成一行注释，只在 -fverbose-asm 时生成
+ *
+ * @param codegener 代码生成器
+ * @param Fmt 注释内容的格式，同 printf
+ */
+static void comment(Codegener *codegener, const char *Fmt, ...) {
+  if (!codegener->verbose)
     return;
-    // 代码块节点
-  case BLOCK:
-    // 依次生成代码块中的语句
-    for (Node *tmpNode = node->Body; tmpNode; tmpNode = tmpNode->Next) {
-      genStmt(tmpNode);
+  StrBuf *Notes = &codegener->insts.notes;
+  inst(codegener, OP_COMMENT, R_ZERO, R_ZERO, R_ZERO, Notes->len);
+  va_list VA;
+  va_start(VA, Fmt);
+  strBufVPrintf(Notes, Fmt, VA);
+  va_end(VA);
+  // 各条注释以 '\0' 分隔
+  strBufAppend(Notes, "", 1);
+}
+
+/**
+ * @brief 数组容量不足 N 时重新分配，调用方不依赖原有内容
+ * 分配失败时原数组与容量不变
+ *
+ * @param Array 数组
+ * @param Cap 数组容量，不足时更新为 N
+ * @param N 需要的元素个数
+ * @param Size 元素大小
+ * @return void* 容量足够的数组
+ */
+static void *reserve(void *Array, unsigned int *Cap, unsigned int N,
+                     size_t Size) {
+  if (N <= *Cap)
+    return Array;
+  Array = realloc(Array, N * Size);
+  if (!Array)
+    error("out of memory");
+  *Cap = N;
+  return Array;
+}
+
+// 是否为不占寄存器的值：undef 与常数 0 都读 zero 寄存器
+static bool isZero(const IrInst *I) {
+  return I->Op == IR_UNDEF || (I->Op == IR_CONST && !I->Imm);
+}
+
+// Block 在 S 的前驱中的下标
+static unsigned int predIndex(const IrBlock *S, const IrBlock *Block) {
+  unsigned int K = 0;
+  while (S->Preds[K] != Block)
+    K++;
+  return K;
+}
+
+// 立即数能否放进 12 位有符号立即数字段
+static bool isImm12(long V) { return V >= -2048 && V <= 2047; }
+
+/**
+ * @brief 指令选择：二元运算的一侧为常数且有对应的立即数形式时，选出这一形式
+ * 可交换的运算常数可在任一侧；比较运算按需调整常数并在之后取反
+ *
+ * @param I 中间表示的指令
+ * @param T 选出的立即数形式
+ * @return true 使用立即数形式，常数一侧不占寄存器
+ * @return false 使用寄存器形式
+ */
+static bool selectImm(const IrInst *I, ImmTile *T) {
+  const IrInst *A = I->Args[0], *B = I->Args[1];
+  if (!B || (A->Op != IR_CONST && B->Op != IR_CONST))
+    return false;
+  // 两侧都是常数时折叠右侧
+  bool Right = B->Op == IR_CONST;
+  long C = Right ? B->Imm : A->Imm;
+  T->Arg = Right ? 0 : 1;
+  T->Imm = C;
+  T->Then = 0;
+
+  switch (I->Op) {
+  case IR_ADD:
+  case IR_AND:
+  case IR_OR:
+  case IR_XOR:
+    T->Op = I->Op == IR_ADD   ? OP_ADDI
+            : I->Op == IR_AND ? OP_ANDI
+            : I->Op == IR_OR  ? OP_ORI
+                              : OP_XORI;
+    return isImm12(C);
+  // 乘 2 的幂即左移
+  case IR_MUL:
+    if (C <= 0 || (C & (C - 1)))
+      return false;
+    T->Op = OP_SLLI;
+    T->Imm = __builtin_ctzl(C);
+    return true;
+  // 减常数即加其相反数，-(-2048) 超出范围
+  case IR_SUB:
+    T->Op = OP_ADDI;
+    T->Imm = -C;
+    return Right && C > -2048 && C <= 2048;
+  // 移位量只取低 6 位
+  case IR_SHL:
+  case IR_SHR:
+    T->Op = I->Op == IR_SHL ? OP_SLLI : OP_SRAI;
+    T->Imm = C & 63;
+    return Right;
+  // 与 0 比较时直接判断另一侧，不需要立即数
+  case IR_EQ:
+  case IR_NE:
+    T->Op = OP_XORI;
+    T->Then = I->Op == IR_EQ ? OP_SEQZ : OP_SNEZ;
+    return C && isImm12(C);
+  // C < x 即 !(x < C + 1)
+  case IR_LT:
+    T->Op = OP_SLTI;
+    if (Right)
+      return isImm12(C);
+    T->Imm = C + 1;
+    T->Then = OP_XORI;
+    return C >= -2049 && C <= 2046;
+  // x <= C 即 x < C + 1，C <= x 即 !(x < C)
+  case IR_LE:
+    T->Op = OP_SLTI;
+    if (!Right) {
+      T->Then = OP_XORI;
+      return isImm12(C);
+    }
+    T->Imm = C + 1;
+    return C >= -2049 && C <= 2046;
+  default:
+    return false;
+  }
+}
+
+// 值在位置 Pos 被使用，最后一次使用即结束位置
+static void useAt(Codegener *codegener, const IrInst *V, unsigned int Pos) {
+  if (!isZero(V) && codegener->end[V->Id] < Pos)
+    codegener->end[V->Id] = Pos;
+}
+
+/**
+ * @brief 按布局顺序为指令编号，倒序求各值的结束位置
+ * 没有被使用的值不再生成；φ 的操作数在对应前驱的终结指令处使用，
+ * 常数操作数在移动时直接生成，不占寄存器
+ *
+ * @param codegener 代码生成器
+ * @param F 中间表示
+ */
+static void computeLiveness(Codegener *codegener, IrFunc *F) {
+  // 位置从 1 开始，0 表示不被使用
+  unsigned int N = 1;
+  for (IrBlock *B = F->Entry; B; B = B->Next)
+    for (IrInst *I = B->First; I; I = I->Next)
+      N++;
+  codegener->order =
+      reserve(codegener->order, &codegener->orderCap, N, sizeof(IrInst *));
+  codegener->blocks = reserve(codegener->blocks, &codegener->blockCap,
+                              F->NumBlocks, sizeof(IrBlock *));
+  codegener->termPos = reserve(codegener->termPos, &codegener->termCap,
+                               F->NumBlocks, sizeof(unsigned int));
+  unsigned int Cap = codegener->valueCap;
+  codegener->start =
+      reserve(codegener->start, &Cap, F->NumValues, sizeof(unsigned int));
+  Cap = codegener->valueCap;
+  codegener->end =
+      reserve(codegener->end, &Cap, F->NumValues, sizeof(unsigned int));
+  Cap = codegener->valueCap;
+  codegener->loc = reserve(codegener->loc, &Cap, F->NumValues, sizeof(int));
+  codegener->hint =
+      reserve(codegener->hint, &codegener->valueCap, F->NumValues, 1);
+  memset(codegener->end, 0, F->NumValues * sizeof(unsigned int));
+  memset(codegener->loc, 0, F->NumValues * sizeof(int));
+  memset(codegener->hint, R_ZERO, F->NumValues);
+
+  N = 1;
+  for (IrBlock *B = F->Entry; B; B = B->Next) {
+    codegener->blocks[B->Id] = B;
+    for (IrInst *I = B->First; I; I = I->Next)
+      codegener->order[N++] = I;
+    codegener->termPos[B->Id] = N - 1;
+  }
+
+  // 使用总在定义之后，倒序遍历时值的使用都已看到
+  unsigned int *End = codegener->end, *TermPos = codegener->termPos;
+  for (unsigned int Id = F->NumBlocks; Id-- > 0;) {
+    IrBlock *B = codegener->blocks[Id];
+    unsigned int First = Id ? TermPos[Id - 1] + 1 : 1;
+    for (unsigned int P = TermPos[Id]; P >= First; P--) {
+      IrInst *I = codegener->order[P];
+      if (I->Id && !End[I->Id])
+        continue;
+      if (I->Op == IR_PHI) {
+        for (unsigned int K = 0; K < B->NumPreds; K++)
+          if (I->PhiArgs[K]->Op != IR_CONST)
+            useAt(codegener, I->PhiArgs[K], TermPos[B->Preds[K]->Id]);
+        // 各前驱写入之间不能被占用
+        useAt(codegener, I, TermPos[B->Preds[B->NumPreds - 1]->Id]);
+        continue;
+      }
+      // 按常数跳转与返回常数都不需要寄存器
+      if ((I->Op == IR_BR || I->Op == IR_RET) && I->Args[0]->Op == IR_CONST)
+        continue;
+      // 立即数形式中的常数不占寄存器
+      ImmTile T;
+      bool Tiled = selectImm(I, &T);
+      for (unsigned int i = 0; i < 2 && I->Args[i]; i++)
+        if (!Tiled || i == T.Arg)
+          useAt(codegener, I->Args[i], P);
+      if (I->Op == IR_RET)
+        codegener->hint[I->Args[0]->Id] = R_A0;
+    }
+  }
+}
+
+/**
+ * @brief 溢出一个值，复用上一个值已在它开始之前结束的溢出槽，没有时新增
+ * 同一溢出槽上的值依次不重叠，只需比较最后一个
+ *
+ * @param codegener 代码生成器
+ * @param V 值编号
+ */
+static void spillValue(Codegener *codegener, unsigned int V) {
+  unsigned int S = 0;
+  while (S < codegener->slotNum &&
+         codegener->slotEnd[S] >= codegener->start[V])
+    S++;
+  if (S == codegener->slotNum) {
+    codegener->slotEnd =
+        growStack(codegener->slotEnd, &codegener->slotCap, S,
+                  sizeof(unsigned int));
+    codegener->slotNum++;
+  }
+  codegener->slotEnd[S] = codegener->end[V];
+  codegener->loc[V] = -(int)(S + 1);
+}
+
+/**
+ * @brief 为从 Pos 开始的值分配寄存器，优先取 Hint，否则取编号最小的空闲寄存器
+ * 没有空闲寄存器时，结束最晚的值整体溢出，让出寄存器
+ *
+ * @param codegener 代码生成器
+ * @param V 值编号
+ * @param Pos 开始位置
+ * @param Hint 希望分配到的寄存器，没有时为 R_ZERO
+ */
+static void allocate(Codegener *codegener, unsigned int V, unsigned int Pos,
+                     Register Hint) {
+  unsigned int *End = codegener->end, *Owner = codegener->owner;
+  codegener->start[V] = Pos;
+  int Idx = RegIndex[Hint];
+  if (Idx < 0 || !(codegener->freeRegs >> Idx & 1)) {
+    if (codegener->freeRegs) {
+      Idx = __builtin_ctz(codegener->freeRegs);
+    } else {
+      Idx = 0;
+      for (unsigned int i = 1; i < REG_NUM; i++)
+        if (End[Owner[i]] > End[Owner[Idx]])
+          Idx = i;
+      if (End[Owner[Idx]] <= End[V]) {
+        spillValue(codegener, V);
+        return;
+      }
+      spillValue(codegener, Owner[Idx]);
+    }
+  }
+  codegener->freeRegs &= ~(1u << Idx);
+  Owner[Idx] = V;
+  codegener->loc[V] = Regs[Idx];
+  if ((unsigned int)Idx >= codegener->usedRegs)
+    codegener->usedRegs = Idx + 1;
+}
+
+// 值在此结束时释放其寄存器，寄存器已分给其他值时不动
+static void release(Codegener *codegener, const IrInst *V, unsigned int Pos) {
+  int Loc = codegener->loc[V->Id];
+  if (codegener->end[V->Id] != Pos || Loc <= R_ZERO)
+    return;
+  int Idx = RegIndex[Loc];
+  if (codegener->owner[Idx] == V->Id)
+    codegener->freeRegs |= 1u << Idx;
+}
+
+/**
+ * @brief 在块 B 的终结指令处分配寄存器
+ * 先释放在此结束的流入值，使 φ 可以分到同一寄存器而省去移动；
+ * 再为以 B 为第一个前驱的后继中的 φ 分配，最后释放终结指令的操作数
+ *
+ * @param codegener 代码生成器
+ * @param B 基本块
+ * @param Pos 终结指令的位置
+ */
+static void allocateEdges(Codegener *codegener, IrBlock *B, unsigned int Pos) {
+  IrInst *Term = B->Last;
+  for (unsigned int i = 0; i < irNumSuccs(Term); i++) {
+    IrBlock *S = Term->Succs[i];
+    unsigned int K = predIndex(S, B);
+    for (IrInst *Phi = S->First; Phi->Op == IR_PHI; Phi = Phi->Next)
+      if (codegener->end[Phi->Id] && Phi->PhiArgs[K] != Term->Args[0])
+        release(codegener, Phi->PhiArgs[K], Pos);
+  }
+  for (unsigned int i = 0; i < irNumSuccs(Term); i++) {
+    IrBlock *S = Term->Succs[i];
+    if (S->Preds[0] != B)
+      continue;
+    for (IrInst *Phi = S->First; Phi->Op == IR_PHI; Phi = Phi->Next) {
+      if (!codegener->end[Phi->Id])
+        continue;
+      // 流入的值所在的寄存器若已空出，φ 就分到它
+      int Hint = codegener->loc[Phi->PhiArgs[0]->Id];
+      if (Phi->PhiArgs[0]->Op == IR_CONST || Hint < 0)
+        Hint = R_ZERO;
+      allocate(codegener, Phi->Id, Pos, Hint);
     }
+  }
+  if (Term->Args[0])
+    release(codegener, Term->Args[0], Pos);
+}
+
+/**
+ * @brief 线性扫描分配寄存器，溢出的值分到溢出槽
+ * 分配完成后安排栈帧，溢出槽号换为相对 fp 的偏移量
+ *
+ * @param codegener 代码生成器
+ * @param F 中间表示
+ */
+static void allocateRegs(Codegener *codegener, IrFunc *F) {
+  codegener->freeRegs = (1u << REG_NUM) - 1;
+  codegener->usedRegs = 0;
+  codegener->slotNum = 0;
+
+  unsigned int Pos = 0;
+  for (IrBlock *B = F->Entry; B; B = B->Next) {
+    for (IrInst *I = B->First; I; I = I->Next) {
+      Pos++;
+      if (!I->Next) {
+        allocateEdges(codegener, B, Pos);
+        continue;
+      }
+      // φ 已在第一个前驱的终结指令处分配，不使用的值不生成
+      if (I->Op == IR_PHI || isZero(I) || !codegener->end[I->Id])
+        continue;
+      for (unsigned int i = 0; i < 2 && I->Args[i]; i++)
+        release(codegener, I->Args[i], Pos);
+      // 扩展时尽量留在原寄存器，省去移动
+      Register Hint = codegener->hint[I->Id];
+      if (I->Op == IR_ZEXT && Hint == R_ZERO &&
+          codegener->loc[I->Args[0]->Id] > R_ZERO)
+        Hint = codegener->loc[I->Args[0]->Id];
+      allocate(codegener, I->Id, Pos, Hint);
+    }
+  }
+
+  unsigned int Used = codegener->usedRegs;
+  codegener->savedNum = Used > FIRST_SAVED ? Used - FIRST_SAVED : 0;
+  codegener->spillOffset = -8 * (int)codegener->savedNum;
+  for (unsigned int V = 1; V < F->NumValues; V++)
+    if (codegener->loc[V] < 0)
+      codegener->loc[V] = codegener->spillOffset + 8 * codegener->loc[V];
+}
+
+/**
+ * @brief 取得值所在的寄存器，溢出的值先读入 Scratch
+ *
+ * @param codegener 代码生成器
+ * @param V 值
+ * @param Scratch 溢出时使用的临时寄存器
+ * @return Register 值所在的寄存器
+ */
+static Register useReg(Codegener *codegener, const IrInst *V,
+                       Register Scratch) {
+  int Loc = codegener->loc[V->Id];
+  if (Loc >= 0)
+    return Loc;
+  comment(codegener, "从溢出槽读入 %s", RegNames[Scratch]);
+  instI(codegener, OP_LD, Scratch, R_FP, Loc);
+  return Scratch;
+}
+
+/**
+ * @brief 取得写入值时的目标寄存器，溢出时先写入 SCRATCH0
+ * 写入后需调用 spill 存入溢出槽
+ *
+ * @param codegener 代码生成器
+ * @param V 值
+ * @return Register 目标寄存器
+ */
+static Register defReg(Codegener *codegener, const IrInst *V) {
+  int Loc = codegener->loc[V->Id];
+  return Loc >= 0 ? Loc : SCRATCH0;
+}
+
+/**
+ * @brief 值溢出时，将 defReg 取得的寄存器存入溢出槽
+ *
+ * @param codegener 代码生成器
+ * @param V 值
+ * @param Reg defReg 取得的寄存器
+ */
+static void spill(Codegener *codegener, const IrInst *V, Register Reg) {
+  int Loc = codegener->loc[V->Id];
+  if (Loc >= 0)
+    return;
+  comment(codegener, "将 %s 存入溢出槽", RegNames[Reg]);
+  instStore(codegener, Reg, R_FP, Loc);
+}
+
+// 寄存器间复制，来源为 zero 时生成 li
+static void move(Codegener *codegener, Register Rd, Register Rs) {
+  if (Rs == R_ZERO)
+    instI(codegener, OP_LI, Rd, R_ZERO, 0);
+  else if (Rd != Rs)
+    instR(codegener, OP_MV, Rd, Rs, R_ZERO);
+}
+
+// 低 Bits 位作为有符号数
+static long signExtend(unsigned long V, int Bits) {
+  return (long)(V << (64 - Bits)) >> (64 - Bits);
+}
+
+/**
+ * @brief 求出把常数装入 Rd 的指令序列
+ * 12 位以内用 li；32 位以内用 lui 装入高 20 位，再以 addiw 加上低 12 位，
+ * addiw 按 32 位回绕，高 20 位进位到符号位时结果仍正确；
+ * 更大的常数先递归装入去掉低 12 位并移去末尾 0 的高位，再左移并加上低 12 位
+ *
+ * @param Val 常数
+ * @param Rd 目标寄存器
+ * @param Seq 指令序列，至少 8 条的空间
+ * @return unsigned int 指令条数
+ */
+static unsigned int immSeq(long Val, Register Rd, Inst *Seq) {
+  if (isImm12(Val)) {
+    Seq[0] = (Inst){OP_LI, Rd, R_ZERO, R_ZERO, Val};
+    return 1;
+  }
+  long Lo12 = signExtend(Val, 12);
+  if (Val == (int32_t)Val) {
+    unsigned int N = 0;
+    Seq[N++] =
+        (Inst){OP_LUI, Rd, R_ZERO, R_ZERO, ((Val + 0x800) >> 12) & 0xFFFFF};
+    if (Lo12)
+      Seq[N++] = (Inst){OP_ADDIW, Rd, Rd, R_ZERO, Lo12};
+    return N;
+  }
+
+  // 加上 0x800 抵消低 12 位按有符号数相加时的借位
+  unsigned long Hi52 = ((unsigned long)Val + 0x800) >> 12;
+  int Shift = 12 + __builtin_ctzl(Hi52);
+  long Hi = signExtend(Hi52 >> (Shift - 12), 64 - Shift);
+  unsigned int N = immSeq(Hi, Rd, Seq);
+  Seq[N++] = (Inst){OP_SLLI, Rd, Rd, R_ZERO, Shift};
+  if (Lo12)
+    Seq[N++] = (Inst){OP_ADDI, Rd, Rd, R_ZERO, Lo12};
+  return N;
+}
+
+/**
+ * @brief 把 64 位常数装入寄存器，序列超过 MAX_IMM_SEQ 条时改从常数池读取
+ * 读取常数池需要 la 展开的两条指令与一次 ld
+ *
+ * @param codegener 代码生成器
+ * @param Rd 目标寄存器
+ * @param Val 常数
+ */
+static void loadImm(Codegener *codegener, Register Rd, long Val) {
+  Inst Seq[8];
+  unsigned int N = immSeq(Val, Rd, Seq);
+  if (N <= MAX_IMM_SEQ) {
+    for (unsigned int i = 0; i < N; i++)
+      inst(codegener, Seq[i].Op, Seq[i].Rd, Seq[i].Rs1, Seq[i].Rs2,
+           Seq[i].Imm);
     return;
-    // 返回节点
-  case RETURN:
-    // 生成返回值->a0
-    genExpr(node->LHS);
-    printf("    # 函数返回\n");
-    printf("    j .L.return\n");
+  }
+
+  comment(codegener, "从常数池读取 %ld", Val);
+  codegener->pool = growStack(codegener->pool, &codegener->poolCap,
+                              codegener->poolLen, sizeof(long));
+  codegener->pool[codegener->poolLen] = Val;
+  instI(codegener, OP_LA, Rd, R_ZERO, codegener->poolLen++);
+  instI(codegener, OP_LD, Rd, Rd, 0);
+}
+
+/**
+ * @brief 生成一条有值的指令，能用立即数形式时使用立即数形式
+ *
+ * @param codegener 代码生成器
+ * @param I 指令
+ */
+static void genInst(Codegener *codegener, const IrInst *I) {
+  Register Rd = defReg(codegener, I), Ra = R_ZERO, Rb = R_ZERO;
+  ImmTile T;
+  if (selectImm(I, &T)) {
+    Ra = useReg(codegener, I->Args[T.Arg], SCRATCH0);
+    instI(codegener, T.Op, Rd, Ra, T.Imm);
+    if (T.Then == OP_XORI)
+      instI(codegener, OP_XORI, Rd, Rd, 1);
+    else if (T.Then)
+      instR(codegener, T.Then, Rd, Rd, R_ZERO);
+    spill(codegener, I, Rd);
     return;
-  default:
+  }
+
+  if (I->Args[0])
+    Ra = useReg(codegener, I->Args[0], SCRATCH0);
+  if (I->Args[1])
+    Rb = useReg(codegener, I->Args[1], SCRATCH1);
+
+  switch (I->Op) {
+  case IR_CONST:
+    loadImm(codegener, Rd, I->Imm);
+    break;
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_DIV:
+  case IR_REM:
+  case IR_SHL:
+  case IR_SHR:
+  case IR_AND:
+  case IR_OR:
+  case IR_XOR:
+    instR(codegener, BinInsts[I->Op], Rd, Ra, Rb);
     break;
+  // 与 0 比较时直接判断另一侧
+  case IR_EQ:
+  case IR_NE:
+    if (Rb != R_ZERO && Ra != R_ZERO) {
+      instR(codegener, OP_XOR, Rd, Ra, Rb);
+      Ra = Rd;
+    } else if (Ra == R_ZERO) {
+      Ra = Rb;
+    }
+    instR(codegener, I->Op == IR_EQ ? OP_SEQZ : OP_SNEZ, Rd, Ra, R_ZERO);
+    break;
+  case IR_LT:
+    instR(codegener, OP_SLT, Rd, Ra, Rb);
+    break;
+  case IR_LE:
+    instR(codegener, OP_SLT, Rd, Rb, Ra);
+    instI(codegener, OP_XORI, Rd, Rd, 1);
+    break;
+  case IR_NEG:
+    instR(codegener, OP_NEG, Rd, Ra, R_ZERO);
+    break;
+  case IR_NOT:
+    instR(codegener, OP_NOT, Rd, Ra, R_ZERO);
+    break;
+  // i1 已是 0 或 1，扩展只需复制
+  case IR_ZEXT:
+    move(codegener, Rd, Ra);
+    break;
+  default:
+    error("invalid IR instruction");
+  }
+  spill(codegener, I, Rd);
+}
+
+/**
+ * @brief 生成一次移动，位置含义同 loc
+ *
+ * @param codegener 代码生成器
+ * @param M 移动
+ */
+static void genMove(Codegener *codegener, const Move *M) {
+  Register Rs = M->Src >= 0 ? M->Src : SCRATCH0;
+  Register Rd = M->Dst >= 0 ? M->Dst : SCRATCH0;
+  if (M->Src == LOC_IMM) {
+    loadImm(codegener, Rd, M->Imm);
+    Rs = Rd;
+  } else if (M->Src < 0) {
+    // 目标是寄存器时直接读入
+    Rs = Rd;
+    instI(codegener, OP_LD, Rs, R_FP, M->Src);
+  }
+  if (M->Dst >= 0)
+    move(codegener, Rd, Rs);
+  else
+    instStore(codegener, Rs, R_FP, M->Dst);
+}
+
+/**
+ * @brief 在块 B 跳到 S 之前，把各 φ 从 B 流入的值移入 φ 的位置
+ * 这些移动同时发生：先做目标不再被读取的移动，只剩环时把一个目标先存入
+ * SCRATCH1，读取它的移动改为读取 SCRATCH1
+ *
+ * @param codegener 代码生成器
+ * @param B 前驱
+ * @param S 后继
+ */
+static void genPhiMoves(Codegener *codegener, IrBlock *B, IrBlock *S) {
+  unsigned int K = predIndex(S, B), N = 0;
+  for (IrInst *Phi = S->First; Phi->Op == IR_PHI; Phi = Phi->Next) {
+    IrInst *V = Phi->PhiArgs[K];
+    if (!codegener->end[Phi->Id] || V->Op == IR_UNDEF)
+      continue;
+    Move M = {codegener->loc[Phi->Id], codegener->loc[V->Id], 0};
+    if (V->Op == IR_CONST) {
+      M.Src = LOC_IMM;
+      M.Imm = V->Imm;
+    }
+    if (M.Src == M.Dst)
+      continue;
+    codegener->moves =
+        growStack(codegener->moves, &codegener->moveCap, N, sizeof(Move));
+    codegener->moves[N++] = M;
+  }
+  if (N)
+    comment(codegener, "bb%u 流入 bb%u 的 φ", B->Id, S->Id);
+
+  Move *Moves = codegener->moves;
+  while (N) {
+    unsigned int i;
+    for (i = 0; i < N; i++) {
+      unsigned int j = 0;
+      while (j < N && Moves[j].Src != Moves[i].Dst)
+        j++;
+      if (j == N)
+        break;
+    }
+    if (i < N) {
+      genMove(codegener, &Moves[i]);
+      Moves[i] = Moves[--N];
+      continue;
+    }
+    Move Save = {SCRATCH1, Moves[0].Dst, 0};
+    genMove(codegener, &Save);
+    for (unsigned int j = 0; j < N; j++)
+      if (Moves[j].Src == Save.Src)
+        Moves[j].Src = SCRATCH1;
   }
-  error("invalid statement");
 }
 
 /**
- * @brief 产生新的汇编生成器
+ * @brief 生成终结指令，后继紧接在后面时不必跳转
  *
- * @param func 函数序列指针
- * @return Codegener* 新汇编生成器指针
+ * @param codegener 代码生成器
+ * @param B 所在块
  */
-Codegener *newCodegener(Function *func) {
+static void genTerm(Codegener *codegener, IrBlock *B) {
+  IrInst *Term = B->Last;
+  for (unsigned int i = 0; i < irNumSuccs(Term); i++)
+    if (Term->Succs[i]->First->Op == IR_PHI)
+      genPhiMoves(codegener, B, Term->Succs[i]);
+
+  IrBlock *Then = Term->Succs[0], *Else = Term->Succs[1];
+  Register Rs;
+  switch (Term->Op) {
+  case IR_JMP:
+    if (Then != B->Next)
+      instLabel(codegener, OP_J, R_ZERO, LABEL_BLOCK(Then->Id));
+    return;
+  case IR_BR:
+    // 条件为常数时只走一侧
+    if (Term->Args[0]->Op == IR_CONST) {
+      Then = Term->Args[0]->Imm ? Then : Else;
+      if (Then != B->Next)
+        instLabel(codegener, OP_J, R_ZERO, LABEL_BLOCK(Then->Id));
+      return;
+    }
+    Rs = useReg(codegener, Term->Args[0], SCRATCH0);
+    if (Else == B->Next) {
+      instLabel(codegener, OP_BNEZ, Rs, LABEL_BLOCK(Then->Id));
+    } else if (Then == B->Next) {
+      instLabel(codegener, OP_BEQZ, Rs, LABEL_BLOCK(Else->Id));
+    } else {
+      instLabel(codegener, OP_BNEZ, Rs, LABEL_BLOCK(Then->Id));
+      instLabel(codegener, OP_J, R_ZERO, LABEL_BLOCK(Else->Id));
+    }
+    return;
+  default:
+    comment(codegener, "函数返回");
+    if (Term->Args[0]->Op == IR_CONST)
+      loadImm(codegener, R_A0, Term->Args[0]->Imm);
+    else
+      move(codegener, R_A0, useReg(codegener, Term->Args[0], R_A0));
+    // 最后一块之后紧接着就是后语
+    if (B->Next)
+      instLabel(codegener, OP_J, R_ZERO, LABEL_RETURN);
+    return;
+  }
+}
+
+Codegener *newCodegener(void) {
   Codegener *codegener = calloc(1, sizeof(Codegener));
-  codegener->func = func;
+  if (!codegener)
+    error("out of memory");
   return codegener;
 }
 
+void freeCodegener(Codegener *codegener) {
+  free(codegener->order);
+  free(codegener->blocks);
+  free(codegener->termPos);
+  free(codegener->start);
+  free(codegener->end);
+  free(codegener->loc);
+  free(codegener->hint);
+  free(codegener->slotEnd);
+  free(codegener->moves);
+  free(codegener->pool);
+  free(codegener->insts.buf);
+  free(codegener->insts.labelAt);
+  strBufFree(&codegener->insts.notes);
+  strBufFree(&codegener->text);
+  free(codegener);
+}
+
 // 对齐到Align的整数倍
 static int alignTo(int N, int Align) {
   // (0,Align]返回Align
   return (N + Align - 1) / Align * Align;
 }
 
-// 根据变量的链表计算出偏移量
-static void assignLVarOffsets(Function *Prog) {
-  int Offset = 0;
-  // 读取所有变量
-  for (Obj *Var = Prog->localObjs; Var; Var = Var->Next) {
-    // 每个变量分配8字节
-    Offset += 8;
-    // 为每个变量赋一个偏移量，或者说是栈中地址
-    Var->Offset = -Offset;
-  }
-  // 将栈对齐到16字节
-  Prog->stackSize = alignTo(Offset, 16);
-}
-
 /**
- * @brief 汇编代码生成入口
+ * @brief 保存或恢复用到的 s 寄存器
  *
- * @param codegener 汇编生成器指针
+ * @param codegener 代码生成器
+ * @param Save 为真时保存，否则恢复
  */
-void codegen(Codegener *codegener) {
-  printf("    .globl main\n");
-  printf("main:\n");
+static void saveRegs(Codegener *codegener, bool Save) {
+  for (unsigned int i = 0; i < codegener->savedNum; i++) {
+    Register Reg = Regs[FIRST_SAVED + i];
+    int Offset = -8 * (int)(i + 1);
+    if (Save)
+      instStore(codegener, Reg, R_FP, Offset);
+    else
+      instI(codegener, OP_LD, Reg, R_FP, Offset);
+  }
+}
+
+void codegen(Codegener *codegener, IrFunc *F, StrBuf *Out, bool Verbose,
+             bool Peephole) {
+  // 每个编译单元重新编号
+  codegener->out = Out;
+  codegener->verbose = Verbose;
+  codegener->peephole = Peephole;
+  codegener->insts.len = 0;
+  codegener->poolLen = 0;
+  strBufClear(&codegener->insts.notes);
+
+  // 先分配寄存器，栈帧大小随之确定
+  computeLiveness(codegener, F);
+  allocateRegs(codegener, F);
+
+  emit(codegener, "    .globl main\n");
+  emit(codegener, "main:\n");
 
   // 栈布局
   //-------------------------------//
-  //  origin_temp_Stack_Top_Elemt     <-origin_sp
-  //-------------------------------//
-  //          origin_fp
+  //          origin_fp               <-origin_sp - 8
   //-------------------------------//
-  //       local_var1_addr            <-fp
+  //        saved_s1 ... sK           用到的 s 寄存器，<-fp - 8 起
   //-------------------------------//
-  //       local_var2_addr
+  //     spill_slot1 ... slotM        寄存器不足时的溢出槽
   //-------------------------------//
-  //             ...
-  //-------------------------------//
-  //       local_varN_addr
-  //-------------------------------//
-  //  now_temp_Stack_Botton_Elemt     <-sp = origin_sp - 8 - StackSize
+  //                                  <-sp = origin_sp - 8 - StackSize
   //-------------------------------//
 
   // Prologue, 前言
   // 将fp压入栈中，保存fp的值
-  printf("    # fp 压栈\n");
-  printf("    addi sp, sp, -8\n");
-  printf("    sd fp, 0(sp)\n");
+  comment(codegener, "fp 压栈");
+  instI(codegener, OP_ADDI, R_SP, R_SP, -8);
+  instStore(codegener, R_FP, R_SP, 0);
 
   // 将sp写入fp
-  printf("    # 生成变量栈区\n");
-  printf("    mv fp, sp\n");
-  // 计算本地变量栈空间
-  assignLVarOffsets(codegener->func);
-  // 偏移量为实际变量所用的栈大小
-  printf("    addi sp, sp, -%d\n", codegener->func->stackSize);
+  comment(codegener, "生成栈帧");
+  instR(codegener, OP_MV, R_FP, R_SP, R_ZERO);
+  comment(codegener, "用到 %u 个 s 寄存器，溢出槽 %u 个", codegener->savedNum,
+          codegener->slotNum);
+  // 保存的寄存器与溢出槽所需的栈空间，对齐到16字节
+  int StackSize =
+      alignTo(8 * (int)(codegener->savedNum + codegener->slotNum), 16);
+  instI(codegener, OP_ADDI, R_SP, R_SP, -StackSize);
+  if (codegener->savedNum)
+    comment(codegener, "保存用到的 s 寄存器");
+  saveRegs(codegener, true);
 
-  // 根节点 是一个 代码块 节点
-  genStmt(codegener->func->Body);
+  for (IrBlock *B = F->Entry; B; B = B->Next) {
+    // 入口块没有前驱，不会被跳转到
+    if (B->NumPreds)
+      instLabel(codegener, OP_LABEL, R_ZERO, LABEL_BLOCK(B->Id));
+    for (IrInst *I = B->First; I; I = I->Next) {
+      bool Live = !I->Id || (codegener->end[I->Id] && !isZero(I));
+      if (Verbose && Live) {
+        strBufClear(&codegener->text);
+        irPrintInst(&codegener->text, I, B);
+        comment(codegener, "%s", codegener->text.buf);
+      }
+      if (!I->Next)
+        genTerm(codegener, B);
+      else if (Live && I->Op != IR_PHI)
+        genInst(codegener, I);
+
+      // 指令已足够多时先优化并输出
+      if (codegener->insts.len >= INST_FLUSH)
+        flushInsts(codegener);
+    }
+  }
 
   // Epilogue，后语
   // 恢复执行前环境
+  instLabel(codegener, OP_LABEL, R_ZERO, LABEL_RETURN);
+  if (codegener->savedNum)
+    comment(codegener, "恢复用到的 s 寄存器");
+  saveRegs(codegener, false);
 
   // 将fp的值改写回sp
-  printf(".L.return:\n");
-  printf("    # 清理变量栈区\n");
-  printf("    mv sp, fp\n");
+  comment(codegener, "清理栈帧");
+  instR(codegener, OP_MV, R_SP, R_FP, R_ZERO);
   // 将最早fp保存的值弹栈，恢复fp。
-  printf("    # 恢复 fp\n");
-  printf("    ld fp, 0(sp)\n");
-  printf("    # 恢复 sp\n");
-  printf("    addi sp, sp, 8\n");
+  comment(codegener, "恢复 fp");
+  instI(codegener, OP_LD, R_FP, R_SP, 0);
+  comment(codegener, "恢复 sp");
+  instI(codegener, OP_ADDI, R_SP, R_SP, 8);
   // 返回
-  printf("  ret\n");
+  inst(codegener, OP_RET, R_ZERO, R_ZERO, R_ZERO, 0);
+
+  // 优化并输出剩余的指令
+  flushInsts(codegener);
+
+  // 常数池放在只读数据段，按 8 字节对齐，之后回到代码段
+  if (!codegener->poolLen)
+    return;
+  emit(codegener, "    .section .rodata\n");
+  emit(codegener, "    .p2align 3\n");
+  for (unsigned int i = 0; i < codegener->poolLen; i++) {
+    emitNum(codegener, ".L.const.", i, ":\n");
+    emitNum(codegener, "    .dword ", codegener->pool[i], "\n");
+  }
+  emit(codegener, "    .text\n");
 }
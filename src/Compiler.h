@@ -8,8 +8,11 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,7 +21,8 @@
 
 //词法单元种类
 typedef enum {
-  EOF_FLAG, // EOF
+  EOF_FLAG,  // EOF
+  LINK_FLAG, // 块尾，衔接下一个词法单元块，不会交给语法分析器
 
   // 符号
   PUNCT, // 各类标点符号
@@ -36,101 +40,670 @@ typedef enum {
   ID, // identifier
 } TokenKind;
 
-//词法单元结构体
+// 词法单元编号，关键字与标点符号词法单元由此区分具体是哪一个
+typedef enum {
+  TK_NONE, // 无编号
+
+  // 关键字，顺序与 NodeKind 中的关键字节点一致
+  KW_IF,       // if
+  KW_ELSE,     // else
+  KW_GOTO,     // goto
+  KW_SWITCH,   // switch
+  KW_CASE,     // case
+  KW_DEFAULT,  // default
+  KW_FOR,      // for
+  KW_DO,       // do
+  KW_WHILE,    // while
+  KW_BREAK,    // break
+  KW_CONTINUE, // continue
+  KW_RETURN,   // return
+  KW_SIZEOF,   // sizeof
+  KW_VOID,     // void
+  KW_CHAR,     // char
+  KW_SHORT,    // short
+  KW_INT,      // int
+  KW_LONG,     // long
+  KW_FLOAT,    // float
+  KW_DOUBLE,   // double
+  KW_UNION,    // union
+  KW_ENUM,     // enum
+  KW_STRUCT,   // struct
+  KW_TYPEDEF,  // typedef
+  KW_AUTO,     // auto
+  KW_EXTERN,   // extern
+  KW_CONST,    // const
+  KW_STATIC,   // static
+  KW_SIGNED,   // signed
+  KW_UNSIGNED, // unsigned
+  KW_REGISTER, // register
+  KW_VOLATILE, // volatile
+
+  // 标点符号，顺序同 C11 6.4.6，双连符与对应的标点符号编号相同
+  P_LBRACKET,   // [ <:
+  P_RBRACKET,   // ] :>
+  P_LPAREN,     // (
+  P_RPAREN,     // )
+  P_LBRACE,     // { <%
+  P_RBRACE,     // } %>
+  P_DOT,        // .
+  P_ARROW,      // ->
+  P_INC,        // ++
+  P_DEC,        // --
+  P_AMP,        // &
+  P_STAR,       // *
+  P_PLUS,       // +
+  P_MINUS,      // -
+  P_TILDE,      // ~
+  P_NOT,        // !
+  P_SLASH,      // /
+  P_PERCENT,    // %
+  P_SHL,        // <<
+  P_SHR,        // >>
+  P_LT,         // <
+  P_GT,         // >
+  P_LE,         // <=
+  P_GE,         // >=
+  P_EQ,         // ==
+  P_NE,         // !=
+  P_CARET,      // ^
+  P_PIPE,       // |
+  P_LOGAND,     // &&
+  P_LOGOR,      // ||
+  P_QUESTION,   // ?
+  P_COLON,      // :
+  P_SEMI,       // ;
+  P_ELLIPSIS,   // ...
+  P_ASSIGN,     // =
+  P_MUL_ASSIGN, // *=
+  P_DIV_ASSIGN, // /=
+  P_MOD_ASSIGN, // %=
+  P_ADD_ASSIGN, // +=
+  P_SUB_ASSIGN, // -=
+  P_SHL_ASSIGN, // <<=
+  P_SHR_ASSIGN, // >>=
+  P_AND_ASSIGN, // &=
+  P_XOR_ASSIGN, // ^=
+  P_OR_ASSIGN,  // |=
+  P_COMMA,      // ,
+  P_HASH,       // # %:
+  P_HASHHASH,   // ## %:%:
+
+  TK_ID_NUM, // 编号个数
+} TokenId;
+
+//词法单元结构体，只记录文本在源文件中的位置，行列号在报错时才由行首表求得
 typedef struct Token Token;
 struct Token {
-  const char *text; // 文本指针
-  unsigned int len; // 文本长度
-  TokenKind kind;   // 词法单元种类
-
-  const char *fpath;   // 所在文件地址
-  const char *context; // 上下文
-  unsigned int row;    // 行位置
-  unsigned int col;    // 列位置
+  unsigned int offset; // 文本在源文件中的偏移
+  unsigned int len;    // 文本长度
+  unsigned char kind;  // 词法单元种类 TokenKind
+  unsigned char id;    // 词法单元编号 TokenId
 
   union {
-    char charVal;    // 字符值
-    long intVal;     // 整形数值
-    double floatVal; // 浮点数值
-    char *strPtr;    // 字符串首指针
+    unsigned int symId;  // 标识符的驻留符号编号
+    unsigned int valIdx; // 整数值在所在块数值区中的下标
   };
+};
+
+_Static_assert(sizeof(Token) == 16, "Token should stay 16 bytes");
+
+// 词法单元块大小，块按此大小对齐，由词法单元地址即可求得所在块
+#define TOKEN_CHUNK_BYTES (64 * 1024)
+
+typedef struct Lexer Lexer;
 
-  Token *nextTok; // 下一个词法单元
+// 词法单元块，词法单元自块首向后连续存放，字面量的值自块尾向前存放，
+// 块之间由 LINK_FLAG 词法单元衔接
+typedef struct TokenChunk TokenChunk;
+struct TokenChunk {
+  TokenChunk *next;    // 下一个词法单元块，回收后为空闲链表的下一块
+  Lexer *lexer;        // 产生该块的词法分析器
+  const char *text;    // 源文件文本，词法单元偏移的基址
+  unsigned int len;    // 已使用的词法单元个数
+  unsigned int valLen; // 已使用的数值个数
+  Token toks[];        // 词法单元数组
 };
 
 /**
- * @brief 生成并返回一个新的Token指针
+ * @brief 块内是否还能放入一个词法单元及其数值，同时为块尾衔接标记留出位置
  *
+ * @param chunk 词法单元块
+ */
+static inline bool chunkHasRoom(const TokenChunk *chunk) {
+  return sizeof(TokenChunk) + (chunk->len + 2) * sizeof(Token) +
+             (chunk->valLen + 1) * sizeof(long) <=
+         TOKEN_CHUNK_BYTES;
+}
+
+/**
+ * @brief 在词法单元块中分配并返回一个新的Token指针，调用方保证块内有空位
+ *
+ * @param chunk 词法单元块
  * @param kind Token类型
- * @param text Token文本起始指针
- * @param fpath Token所在文件
- * @param ftext Token所在文件文本
- * @param line  Token所在行
- * @param pos   Token所在列
+ * @param offset Token文本在源文件中的偏移
  * @return Token* 新生成的Token指针
  */
-Token *newToken(TokenKind kind, const char *text, const char *fpath,
-                const char *context, int row, int col);
+Token *newToken(TokenChunk *chunk, TokenKind kind, unsigned int offset);
+
+/**
+ * @brief 获取 Tok 所在的词法单元块
+ *
+ * @param Tok 词法单元
+ * @return TokenChunk* 所在块
+ */
+static inline TokenChunk *tokenChunkOf(const Token *Tok) {
+  return (TokenChunk *)((uintptr_t)Tok & ~(uintptr_t)(TOKEN_CHUNK_BYTES - 1));
+}
+
+/**
+ * @brief 获取词法单元文本，文本不以 '\0' 结尾，长度为 Tok->len
+ *
+ * @param Tok 词法单元
+ * @return const char* 文本起始
+ */
+static inline const char *tokText(const Token *Tok) {
+  return tokenChunkOf(Tok)->text + Tok->offset;
+}
+
+/**
+ * @brief 获取整数词法单元的值，数值区自块尾向前增长
+ *
+ * @param Tok 整数词法单元
+ * @return long 整数值
+ */
+static inline long tokInt(const Token *Tok) {
+  const long *End = (const long *)((uintptr_t)tokenChunkOf(Tok) +
+                                   TOKEN_CHUNK_BYTES);
+  return End[-1 - (long)Tok->valIdx];
+}
+
+/**
+ * @brief 为整数词法单元在所在块的数值区中存入值，调用方保证块内有空位
+ *
+ * @param Tok 整数词法单元
+ * @param Val 整数值
+ */
+void setTokInt(Token *Tok, long Val);
+
+/**
+ * @brief 由块尾的 LINK_FLAG 衔接到下一块的首个词法单元，
+ * 下一块尚未产生时向词法分析器拉取
+ *
+ * @param Tok LINK_FLAG 词法单元
+ * @return Token* 下一块的首个词法单元
+ */
+Token *linkTok(Token *Tok);
+
+/**
+ * @brief 获取下一个词法单元，EOF_FLAG 之后仍为 EOF_FLAG
+ *
+ * @param Tok 当前词法单元
+ * @return Token* 下一个词法单元
+ */
+static inline Token *nextTok(Token *Tok) {
+  if (Tok->kind == EOF_FLAG)
+    return Tok;
+  ++Tok;
+  // 块尾衔接到下一块的首个词法单元
+  if (Tok->kind == LINK_FLAG)
+    Tok = linkTok(Tok);
+  return Tok;
+}
+
+/**
+ * @brief 回收 Keep 所在块之前的全部词法单元块，供词法分析器重复使用
+ * 调用后只有 Keep 及其之后的词法单元仍然有效
+ *
+ * @param Keep 仍需使用的最早的词法单元
+ */
+void releaseTokens(Token *Keep);
 
 /**
- * @brief 比较Token->text与Str内容
+ * @brief 比较词法单元文本与Str内容，仅用于关键字识别与诊断
  *
  * @param Tok 待比较词法单元
  * @param Str 待比较字符串
  * @return true 内容相同
  * @return false 内容不同
  */
-bool equal(const Token *Tok, const char *Str);
+bool equalText(const Token *Tok, const char *Str);
+
+/**
+ * @brief 判断词法单元是否为编号 Id 的关键字或标点符号，只比较整数编号
+ *
+ * @param Tok 待比较词法单元
+ * @param Id 关键字或标点符号编号
+ * @return true 编号相同
+ * @return false 编号不同
+ */
+static inline bool equal(const Token *Tok, TokenId Id) { return Tok->id == Id; }
 
 /**
- * @brief 跳过文本内容与Str相同的Token，相同则返回下一个Token指针，否则报错
+ * @brief 获取关键字或标点符号编号对应的文本，用于诊断
+ *
+ * @param Id 关键字或标点符号编号
+ * @return const char* 文本
+ */
+const char *tokIdText(TokenId Id);
+
+/**
+ * @brief 跳过编号为 Id 的Token，相同则返回下一个Token指针，否则报错
  *
- * @param Buf 上下文
  * @param Tok 当前词法单元
- * @param Str 匹配字符串
+ * @param Id 期望的关键字或标点符号编号
  * @return Token* 下一个词法单元指针
  */
-Token *skip(Token *Tok, char *Str);
+Token *skip(Token *Tok, TokenId Id);
 
 /**
- * @brief 检查该词法单元是否为KEYWORD，并转换
+ * @brief 检查该词法单元是否为KEYWORD，并转换，同时记录关键字编号
  *
- * @param Tok
+ * @param Tok 标识符词法单元
  */
 void convert(Token *Tok);
 
+/************************Intern************************/
+
+// 驻留符号，相同文本的标识符共用同一个符号
+typedef struct Symbol Symbol;
+struct Symbol {
+  const char *name;  // 以 '\0' 结尾的名称，由驻留表持有
+  unsigned int len;  // 名称长度
+  unsigned int hash; // 名称哈希值
+};
+
+// 驻留表，每个编译上下文一个，编译单元结束时重置，符号编号只在编译单元内有效
+typedef struct InternTable InternTable;
+
+/**
+ * @brief 生成一个空的驻留表
+ *
+ * @return InternTable* 驻留表
+ */
+InternTable *newInternTable(void);
+
+/**
+ * @brief 重置驻留表，之前的符号全部失效，保留哈希表供下一编译单元使用
+ * 调用时不能有其他线程在使用
+ *
+ * @param T 驻留表
+ */
+void resetInternTable(InternTable *T);
+
+/**
+ * @brief 释放驻留表
+ *
+ * @param T 驻留表
+ */
+void freeInternTable(InternTable *T);
+
+/**
+ * @brief 驻留一段文本，返回其符号编号，相同文本总是得到相同编号
+ * 可由多个线程同时调用
+ *
+ * @param T 驻留表
+ * @param Str 文本起始
+ * @param Len 文本长度
+ * @return unsigned int 符号编号，从1开始
+ */
+unsigned int intern(InternTable *T, const char *Str, unsigned int Len);
+
+/**
+ * @brief 由符号编号获取符号
+ *
+ * @param T 驻留表
+ * @param Id 符号编号
+ * @return const Symbol* 符号
+ */
+const Symbol *symbolOf(const InternTable *T, unsigned int Id);
+
+/************************Scanner************************/
+
+// 字符类别
+enum {
+  CC_SPACE = 1 << 0, // 空白符
+  CC_DIGIT = 1 << 1, // 数字
+  CC_ALPHA = 1 << 2, // 字母或下划线
+  CC_IDENT = 1 << 3, // 标识符字符，字母、数字或下划线
+  CC_PUNCT = 1 << 4, // 标点符号
+};
+
+// 字符类别表，不依赖 locale
+extern const unsigned char CharClass[256];
+
+// 扫描器可能越过文本末尾读取的字节数，输入文本末尾需保留同样多的 0 字节
+#define SCAN_PADDING 32
+
+// 字符扫描器，一次比较多个字节，找到各类字符序列的结尾
+typedef struct Scanner Scanner;
+struct Scanner {
+  const char *name; // 扫描器名称
+
+  // 跳过空白符序列，返回序列之后的位置
+  const char *(*skipSpace)(const char *P);
+  // 跳过标识符字符序列 [a-zA-Z0-9_]*
+  const char *(*skipIdent)(const char *P);
+  // 跳过数字序列 [0-9]*
+  const char *(*skipDigit)(const char *P);
+  // 跳过 " ' / '\0' 以外的字符，即字符串、字符常量与注释之外的普通代码
+  const char *(*skipPlain)(const char *P);
+};
+
+/**
+ * @brief 获取当前CPU支持的最快扫描器
+ *
+ * @return const Scanner* 扫描器，SIMD 均不可用时为标量实现
+ */
+const Scanner *bestScanner(void);
+
+/**
+ * @brief 按名称查找扫描器
+ *
+ * @param Name 扫描器名称 avx2、sse2 或 scalar
+ * @return const Scanner* 扫描器，不存在或当前CPU不支持时为 NULL
+ */
+const Scanner *findScanner(const char *Name);
+
+/************************Pool************************/
+
+/**
+ * @brief 以 Threads 个线程并行执行 Fn(Arg, 0) ... Fn(Arg, Jobs - 1)，
+ * 全部完成后返回。调用线程也参与执行，任务编号由原子计数器分发
+ *
+ * @param Threads 线程数，含调用线程
+ * @param Jobs 任务个数
+ * @param Fn 任务函数
+ * @param Arg 任务函数参数
+ */
+void parallelFor(unsigned int Threads, unsigned int Jobs,
+                 void (*Fn)(void *Arg, unsigned int Job), void *Arg);
+
+/**
+ * @brief 获取可用的处理器个数
+ *
+ * @return unsigned int 处理器个数，至少为1
+ */
+unsigned int cpuCount(void);
+
+/************************Arena************************/
+
+// 内存区块，块内按顺序分配，整块释放
+typedef struct ArenaChunk ArenaChunk;
+
+// 内存区，一个编译单元内的语法树与编译器对象都从中分配，编译结束时整体释放
+typedef struct Arena Arena;
+struct Arena {
+  ArenaChunk *chunks; // 块链表，首块为当前分配的块
+  char *ptr;          // 当前块空闲位置
+  char *end;          // 当前块结尾
+  size_t chunkCount;  // 块个数
+  size_t reserved;    // 块总字节数
+  size_t allocCount;  // 分配次数
+  size_t allocBytes;  // 分配总字节数
+};
+
+// 分配的对齐字节数
+#define ARENA_ALIGN 8
+
+/**
+ * @brief 当前块空间不足时申请新块并从中分配
+ *
+ * @param A 内存区
+ * @param Size 已对齐的字节数
+ * @return void* 已清零的空间
+ */
+void *arenaAllocSlow(Arena *A, size_t Size);
+
+/**
+ * @brief 从内存区分配一段已清零的空间，取代 calloc
+ *
+ * @param A 内存区
+ * @param Size 字节数
+ * @return void* 已清零的空间，按 ARENA_ALIGN 对齐
+ */
+static inline void *arenaAlloc(Arena *A, size_t Size) {
+  Size = (Size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  A->allocCount++;
+  A->allocBytes += Size;
+  if ((size_t)(A->end - A->ptr) < Size)
+    return arenaAllocSlow(A, Size);
+  void *P = A->ptr;
+  A->ptr += Size;
+  return memset(P, 0, Size);
+}
+
+/**
+ * @brief 重置内存区，之前分配的空间全部失效，保留当前块供下一编译单元使用
+ *
+ * @param A 内存区
+ */
+void arenaReset(Arena *A);
+
+/**
+ * @brief 释放内存区的全部块
+ *
+ * @param A 内存区
+ */
+void arenaFree(Arena *A);
+
+/**
+ * @brief 堆上的栈已满时容量翻倍，各阶段跨编译单元复用的栈都由此扩容
+ * 内存不足时报错
+ *
+ * @param Stack 栈
+ * @param Cap 栈容量，扩容后更新
+ * @param Top 栈顶，即将放入的下标
+ * @param Size 元素大小
+ * @return void* 扩容后的栈
+ */
+void *growStack(void *Stack, unsigned int *Cap, unsigned int Top, size_t Size);
+
+/************************StrBuf************************/
+
+// 可增长的字符缓冲区，汇编输出与诊断信息都写入其中，清空后保留容量供重用
+// 设置了 sink 时内容每满 STRBUF_FLUSH 字节就写出并清空，大的输出不必整体留在内存
+typedef struct {
+  char *buf;      // 内容，非空时以 '\0' 结尾
+  size_t len;     // 内容长度
+  size_t cap;     // 容量
+  FILE *sink;     // 输出流，为空时内容全部保留
+  size_t flushed; // 已写出到输出流的字节数
+} StrBuf;
+
+// 有输出流时缓冲区写出的阈值
+#define STRBUF_FLUSH (64 * 1024)
+
+/**
+ * @brief 确保缓冲区在内容之后至少还能放下 Size 字节，用于直接读入内容
+ *
+ * @param B 缓冲区
+ * @param Size 字节数，不含结尾的 '\0'
+ * @return char* 内容之后的空闲位置
+ */
+char *strBufReserve(StrBuf *B, size_t Size);
+
+/**
+ * @brief 追加一段文本
+ *
+ * @param B 缓冲区
+ * @param Str 文本
+ * @param Len 文本长度
+ */
+void strBufAppend(StrBuf *B, const char *Str, size_t Len);
+
+/**
+ * @brief 按格式追加文本，同 vprintf
+ *
+ * @param B 缓冲区
+ * @param Fmt 格式
+ * @param VA 参数
+ * @return int 追加的字节数
+ */
+int strBufVPrintf(StrBuf *B, const char *Fmt, va_list VA);
+
+/**
+ * @brief 按格式追加文本，同 printf
+ *
+ * @param B 缓冲区
+ * @param Fmt 格式
+ * @return int 追加的字节数
+ */
+int strBufPrintf(StrBuf *B, const char *Fmt, ...);
+
+/**
+ * @brief 将内容写入输出流并清空，没有输出流时不做任何事
+ *
+ * @param B 缓冲区
+ */
+void strBufFlush(StrBuf *B);
+
+/**
+ * @brief 清空缓冲区，保留容量
+ *
+ * @param B 缓冲区
+ */
+static inline void strBufClear(StrBuf *B) {
+  B->len = 0;
+  if (B->buf)
+    B->buf[0] = '\0';
+}
+
+/**
+ * @brief 释放缓冲区
+ *
+ * @param B 缓冲区
+ */
+void strBufFree(StrBuf *B);
+
 /************************Lexer************************/
 
+// 词法分析方式
+typedef enum {
+  LEX_STREAM,   // 语法分析器按需拉取，每次产生一块
+  LEX_EAGER,    // 语法分析前一次产生全部词法单元
+  LEX_THREAD,   // 词法分析线程与语法分析流水线并行，经环形缓冲区交接
+  LEX_PARALLEL, // 文本切分为多个片段，由多个线程同时分析后拼接
+} LexMode;
+
+// 流水线模式下环形缓冲区可容纳的块数
+#define LEX_RING_SIZE 4
+
 // 词法分析器结构体
-typedef struct Lexer Lexer;
 struct Lexer {
-  Token *tokListHead; // 词法单元队列
+  LexMode mode;           // 词法分析方式
+  TokenChunk *firstChunk; // 首个未被回收的词法单元块
+  TokenChunk *lastChunk;  // 最后交给语法分析器的词法单元块
+  TokenChunk *freeChunks; // 已回收可重用的词法单元块
+  size_t tokCount;        // 词法单元个数
+  size_t chunkCount;      // 申请过的词法单元块个数
+  double lexTime;         // 词法分析累计耗时
+  bool done;              // 已产生 EOF_FLAG
+  bool failed;            // 遇到无法识别的字符或过大的字面量而提前结束
+  const char *failMsg;    // 提前结束的原因，语法分析器到达该处时报出
 
-  const char *fText; // 文本指针
+  const char *fText; // 文本指针，fText[fTextLen] 之后至少有 SCAN_PADDING 个 0
   const char *fPath; // 打开路径
+  size_t fTextLen;   // 文本长度
+  bool fMapped;      // 文本是否由 mmap 映射
+  char *textBuf;     // 读入或复制的文本所在缓冲区，各编译单元复用
+  size_t textCap;    // 文本缓冲区容量
+
+  const Scanner *scan;  // 字符扫描器
+  InternTable *interns; // 标识符驻留表，由编译上下文持有，各片段共用
 
   const char *curReadPtr; // 当前读取指针
-  const char *curLinePtr; // 当前行首字符指针
-  int curRowNum;          // 当前读取行位置
-  int curColNum;          // 当前读取列位置
+  const char *curEndPtr;  // 当前片段结尾，为下一片段首个字符，未切分时为空
+
+  // 行首表，报错时才建立
+  unsigned int *lineStarts; // 各行行首偏移
+  unsigned int lineCount;   // 行数
+
+  // 并行模式
+  unsigned int lexJobs; // 词法分析线程数
+
+  // 工作线程没有调用方的报错处理器，出错时记下，由调用线程报告
+  bool aborted;      // 工作线程报错而提前结束
+  StrBuf workerDiag; // 工作线程的报错信息
+
+  // 流水线模式
+  pthread_t thread;                // 词法分析线程
+  pthread_mutex_t lock;            // 保护环形缓冲区与空闲块
+  pthread_cond_t notEmpty;         // 环形缓冲区非空
+  pthread_cond_t notFull;          // 环形缓冲区未满
+  TokenChunk *ring[LEX_RING_SIZE]; // 环形缓冲区
+  unsigned int ringHead;           // 环形缓冲区首块下标
+  unsigned int ringLen;            // 环形缓冲区块数
+  bool stop;                       // 通知词法分析线程退出
 };
 
 /**
- * @brief 生成并初始化一个词法律分析器
+ * @brief 读取文件作为词法分析器的源文本，并重置其余状态
+ * 已回收的词法单元块与文本缓冲区保留下来供本次使用
+ *
+ * @param lexer 词法分析器，首次使用前清零即可
+ * @param fpath 等编译文件地址，若为-则从标准输入读取
+ */
+void loadFile(Lexer *lexer, const char *fpath);
+
+/**
+ * @brief 复制内存中的文本作为词法分析器的源文本，并重置其余状态
+ *
+ * @param lexer 词法分析器，首次使用前清零即可
+ * @param Name 报错时使用的文件名
+ * @param Text 源文本
+ * @param Len 源文本长度
+ */
+void loadText(Lexer *lexer, const char *Name, const char *Text, size_t Len);
+
+/**
+ * @brief 结束一个编译单元，回收词法单元并释放映射的文本与行首表
+ * 词法单元块与文本缓冲区保留给下一编译单元
+ *
+ * @param lexer 词法分析器
+ */
+void closeLexer(Lexer *lexer);
+
+/**
+ * @brief 释放词法分析器持有的全部内存，词法分析器本身除外
+ *
+ * @param lexer 词法分析器
+ */
+void freeLexer(Lexer *lexer);
+
+// 源文件位置，报错时由行首表求得
+typedef struct {
+  int row;          // 行号，从1开始
+  int col;          // 列号，从1开始
+  const char *line; // 所在行行首
+  int lineLen;      // 所在行长度，不含换行符
+} SourceLoc;
+
+/**
+ * @brief 由源文件偏移求得行列位置，首次调用时建立行首表
  *
- * @param fpath 等编译文件地址
- * @return Lexer* 新生成编译器地址
+ * @param lexer 词法分析器
+ * @param Offset 源文件偏移
+ * @return SourceLoc 行列位置与所在行
  */
-Lexer *newLexer(const char *fpath);
+SourceLoc locate(Lexer *lexer, size_t Offset);
 
 /**
  * @brief 为词法分析器产生词法单元序列并返回
+ * LEX_STREAM 与 LEX_THREAD 返回时只产生了首块，其余在 nextTok 时按需产生
  *
  * @param lexer 待生成词法单元序列的词法分析器
- * @return Token* 词法单元序列头节点
+ * @return Token* 词法单元序列首个词法单元，用 nextTok 遍历
  */
 Token *analysis(Lexer *lexer);
 
+/**
+ * @brief 结束词法分析，词法分析器产生的全部词法单元块放回空闲链表
+ * 可重复调用
+ *
+ * @param lexer 词法分析器
+ */
+void freeTokens(Lexer *lexer);
+
 /************************Parser************************/
 
 // AST节点种类
@@ -245,76 +818,551 @@ typedef enum {
 
 } NodeKind;
 
-// AST语法树节点结构体
-typedef struct Node Node;
 // 对象结构体
 typedef struct Obj Obj;
 // 函数结构体
 typedef struct Function Function;
 
 struct Obj {
-  Obj *Next;   // 下个对象名
-  char *Name;  // 对象名
-  long Offset; // 相对 fp 的偏移量
+  Obj *Next;          // 下个对象名
+  const char *Name;   // 对象名，由驻留表持有
+  unsigned int SymId; // 对象名符号编号
+  int Depth;          // 所在作用域深度，函数作用域为1
+  Obj *Shadow;        // 被遮蔽的外层同名对象
+  Obj *ScopeNext;     // 同一作用域中的下个对象
+  unsigned int Index; // 变量编号，构造 SSA 时按编号记录各变量的当前值
 };
 
+/************************Ast************************/
+
+// AST语法树节点编号，0 号为空节点
+typedef unsigned int NodeId;
+
+// 节点数据，按节点种类使用
+typedef union {
+  long Val;    // NUM: 值
+  Obj *Var;    // VAR: 变量
+  NodeId Cond; // CONDITION: 条件
+} NodeData;
+
+// 每个节点在各列中共占的字节数
+#define AST_NODE_BYTES                                                         \
+  (sizeof(NodeData) + 2 * sizeof(NodeId) + sizeof(unsigned int) +              \
+   sizeof(unsigned char))
+
+// AST语法树，各节点的字段按列存放在同一块内存中，以节点编号下标访问
+// 节点总在子节点之后创建，子节点编号小于父节点，按编号顺序遍历即为后序遍历
+// 代码块由 BLOCK 节点串接：LHS 为语句，RHS 为下一个 BLOCK 节点
+// 条件运算符 LHS 为真分支，RHS 为假分支，条件存放在 Data 中
+typedef struct {
+  void *Buf;           // 各列所在的内存块
+  NodeData *Data;      // 节点数据
+  NodeId *LHS;         // 左子树
+  NodeId *RHS;         // 右子树
+  unsigned int *Loc;   // 对应词法单元在源文件中的偏移，报错用
+  unsigned char *Kind; // 节点种类 NodeKind
+  unsigned int Len;    // 节点个数，含 0 号空节点
+  unsigned int Cap;    // 容量
+} Ast;
+
+/**
+ * @brief 新建节点，字段均为 0
+ *
+ * @param ast 语法树
+ * @param Kind 节点种类
+ * @return NodeId 新节点编号
+ */
+NodeId astNew(Ast *ast, NodeKind Kind);
+
+/**
+ * @brief 复制语法树，全部节点只需一次 memcpy
+ *
+ * @param Dst 目标语法树
+ * @param Src 源语法树
+ */
+void astCopy(Ast *Dst, const Ast *Src);
+
+/**
+ * @brief 清空语法树，保留已分配的内存供重用
+ *
+ * @param ast 语法树
+ */
+void astReset(Ast *ast);
+
+/**
+ * @brief 释放语法树
+ *
+ * @param ast 语法树
+ */
+void astFree(Ast *ast);
+
+// 语法树访问者
+typedef void (*AstVisitor)(Ast *ast, NodeId Id, void *Arg);
+
+/**
+ * @brief 按编号顺序访问全部节点，子节点总是先于父节点被访问
+ *
+ * @param ast 语法树
+ * @param Fn 访问者
+ * @param Arg 访问者参数
+ */
+void astVisit(Ast *ast, AstVisitor Fn, void *Arg);
+
+// 依次遍历代码块 Block 中的语句，Cell 为串接语句的 BLOCK 节点
+#define AST_FOR_EACH_STMT(ast, Cell, Block)                                    \
+  for (NodeId Cell = (Block); Cell; Cell = (ast)->RHS[Cell])
+
 struct Function {
-  Node *Body;     // 函数体
+  Lexer *lexer;   // 源文件，报错时求行列号
+  Ast *Tree;      // 语法树，由语法分析器持有，各编译单元复用
+  NodeId Body;    // 函数体
   Obj *localObjs; // 函数局部变量
-  int stackSize;  // 函数栈大小
 };
 
-struct Node {
-  NodeKind Kind; // 节点种类
-  union {
-    int Val;   // 值
-    Node *LHS; // 左子树
-    Obj *Var;  //变量
-    Node *Body;
-  };
+//语法分析器结构体，持有解析栈、变量绑定表与语法树，各编译单元复用
+typedef struct Parser Parser;
+
+/**
+ * @brief 生成一个语法分析器
+ *
+ * @return Parser* 新生成的语法分析器指针
+ */
+Parser *newParser(void);
+
+/**
+ * @brief 从词法单元序列生成语法分析树
+ *
+ * @param parser 语法分析器
+ * @param tokList 词法单元序列头节点
+ * @param arena 内存区，函数、变量与作用域均从中分配
+ * @return Function* 函数结构体指针，语法树在下次分析前有效
+ */
+Function *parse(Parser *parser, Token *tokList, Arena *arena);
+
+/**
+ * @brief 语法分析出错中止后退出全部作用域，恢复变量绑定表
+ * 须在内存区重置之前调用
+ *
+ * @param parser 语法分析器
+ */
+void abortParse(Parser *parser);
+
+/**
+ * @brief 释放语法分析器
+ *
+ * @param parser 语法分析器
+ */
+void freeParser(Parser *parser);
+
+/************************Fold************************/
+
+/**
+ * @brief 常量折叠与代数化简，在语法分析之后、代码生成之前进行
+ * 按目标机器的 64 位运算对常量子树求值，常数除以 0 时给出警告
+ *
+ * @param func 函数
+ */
+void fold(Function *func);
+
+/************************IR************************/
+
+// 值的类型
+typedef enum {
+  IR_VOID, // 没有值，用于终结指令
+  IR_I1,   // 比较结果，只为 0 或 1
+  IR_I64,  // 64 位整数
+} IrType;
+
+// 中间表示的操作，注释中为文本格式
+typedef enum {
+  IR_CONST, // %v = const T Imm
+  IR_UNDEF, // %v = undef i64，未赋值的变量，只在入口块中定义一次
+  IR_PHI,   // %v = phi T [%a, bbN], ...，各前驱流入的值
+  IR_ADD,   // %v = add i64 %a, %b
+  IR_SUB,   // %v = sub i64 %a, %b
+  IR_MUL,   // %v = mul i64 %a, %b
+  IR_DIV,   // %v = div i64 %a, %b
+  IR_REM,   // %v = rem i64 %a, %b
+  IR_SHL,   // %v = shl i64 %a, %b
+  IR_SHR,   // %v = shr i64 %a, %b，算术右移
+  IR_AND,   // %v = and i64 %a, %b
+  IR_OR,    // %v = or i64 %a, %b
+  IR_XOR,   // %v = xor i64 %a, %b
+  IR_EQ,    // %v = eq i1 %a, %b
+  IR_NE,    // %v = ne i1 %a, %b
+  IR_LT,    // %v = lt i1 %a, %b
+  IR_LE,    // %v = le i1 %a, %b
+  IR_NEG,   // %v = neg i64 %a
+  IR_NOT,   // %v = not i64 %a，按位反
+  IR_ZEXT,  // %v = zext i64 %a，i1 扩展为 i64
+  IR_JMP,   // jmp bbN
+  IR_BR,    // br %c, bbT, bbF，%c 为 i1，非 0 时跳到 bbT
+  IR_RET,   // ret %a
+} IrOp;
+
+typedef struct IrInst IrInst;
+typedef struct IrBlock IrBlock;
+
+// 指令，有值的指令即定义一个虚拟寄存器，以值编号 Id 标识
+struct IrInst {
+  IrInst *Next;    // 块内的下一条指令
+  IrInst *Args[2]; // 操作数，φ 的操作数在 PhiArgs 中
   union {
-    Node *RHS;  // 右子树
-    Node *Next; // 右兄弟
+    long Imm;          // IR_CONST: 值
+    IrBlock *Succs[2]; // IR_JMP 与 IR_BR: 后继，BR 先真后假
+    IrInst **PhiArgs;  // IR_PHI: 各前驱流入的值，顺序同所在块的 Preds
   };
+  unsigned int Id;    // 值编号，从 1 开始，没有值的指令为 0
+  unsigned char Op;   // IrOp
+  unsigned char Type; // IrType
 };
 
-//语法分析器结构体
-typedef struct Parser Parser;
-struct Parser {
-  Token *tokList;
-  Function *Func;
+// 基本块，φ 在最前，终结指令在最后
+struct IrBlock {
+  IrBlock *Next;          // 布局中的下一块
+  IrInst *First;          // 首条指令
+  IrInst *Last;           // 末条指令
+  IrBlock **Preds;        // 前驱，按布局顺序
+  unsigned int NumPreds;  // 前驱个数
+  unsigned int PredCap;   // Preds 的容量
+  unsigned int Id;        // 块编号，即在布局中的位置
+  // 支配树，由 irDominators 求得
+  IrBlock *Idom;          // 直接支配者，入口块为空
+  IrBlock *DomChild;      // 支配树中的首个子节点
+  IrBlock *DomSibling;    // 支配树中的下一个兄弟节点
+  unsigned int DomIn;     // 支配树先序遍历进入时的编号
+  unsigned int DomOut;    // 支配树先序遍历离开时的编号
 };
 
+// 函数的中间表示，全部从编译单元内存区分配
+// 块按布局顺序排列，跳转只能向后，布局即为拓扑序
+typedef struct {
+  Arena *arena;           // 内存区
+  IrBlock *Entry;         // 入口块，布局中的第一块
+  IrBlock *Tail;          // 布局中的最后一块
+  IrInst *Undef;          // 入口块中的 undef，没有用到时为空
+  unsigned int NumBlocks; // 已放入布局的块数
+  unsigned int NumValues; // 值编号个数，含 0 号
+} IrFunc;
+
 /**
- * @brief  从词法单元序列生成一个语法分析树
+ * @brief 新建函数的中间表示，只有一个空的入口块
+ *
+ * @param arena 内存区
+ * @return IrFunc* 中间表示
+ */
+IrFunc *newIrFunc(Arena *arena);
 
- * @param  toklist 词法单元序列头节点
- * @return Parser* 新生成的语法分析器指针
+/**
+ * @brief 新建基本块，放入布局之前不能加入指令
+ *
+ * @param F 中间表示
+ * @return IrBlock* 基本块
+ */
+IrBlock *irNewBlock(IrFunc *F);
+
+/**
+ * @brief 将基本块放在布局末尾，编号为布局中的位置
+ *
+ * @param F 中间表示
+ * @param B 基本块
  */
-Parser *newParser(Token *tokList);
+void irPlaceBlock(IrFunc *F, IrBlock *B);
 
 /**
- * @brief 为语法分析器进行语法分析，返回语法分析树
+ * @brief 为基本块增加前驱，须在加入 φ 之前
  *
- * @param parser 待分析语法分析器
- * @return Function* 函数结构体指针
+ * @param F 中间表示
+ * @param B 基本块
+ * @param Pred 前驱
  */
-Function *parse(Parser *parser);
+void irAddPred(IrFunc *F, IrBlock *B, IrBlock *Pred);
+
+/**
+ * @brief 在基本块末尾加入一条指令
+ *
+ * @param F 中间表示
+ * @param B 基本块
+ * @param Op 操作
+ * @param Type 值的类型，终结指令为 IR_VOID
+ * @param A 第一个操作数
+ * @param Bv 第二个操作数
+ * @return IrInst* 新指令
+ */
+IrInst *irAppend(IrFunc *F, IrBlock *B, IrOp Op, IrType Type, IrInst *A,
+                 IrInst *Bv);
+
+/**
+ * @brief 在基本块中加入 φ，各前驱流入的值由调用方填入 PhiArgs
+ *
+ * @param F 中间表示
+ * @param B 基本块，前驱已全部加入
+ * @param Type 值的类型
+ * @return IrInst* 新的 φ
+ */
+IrInst *irPhi(IrFunc *F, IrBlock *B, IrType Type);
+
+/**
+ * @brief 取得函数中唯一的 undef，首次使用时加在入口块开头
+ *
+ * @param F 中间表示
+ * @return IrInst* undef
+ */
+IrInst *irUndef(IrFunc *F);
+
+/**
+ * @brief 终结指令的后继个数
+ *
+ * @param I 终结指令
+ * @return unsigned int 后继个数
+ */
+static inline unsigned int irNumSuccs(const IrInst *I) {
+  return I->Op == IR_BR ? 2 : I->Op == IR_JMP ? 1 : 0;
+}
+
+/**
+ * @brief 求支配树，块须按拓扑序布局，一遍即可求出
+ *
+ * @param F 中间表示
+ */
+void irDominators(IrFunc *F);
+
+/**
+ * @brief 检查中间表示：块结构、前驱后继、类型、φ 与 SSA 的支配关系
+ * 不满足时报错
+ *
+ * @param F 中间表示
+ */
+void verifyIr(IrFunc *F);
+
+/**
+ * @brief 输出一条指令的文本，不含缩进与换行
+ *
+ * @param B 输出缓冲区
+ * @param I 指令
+ * @param Block 所在块，用于输出 φ 的前驱
+ */
+void irPrintInst(StrBuf *B, const IrInst *I, const IrBlock *Block);
+
+/**
+ * @brief 输出中间表示的文本，--emit-ir 时使用
+ *
+ * @param B 输出缓冲区
+ * @param F 中间表示
+ */
+void dumpIr(StrBuf *B, IrFunc *F);
+
+// 中间表示构造器，持有构造用的栈与各变量的当前值，各编译单元复用
+typedef struct IrBuilder IrBuilder;
+
+/**
+ * @brief 生成中间表示构造器
+ *
+ * @return IrBuilder* 构造器
+ */
+IrBuilder *newIrBuilder(void);
+
+/**
+ * @brief 由语法树构造 SSA 形式的中间表示，时间与语法树大小成线性
+ * 变量不占内存，赋值即为新的值，分支汇合处为不同的值加入 φ
+ *
+ * @param builder 构造器
+ * @param func 函数
+ * @param arena 内存区，中间表示从中分配
+ * @return IrFunc* 中间表示
+ */
+IrFunc *buildIr(IrBuilder *builder, Function *func, Arena *arena);
+
+/**
+ * @brief 释放中间表示构造器
+ *
+ * @param builder 构造器
+ */
+void freeIrBuilder(IrBuilder *builder);
+
+/************************Peephole************************/
+
+// RISC-V 整数寄存器，顺序与编码无关，只作下标
+typedef enum {
+  R_ZERO,
+  R_RA,
+  R_SP,
+  R_FP,
+  R_A0,
+  R_A1,
+  R_A2,
+  R_A3,
+  R_A4,
+  R_A5,
+  R_A6,
+  R_A7,
+  R_T0,
+  R_T1,
+  R_T2,
+  R_T3,
+  R_T4,
+  R_T5,
+  R_T6,
+  R_S1,
+  R_S2,
+  R_S3,
+  R_S4,
+  R_S5,
+  R_S6,
+  R_S7,
+  R_S8,
+  R_S9,
+  R_S10,
+  R_S11,
+} Register;
+
+// 指令种类，注释中为各操作数的用法
+typedef enum {
+  OP_ADD,     // add Rd, Rs1, Rs2
+  OP_SUB,     // sub Rd, Rs1, Rs2
+  OP_MUL,     // mul Rd, Rs1, Rs2
+  OP_DIV,     // div Rd, Rs1, Rs2
+  OP_REM,     // rem Rd, Rs1, Rs2
+  OP_SLL,     // sll Rd, Rs1, Rs2
+  OP_SRA,     // sra Rd, Rs1, Rs2
+  OP_AND,     // and Rd, Rs1, Rs2
+  OP_OR,      // or Rd, Rs1, Rs2
+  OP_XOR,     // xor Rd, Rs1, Rs2
+  OP_SLT,     // slt Rd, Rs1, Rs2
+  OP_ADDI,    // addi Rd, Rs1, Imm
+  OP_ADDIW,   // addiw Rd, Rs1, Imm，低 32 位相加后符号扩展
+  OP_ANDI,    // andi Rd, Rs1, Imm
+  OP_ORI,     // ori Rd, Rs1, Imm
+  OP_XORI,    // xori Rd, Rs1, Imm
+  OP_SLTI,    // slti Rd, Rs1, Imm
+  OP_SLLI,    // slli Rd, Rs1, Imm
+  OP_SRAI,    // srai Rd, Rs1, Imm
+  OP_MV,      // mv Rd, Rs1
+  OP_NEG,     // neg Rd, Rs1
+  OP_NOT,     // not Rd, Rs1
+  OP_SEQZ,    // seqz Rd, Rs1
+  OP_SNEZ,    // snez Rd, Rs1
+  OP_LI,      // li Rd, Imm，Imm 为 12 位有符号数
+  OP_LUI,     // lui Rd, Imm，Imm 为高 20 位
+  OP_LA,      // la Rd, 常数池第 Imm 项
+  OP_LD,      // ld Rd, Imm(Rs1)
+  OP_SD,      // sd Rs2, Imm(Rs1)
+  OP_BEQZ,    // beqz Rs1, 标签 Imm
+  OP_BNEZ,    // bnez Rs1, 标签 Imm
+  OP_J,       // j 标签 Imm
+  OP_LABEL,   // 标签 Imm 所在位置
+  OP_RET,     // ret
+  OP_COMMENT, // 注释，Imm 为注释在 InstList.notes 中的偏移量
+} Opcode;
+
+// 标签编号，.L.return 为 0，基本块 bbN 的标签 .L.bb.N 为 N+1
+#define LABEL_RETURN 0
+#define LABEL_BLOCK(N) ((long)(N) + 1)
+
+// 一条指令，不用的寄存器操作数为 R_ZERO；只有 Rd 是被写入的寄存器
+typedef struct {
+  unsigned char Op;  // Opcode
+  unsigned char Rd;  // 目标寄存器
+  unsigned char Rs1; // 第一个源寄存器，访存时为基址
+  unsigned char Rs2; // 第二个源寄存器，sd 时为存入的值
+  long Imm;          // 立即数、偏移量或标签编号
+} Inst;
+
+// 指令序列，代码生成器先把指令放在这里，窥孔优化后再输出为汇编文本
+typedef struct {
+  Inst *buf;             // 指令
+  unsigned int len;      // 指令条数
+  unsigned int cap;      // 容量
+  StrBuf notes;          // 注释文本，各条以 '\0' 结尾
+  unsigned int *labelAt; // 窥孔优化用，各标签在序列中的位置
+  unsigned int labelCap; // labelAt 的容量
+} InstList;
+
+/**
+ * @brief 窥孔优化，在滑动窗口上按规则表改写指令序列
+ * 注释不参与匹配，跳转只能向前
+ *
+ * @param L 指令序列，原地改写
+ */
+void peephole(InstList *L);
 
 /************************Codegener************************/
+
+// 代码生成器，持有寄存器分配用的数组，各编译单元复用
 typedef struct Codegener Codegener;
 
-struct Codegener {
-  int stackDepth; //压栈深度
-  Function *func; //语法分析树根节点
-};
-Codegener *newCodegener(Function *func);
-void codegen(Codegener *codegener);
+/**
+ * @brief 生成代码生成器
+ *
+ * @return Codegener* 新生成的代码生成器指针
+ */
+Codegener *newCodegener(void);
+
+/**
+ * @brief 由函数的中间表示生成汇编代码
+ *
+ * @param codegener 代码生成器
+ * @param F 中间表示
+ * @param Out 汇编输出缓冲区
+ * @param Verbose 是否输出解释每条指令的注释
+ * @param Peephole 是否进行窥孔优化
+ */
+void codegen(Codegener *codegener, IrFunc *F, StrBuf *Out, bool Verbose,
+             bool Peephole);
+
+/**
+ * @brief 释放代码生成器
+ *
+ * @param codegener 代码生成器
+ */
+void freeCodegener(Codegener *codegener);
+
+/************************Context************************/
+
+// 编译上下文，定义于 Context.c，接口见 qcc.h
+typedef struct QccContext QccContext;
+
+/**
+ * @brief 为每个工作线程生成编译上下文并设置选项
+ *
+ * @param N 个数
+ * @param Opts 编译选项，同 qccSetOption
+ * @param NOpts 编译选项个数
+ * @param Diag 失败时返回原因，由调用方释放，内存不足时为 NULL
+ * @return QccContext** 编译上下文，内存不足或选项无效时为 NULL
+ */
+QccContext **newContexts(unsigned N, const char *const *Opts, int NOpts,
+                         char **Diag);
+
+/**
+ * @brief 释放各工作线程的编译上下文
+ *
+ * @param Ctxs 编译上下文
+ * @param N 个数
+ */
+void freeContexts(QccContext **Ctxs, unsigned N);
 
 /************************Error************************/
+
+// 报错处理器，编译出错时诊断信息写入 diag，并跳回 jmp 处
+typedef struct {
+  jmp_buf jmp;  // 出错时跳回的位置
+  StrBuf *diag; // 诊断信息，含警告
+} ErrorHandler;
+
+/**
+ * @brief 设置当前线程的报错处理器
+ * 未设置时诊断信息输出到 stderr，出错时终止程序
+ *
+ * @param H 报错处理器，为 NULL 时取消
+ * @return ErrorHandler* 之前的报错处理器
+ */
+ErrorHandler *setErrorHandler(ErrorHandler *H);
+
 //基本错误处理
 void error(char *Fmt, ...);
-void errorAt(const Lexer *lex, char *Fmt, ...);
+void errorAt(Lexer *lex, char *Fmt, ...);
 void errorTok(Token *Tok, char *Fmt, ...);
+void warnAt(Lexer *lex, size_t Offset, char *Fmt, ...);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,436 @@
+#include "Compiler.h"
+#include "qcc.h"
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+// 编译上下文，选项与各阶段复用的内存都在其中，编译之间不共享可变的全局状态
+struct QccContext {
+  // 选项
+  LexMode lexMode;      // 词法分析方式
+  unsigned int lexJobs; // 并行词法分析线程数，0 为全部处理器
+  const Scanner *scan;  // 指定的字符扫描器，为空时使用最快的
+  bool fold;            // 是否进行常量折叠
+  bool peephole;        // 是否进行窥孔优化
+  bool timeReport;      // 是否输出各阶段耗时
+  bool memReport;       // 是否输出内存占用
+  bool dumpTokens;      // 是否只输出词法单元
+  bool verboseAsm;      // 是否在汇编中输出注释
+  bool emitIr;          // 是否只输出中间表示
+  bool verifyIr;        // 是否检查中间表示
+
+  // 各编译单元复用
+  Lexer lexer;          // 词法分析器，保留空闲词法单元块与文本缓冲区
+  Arena arena;          // 编译单元内存区，编译结束时重置
+  InternTable *interns; // 标识符驻留表，编译结束时与内存区一同重置
+  Parser *parser;       // 语法分析器，保留解析栈、绑定表与语法树
+  IrBuilder *irBuilder; // 中间表示构造器，保留构造栈与变量表
+  Codegener *codegener; // 代码生成器，保留寄存器分配用的数组
+  StrBuf out;           // 汇编输出
+  StrBuf diag;          // 诊断信息
+};
+
+/**
+ * @brief 获取当前单调时钟时间
+ *
+ * @return double 秒
+ */
+static double now(void) {
+  struct timespec Ts;
+  clock_gettime(CLOCK_MONOTONIC, &Ts);
+  return Ts.tv_sec + Ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 输出各阶段耗时，-ftime-report 时使用
+ *
+ * @param B 输出缓冲区
+ * @param lexer 词法分析器
+ * @param T 各阶段起止时间
+ * @param AsmLen 生成的汇编字节数
+ */
+static void printTimeReport(StrBuf *B, const Lexer *lexer, const double T[7],
+                            size_t AsmLen) {
+  static const char *ModeName[] = {
+      [LEX_STREAM] = "stream",
+      [LEX_EAGER] = "eager",
+      [LEX_THREAD] = "thread",
+      [LEX_PARALLEL] = "parallel",
+  };
+  double MB = lexer->fTextLen / 1e6;
+  // 除流水线模式外，词法分析与语法分析在同一线程交替进行
+  double ParseTime = T[3] - T[1];
+  if (lexer->mode != LEX_THREAD)
+    ParseTime -= lexer->lexTime;
+
+  strBufPrintf(B, "qcc time report: %s, %zu bytes\n", lexer->fPath,
+               lexer->fTextLen);
+  strBufPrintf(B, "  load     %9.6fs %10.2f MB/s (%s)\n", T[1] - T[0],
+               MB / (T[1] - T[0]), lexer->fMapped ? "mmap" : "read");
+  strBufPrintf(B, "  lex      %9.6fs %10.2f MB/s %12.0f tokens/s (%s",
+               lexer->lexTime, MB / lexer->lexTime,
+               lexer->tokCount / lexer->lexTime, ModeName[lexer->mode]);
+  if (lexer->mode == LEX_PARALLEL)
+    strBufPrintf(B, ", %u jobs", lexer->lexJobs);
+  strBufPrintf(B, ")\n");
+  strBufPrintf(B, "  parse    %9.6fs\n", ParseTime);
+  strBufPrintf(B, "  fold     %9.6fs\n", T[4] - T[3]);
+  strBufPrintf(B, "  ir       %9.6fs\n", T[5] - T[4]);
+  strBufPrintf(B, "  codegen  %9.6fs %10.2f MB/s (%zu bytes)\n", T[6] - T[5],
+               AsmLen / 1e6 / (T[6] - T[5]), AsmLen);
+  strBufPrintf(B, "  total    %9.6fs\n", T[6] - T[0]);
+}
+
+/**
+ * @brief 输出内存占用，-fmem-report 时使用
+ *
+ * @param B 输出缓冲区
+ * @param lexer 词法分析器
+ * @param arena 编译单元内存区
+ * @param ast 语法树
+ * @param F 中间表示
+ */
+static void printMemReport(StrBuf *B, const Lexer *lexer, const Arena *arena,
+                           const Ast *ast, const IrFunc *F) {
+  size_t TokBytes = lexer->chunkCount * TOKEN_CHUNK_BYTES;
+  strBufPrintf(B, "qcc memory report: %s\n", lexer->fPath);
+  strBufPrintf(B, "  tokens   %zu, %zu bytes/token\n", lexer->tokCount,
+               sizeof(Token));
+  strBufPrintf(B, "  chunks   peak %zu, %zu bytes\n", lexer->chunkCount,
+               TokBytes);
+  strBufPrintf(B, "  arena    %zu allocs, %zu bytes used\n",
+               arena->allocCount, arena->allocBytes);
+  strBufPrintf(B, "           %zu chunks, %zu bytes reserved\n",
+               arena->chunkCount, arena->reserved);
+  strBufPrintf(B, "  ast      %u nodes, %zu bytes reserved\n", ast->Len,
+               ast->Cap * AST_NODE_BYTES);
+  strBufPrintf(B, "  ir       %u blocks, %u values\n", F->NumBlocks,
+               F->NumValues - 1);
+}
+
+/**
+ * @brief 输出全部词法单元，-dump-tokens 时使用
+ *
+ * @param B 输出缓冲区
+ * @param Tok 词法单元序列首个词法单元
+ */
+static void dumpTokens(StrBuf *B, Token *Tok) {
+  static const char *KindName[] = {
+      [EOF_FLAG] = "eof",       [PUNCT] = "punct",
+      [KEYWORD] = "keyword",    [VAL_CHAR] = "char",
+      [VAL_INTEGER] = "int",    [VAL_FLOAT] = "float",
+      [VAL_STRING] = "string",  [ID] = "id",
+  };
+  for (;; Tok = nextTok(Tok)) {
+    // 行列号由行首表求得
+    SourceLoc Loc = locate(tokenChunkOf(Tok)->lexer, Tok->offset);
+    strBufPrintf(B, "%d:%d\t%s\t'%.*s'", Loc.row, Loc.col,
+                 KindName[Tok->kind], Tok->len, tokText(Tok));
+    if (Tok->kind == VAL_INTEGER)
+      strBufPrintf(B, "\t%ld", tokInt(Tok));
+    strBufPrintf(B, "\n");
+    if (Tok->kind == EOF_FLAG)
+      break;
+  }
+}
+
+QccContext *qccNew(void) {
+  QccContext *Ctx = calloc(1, sizeof(QccContext));
+  if (!Ctx)
+    return NULL;
+  Ctx->lexMode = LEX_STREAM;
+  Ctx->fold = true;
+  Ctx->peephole = true;
+  return Ctx;
+}
+
+void qccFree(QccContext *Ctx) {
+  if (!Ctx)
+    return;
+  freeLexer(&Ctx->lexer);
+  arenaFree(&Ctx->arena);
+  if (Ctx->interns)
+    freeInternTable(Ctx->interns);
+  if (Ctx->parser)
+    freeParser(Ctx->parser);
+  if (Ctx->irBuilder)
+    freeIrBuilder(Ctx->irBuilder);
+  if (Ctx->codegener)
+    freeCodegener(Ctx->codegener);
+  strBufFree(&Ctx->out);
+  strBufFree(&Ctx->diag);
+  free(Ctx);
+}
+
+void freeContexts(QccContext **Ctxs, unsigned N) {
+  for (unsigned i = 0; i < N; i++)
+    qccFree(Ctxs[i]);
+  free(Ctxs);
+}
+
+QccContext **newContexts(unsigned N, const char *const *Opts, int NOpts,
+                         char **Diag) {
+  *Diag = NULL;
+  QccContext **Ctxs = calloc(N, sizeof(QccContext *));
+  if (!Ctxs) {
+    *Diag = strdup("qcc: out of memory\n");
+    return NULL;
+  }
+  for (unsigned i = 0; i < N; i++) {
+    if (!(Ctxs[i] = qccNew())) {
+      *Diag = strdup("qcc: out of memory\n");
+      freeContexts(Ctxs, N);
+      return NULL;
+    }
+    for (int j = 0; j < NOpts; j++) {
+      if (qccSetOption(Ctxs[i], Opts[j]) != QCC_OK) {
+        *Diag = strdup(qccDiagnostics(Ctxs[i]));
+        freeContexts(Ctxs, N);
+        return NULL;
+      }
+    }
+  }
+  return Ctxs;
+}
+
+QccStatus qccSetOption(QccContext *Ctx, const char *Opt) {
+  strBufClear(&Ctx->diag);
+  if (!strncmp(Opt, "-fscan=", 7)) {
+    // 指定字符扫描器，用于对比各实现
+    Ctx->scan = findScanner(Opt + 7);
+    if (!Ctx->scan) {
+      strBufPrintf(&Ctx->diag, "unsupported scanner: %s\n", Opt + 7);
+      return QCC_ERROR;
+    }
+    return QCC_OK;
+  }
+  if (!strncmp(Opt, "-flex-mode=", 11)) {
+    if (!strcmp(Opt + 11, "stream"))
+      Ctx->lexMode = LEX_STREAM;
+    else if (!strcmp(Opt + 11, "eager"))
+      Ctx->lexMode = LEX_EAGER;
+    else if (!strcmp(Opt + 11, "thread"))
+      Ctx->lexMode = LEX_THREAD;
+    else if (!strcmp(Opt + 11, "parallel"))
+      Ctx->lexMode = LEX_PARALLEL;
+    else {
+      strBufPrintf(&Ctx->diag, "unknown lex mode: %s\n", Opt + 11);
+      return QCC_ERROR;
+    }
+    return QCC_OK;
+  }
+  if (!strncmp(Opt, "-flex-jobs=", 11)) {
+    Ctx->lexJobs = atoi(Opt + 11);
+    if (Ctx->lexJobs == 0) {
+      strBufPrintf(&Ctx->diag, "invalid lex jobs: %s\n", Opt + 11);
+      return QCC_ERROR;
+    }
+    return QCC_OK;
+  }
+  if (!strcmp(Opt, "-dump-tokens")) {
+    Ctx->dumpTokens = true;
+    return QCC_OK;
+  }
+  if (!strcmp(Opt, "-fno-fold")) {
+    Ctx->fold = false;
+    return QCC_OK;
+  }
+  if (!strcmp(Opt, "-fno-peephole")) {
+    Ctx->peephole = false;
+    return QCC_OK;
+  }
+  if (!strcmp(Opt, "--emit-ir")) {
+    Ctx->emitIr = true;
+    return QCC_OK;
+  }
+  if (!strcmp(Opt, "-fverify-ir")) {
+    Ctx->verifyIr = true;
+    return QCC_OK;
+  }
+  if (!strcmp(Opt, "-fverbose-asm")) {
+    Ctx->verboseAsm = true;
+    return QCC_OK;
+  }
+  if (!strcmp(Opt, "-ftime-report")) {
+    Ctx->timeReport = true;
+    return QCC_OK;
+  }
+  if (!strcmp(Opt, "-fmem-report")) {
+    Ctx->memReport = true;
+    return QCC_OK;
+  }
+  strBufPrintf(&Ctx->diag, "unknown option: %s\n", Opt);
+  return QCC_ERROR;
+}
+
+/**
+ * @brief 读入并编译一个编译单元，汇编写入上下文的输出缓冲区
+ * 出错时由报错处理器跳回，清理未完成的编译单元后返回 QCC_ERROR
+ *
+ * @param Ctx 编译上下文
+ * @param Path 源文件路径，Src 为 NULL 时使用
+ * @param Src 内存中的源程序，为 NULL 时读取 Path
+ * @param Len 源程序长度
+ * @param Sink 汇编输出流，为 NULL 时汇编全部留在输出缓冲区
+ * @return QccStatus 编译结果
+ */
+static QccStatus compile(QccContext *Ctx, const char *Path, const char *Src,
+                         size_t Len, FILE *Sink) {
+  Lexer *lexer = &Ctx->lexer;
+  strBufClear(&Ctx->out);
+  strBufClear(&Ctx->diag);
+  Ctx->out.sink = Sink;
+  Ctx->out.flushed = 0;
+
+  // 出错时跳回此处，词法分析线程、变量绑定表、驻留表与内存区恢复到编译之前
+  ErrorHandler Handler = {.diag = &Ctx->diag};
+  ErrorHandler *Prev = setErrorHandler(&Handler);
+  if (setjmp(Handler.jmp)) {
+    if (Ctx->parser)
+      abortParse(Ctx->parser);
+    closeLexer(lexer);
+    if (Ctx->interns)
+      resetInternTable(Ctx->interns);
+    arenaReset(&Ctx->arena);
+    Ctx->out.sink = NULL;
+    strBufClear(&Ctx->out);
+    setErrorHandler(Prev);
+    return QCC_ERROR;
+  }
+
+  double T[7];
+  T[0] = now();
+
+  //读取源程序
+  if (Src)
+    loadText(lexer, Path, Src, Len);
+  else
+    loadFile(lexer, Path);
+  lexer->mode = Ctx->lexMode;
+  // 默认使用全部处理器
+  if (Ctx->lexJobs)
+    lexer->lexJobs = Ctx->lexJobs;
+  if (Ctx->scan)
+    lexer->scan = Ctx->scan;
+  if (!Ctx->interns)
+    Ctx->interns = newInternTable();
+  lexer->interns = Ctx->interns;
+  T[1] = now();
+
+  //词法分析，LEX_STREAM 与 LEX_THREAD 只产生首块，其余由语法分析器按需拉取
+  Token *toklist = analysis(lexer);
+  T[2] = now();
+
+  if (Ctx->dumpTokens) {
+    dumpTokens(&Ctx->out, toklist);
+  } else {
+    //语法分析，函数与变量从编译单元内存区分配，语法树由语法分析器持有
+    if (!Ctx->parser)
+      Ctx->parser = newParser();
+    Function *func = parse(Ctx->parser, toklist, &Ctx->arena);
+    T[3] = now();
+
+    // 语法分析树不引用词法单元，整块回收
+    freeTokens(lexer);
+
+    //常量折叠与代数化简，-fno-fold 时跳过，用于对比
+    if (Ctx->fold)
+      fold(func);
+    T[4] = now();
+
+    //构造 SSA 形式的中间表示，从编译单元内存区分配
+    if (!Ctx->irBuilder)
+      Ctx->irBuilder = newIrBuilder();
+    IrFunc *F = buildIr(Ctx->irBuilder, func, &Ctx->arena);
+    if (Ctx->verifyIr || Ctx->emitIr)
+      verifyIr(F);
+    T[5] = now();
+
+    //目标代码生成与窥孔优化，-fno-peephole 时跳过优化，用于对比
+    //--emit-ir 时输出中间表示的文本代替汇编
+    if (Ctx->emitIr) {
+      dumpIr(&Ctx->out, F);
+    } else {
+      if (!Ctx->codegener)
+        Ctx->codegener = newCodegener();
+      codegen(Ctx->codegener, F, &Ctx->out, Ctx->verboseAsm, Ctx->peephole);
+    }
+    T[6] = now();
+
+    if (Ctx->memReport)
+      printMemReport(&Ctx->diag, lexer, &Ctx->arena, func->Tree, F);
+    if (Ctx->timeReport)
+      printTimeReport(&Ctx->diag, lexer, T, Ctx->out.flushed + Ctx->out.len);
+  }
+
+  // 写出剩余的汇编
+  strBufFlush(&Ctx->out);
+  Ctx->out.sink = NULL;
+
+  // 编译单元结束，内存留给下一编译单元，符号编号不跨编译单元使用
+  closeLexer(lexer);
+  resetInternTable(Ctx->interns);
+  arenaReset(&Ctx->arena);
+  setErrorHandler(Prev);
+  return QCC_OK;
+}
+
+QccStatus qccCompile(QccContext *Ctx, const char *Name, const char *Src,
+                     size_t Len, char *Out, size_t OutCap, size_t *OutLen) {
+  QccStatus Status = compile(Ctx, Name, Src ? Src : "", Len, NULL);
+  if (Status != QCC_OK)
+    return Status;
+
+  if (OutLen)
+    *OutLen = Ctx->out.len;
+  if (!Out)
+    return QCC_OK;
+  if (Ctx->out.len > OutCap)
+    return QCC_NOSPACE;
+  memcpy(Out, Ctx->out.buf, Ctx->out.len);
+  if (Ctx->out.len < OutCap)
+    Out[Ctx->out.len] = '\0';
+  return QCC_OK;
+}
+
+QccStatus qccCompileFile(QccContext *Ctx, const char *Path, FILE *Out) {
+  return compile(Ctx, Path, NULL, 0, Out);
+}
+
+const char *qccOutput(const QccContext *Ctx, size_t *Len) {
+  if (Len)
+    *Len = Ctx->out.len;
+  return Ctx->out.buf ? Ctx->out.buf : "";
+}
+
+QccStatus qccWriteOutput(QccContext *Ctx, const char *Path) {
+  // 汇编已全部在内存中，通常一次 write 即可写完，只有部分写入时才继续
+  int Fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  bool OK = Fd >= 0;
+  const char *P = Ctx->out.buf;
+  size_t Left = Ctx->out.len;
+  while (OK && Left) {
+    ssize_t N = write(Fd, P, Left);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N < 0)
+      OK = false;
+    else {
+      P += N;
+      Left -= N;
+    }
+  }
+  if (Fd >= 0 && close(Fd))
+    OK = false;
+  if (OK)
+    return QCC_OK;
+
+  strBufPrintf(&Ctx->diag, "cannot write %s: %s\n", Path, strerror(errno));
+  if (Fd >= 0)
+    unlink(Path);
+  return QCC_ERROR;
+}
+
+const char *qccDiagnostics(const QccContext *Ctx) {
+  return Ctx->diag.buf ? Ctx->diag.buf : "";
+}
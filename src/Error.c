@@ -1,48 +1,97 @@
 #include "Compiler.h"
 
+// 当前线程的报错处理器，各线程的编译互不影响
+static _Thread_local ErrorHandler *Handler;
+// 正在输出报错信息，其间再次报错（如诊断缓冲区内存不足）时直接终止
+static _Thread_local bool Reporting;
+
+ErrorHandler *setErrorHandler(ErrorHandler *H) {
+  ErrorHandler *Prev = Handler;
+  Handler = H;
+  return Prev;
+}
+
+// 输出诊断信息，有报错处理器时写入其诊断缓冲区，否则输出到 stderr
+static int vdiag(const char *Fmt, va_list VA) {
+  if (Handler)
+    return strBufVPrintf(Handler->diag, Fmt, VA);
+  return vfprintf(stderr, Fmt, VA);
+}
+
+static int diag(const char *Fmt, ...) {
+  va_list VA;
+  va_start(VA, Fmt);
+  int N = vdiag(Fmt, VA);
+  va_end(VA);
+  return N;
+}
+
+// 终止编译，有报错处理器时跳回其 setjmp 处，否则终止程序
+static _Noreturn void fail(void) {
+  Reporting = false;
+  if (Handler)
+    longjmp(Handler->jmp, 1);
+  exit(1);
+}
+
 // Fmt为传入的字符串， ... 为可变参数，表示Fmt后面所有的参数
 
 void error(char *Fmt, ...) {
+  if (Reporting)
+    fail();
+  Reporting = true;
   // 定义一个va_list变量
   va_list VA;
   // VA获取Fmt后面的所有参数
   va_start(VA, Fmt);
-  // vfprintf可以输出va_list类型的参数
-  vfprintf(stderr, Fmt, VA);
+  // 可以输出va_list类型的参数
+  vdiag(Fmt, VA);
   // 在结尾加上一个换行符
-  fprintf(stderr, "\n");
+  diag("\n");
   // 清除VA
   va_end(VA);
-  // 终止程序
-  exit(1);
+  // 终止编译
+  fail();
 }
 
-// 输出错误出现的位置，并退出
-static void verrorAt(const char *context, const int col, char *Fmt,
+// 输出错误出现的位置，Prefix 为信息前缀，如 "warning: "
+// 行列号与出错行由行首表求得，只输出出错的一行
+static void verrorAt(Lexer *lex, size_t Offset, const char *Prefix, char *Fmt,
                      va_list VA) {
-  // 先输出源信息
-  fprintf(stderr, "%s\n", context);
+  SourceLoc Loc = locate(lex, Offset);
+
+  // 先输出文件名、行号与出错行，Indent为已输出的前缀长度
+  int Indent = diag("%s:%d: ", lex->fPath, Loc.row);
+  diag("%.*s\n", Loc.lineLen, Loc.line);
 
   // 输出出错信息
-  // 将字符串补齐为col位，因为是空字符串，所以填充col个空格
-  fprintf(stderr, "%*s", col, "^ ");
-  vfprintf(stderr, Fmt, VA);
-  fprintf(stderr, "\n");
+  // 将空字符串补齐为前缀长度加列位置，使 ^ 指向出错字符
+  diag("%*s", Indent + Loc.col - 1, "");
+  diag("^ %s", Prefix);
+  vdiag(Fmt, VA);
+  diag("\n");
   va_end(VA);
 }
 
 // 词法分析出错
-void errorAt(const Lexer *lex, char *Fmt, ...) {
+void errorAt(Lexer *lex, char *Fmt, ...) {
   va_list VA;
   va_start(VA, Fmt);
-  verrorAt(lex->curLinePtr, lex->curColNum, Fmt, VA);
-  exit(1);
+  verrorAt(lex, lex->curReadPtr - lex->fText, "", Fmt, VA);
+  fail();
 }
 
 // Tok解析出错
 void errorTok(Token *Tok, char *Fmt, ...) {
   va_list VA;
   va_start(VA, Fmt);
-  verrorAt(Tok->context, Tok->col, Fmt, VA);
-  exit(1);
+  verrorAt(tokenChunkOf(Tok)->lexer, Tok->offset, "", Fmt, VA);
+  fail();
+}
+
+// 在源文件偏移 Offset 处给出警告，不退出
+void warnAt(Lexer *lex, size_t Offset, char *Fmt, ...) {
+  va_list VA;
+  va_start(VA, Fmt);
+  verrorAt(lex, Offset, "warning: ", Fmt, VA);
 }
@@ -0,0 +1,311 @@
+#include "Compiler.h"
+#include <limits.h>
+
+// 常量折叠与代数化简
+// 子节点编号总是小于父节点，按编号顺序处理即可保证子节点先于父节点化简完毕
+// 化简结果直接写回节点：变为常数，或复制要替换成的子节点的内容
+
+// 节点是否为常数
+static bool isNum(const Ast *ast, NodeId N) { return ast->Kind[N] == NUM; }
+
+// 节点是否为值为 V 的常数
+static bool isNumOf(const Ast *ast, NodeId N, long V) {
+  return isNum(ast, N) && ast->Data[N].Val == V;
+}
+
+// 节点求值没有副作用，可以直接丢弃
+static bool isPure(const Ast *ast, NodeId N) {
+  return ast->Kind[N] == NUM || ast->Kind[N] == VAR;
+}
+
+// 两个节点是否为同一个变量
+static bool sameVar(const Ast *ast, NodeId A, NodeId B) {
+  return ast->Kind[A] == VAR && ast->Kind[B] == VAR &&
+         ast->Data[A].Var == ast->Data[B].Var;
+}
+
+// 将节点改为常数
+static void setNum(Ast *ast, NodeId N, long Val) {
+  ast->Kind[N] = NUM;
+  ast->Data[N].Val = Val;
+  ast->LHS[N] = ast->RHS[N] = 0;
+}
+
+// 将节点改为单叉树，子节点编号小于 N
+static void setUnary(Ast *ast, NodeId N, NodeKind Kind, NodeId LHS) {
+  ast->Kind[N] = Kind;
+  ast->LHS[N] = LHS;
+  ast->RHS[N] = 0;
+}
+
+// 用子节点 Src 替换节点 N，Src 的子节点编号更小，复制后仍满足编号顺序
+static void replaceWith(Ast *ast, NodeId N, NodeId Src) {
+  ast->Kind[N] = ast->Kind[Src];
+  ast->Data[N] = ast->Data[Src];
+  ast->LHS[N] = ast->LHS[Src];
+  ast->RHS[N] = ast->RHS[Src];
+  ast->Loc[N] = ast->Loc[Src];
+}
+
+/**
+ * @brief 按目标机器的 64 位运算对两个常数求值，有符号溢出按补码回绕
+ *
+ * @param Kind 运算符节点种类
+ * @param L 左值
+ * @param R 右值
+ * @param Val 结果
+ * @return bool 是否可以求值，除数为 0 时不求值
+ */
+static bool evalBinary(NodeKind Kind, long L, long R, long *Val) {
+  unsigned long UL = L, UR = R;
+  switch (Kind) {
+  case ADD:
+    *Val = (long)(UL + UR);
+    return true;
+  case SUB:
+    *Val = (long)(UL - UR);
+    return true;
+  case MUL:
+    *Val = (long)(UL * UR);
+    return true;
+  case DIV:
+  case MOD:
+    if (R == 0)
+      return false;
+    // 与 div/rem 指令一致，LONG_MIN / -1 回绕为 LONG_MIN，余数为 0
+    if (L == LONG_MIN && R == -1)
+      *Val = Kind == DIV ? LONG_MIN : 0;
+    else
+      *Val = Kind == DIV ? L / R : L % R;
+    return true;
+  case SHL:
+    // 与 sll/sra 指令一致，移位量取低 6 位
+    *Val = (long)(UL << (R & 63));
+    return true;
+  case SHR:
+    *Val = L >> (R & 63);
+    return true;
+  case AND:
+    *Val = L & R;
+    return true;
+  case OR:
+    *Val = L | R;
+    return true;
+  case XOR:
+    *Val = L ^ R;
+    return true;
+  case EQ:
+    *Val = L == R;
+    return true;
+  case NE:
+    *Val = L != R;
+    return true;
+  case LT:
+    *Val = L < R;
+    return true;
+  case GT:
+    *Val = L > R;
+    return true;
+  case LE:
+    *Val = L <= R;
+    return true;
+  case GE:
+    *Val = L >= R;
+    return true;
+  case LOGIC_AND:
+    *Val = L && R;
+    return true;
+  case LOGIC_OR:
+    *Val = L || R;
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief 化简二元运算中的恒等式，如 x+0、x*1、x-x
+ *
+ * @param ast 语法树
+ * @param N 节点
+ * @param L 左子树
+ * @param R 右子树
+ */
+static void simplifyBinary(Ast *ast, NodeId N, NodeId L, NodeId R) {
+  switch (ast->Kind[N]) {
+  case ADD:
+    // x+0, 0+x
+    if (isNumOf(ast, R, 0))
+      replaceWith(ast, N, L);
+    else if (isNumOf(ast, L, 0))
+      replaceWith(ast, N, R);
+    return;
+  case SUB:
+    // x-0, 0-x, x-x
+    if (isNumOf(ast, R, 0))
+      replaceWith(ast, N, L);
+    else if (isNumOf(ast, L, 0))
+      setUnary(ast, N, NEG, R);
+    else if (sameVar(ast, L, R))
+      setNum(ast, N, 0);
+    return;
+  case MUL:
+    // x*1, 1*x, x*-1, x*0, 0*x
+    if (isNumOf(ast, R, 1))
+      replaceWith(ast, N, L);
+    else if (isNumOf(ast, L, 1))
+      replaceWith(ast, N, R);
+    else if (isNumOf(ast, R, -1))
+      setUnary(ast, N, NEG, L);
+    else if ((isNumOf(ast, R, 0) && isPure(ast, L)) ||
+             (isNumOf(ast, L, 0) && isPure(ast, R)))
+      setNum(ast, N, 0);
+    return;
+  case DIV:
+    // x/1, x/-1
+    if (isNumOf(ast, R, 1))
+      replaceWith(ast, N, L);
+    else if (isNumOf(ast, R, -1))
+      setUnary(ast, N, NEG, L);
+    return;
+  case MOD:
+    // x%1, x%-1
+    if ((isNumOf(ast, R, 1) || isNumOf(ast, R, -1)) && isPure(ast, L))
+      setNum(ast, N, 0);
+    return;
+  case SHL:
+  case SHR:
+    // x<<0, x>>0
+    if (isNumOf(ast, R, 0))
+      replaceWith(ast, N, L);
+    return;
+  case AND:
+    // x&-1, -1&x, x&x, x&0, 0&x
+    if (isNumOf(ast, R, -1) || sameVar(ast, L, R))
+      replaceWith(ast, N, L);
+    else if (isNumOf(ast, L, -1))
+      replaceWith(ast, N, R);
+    else if ((isNumOf(ast, R, 0) && isPure(ast, L)) ||
+             (isNumOf(ast, L, 0) && isPure(ast, R)))
+      setNum(ast, N, 0);
+    return;
+  case OR:
+    // x|0, 0|x, x|x
+    if (isNumOf(ast, R, 0) || sameVar(ast, L, R))
+      replaceWith(ast, N, L);
+    else if (isNumOf(ast, L, 0))
+      replaceWith(ast, N, R);
+    return;
+  case XOR:
+    // x^0, 0^x, x^x
+    if (isNumOf(ast, R, 0))
+      replaceWith(ast, N, L);
+    else if (isNumOf(ast, L, 0))
+      replaceWith(ast, N, R);
+    else if (sameVar(ast, L, R))
+      setNum(ast, N, 0);
+    return;
+  case EQ:
+  case LE:
+  case GE:
+    // x==x, x<=x, x>=x
+    if (sameVar(ast, L, R))
+      setNum(ast, N, 1);
+    return;
+  case NE:
+  case LT:
+  case GT:
+    // x!=x, x<x, x>x
+    if (sameVar(ast, L, R))
+      setNum(ast, N, 0);
+    return;
+  case LOGIC_AND:
+    // 0&&x 不对 x 求值
+    if (isNumOf(ast, L, 0))
+      setNum(ast, N, 0);
+    return;
+  case LOGIC_OR:
+    // 非 0 常数 || x 不对 x 求值
+    if (isNum(ast, L) && ast->Data[L].Val)
+      setNum(ast, N, 1);
+    return;
+  default:
+    return;
+  }
+}
+
+/**
+ * @brief 化简一个节点，其子节点均已化简完毕
+ *
+ * @param ast 语法树
+ * @param N 节点
+ * @param Arg 源文件所在的词法分析器，报错用
+ */
+static void foldNode(Ast *ast, NodeId N, void *Arg) {
+  NodeId L = ast->LHS[N];
+  NodeId R = ast->RHS[N];
+
+  switch (ast->Kind[N]) {
+  // 语句、常数与变量无需化简
+  case BLOCK:
+  case EXPR_STMT:
+  case RETURN:
+  case NUM:
+  case VAR:
+    return;
+  // -c, - -x
+  case NEG:
+    if (isNum(ast, L))
+      setNum(ast, N, (long)(0UL - (unsigned long)ast->Data[L].Val));
+    else if (ast->Kind[L] == NEG)
+      replaceWith(ast, N, ast->LHS[L]);
+    return;
+  // ~c, ~~x
+  case NOT:
+    if (isNum(ast, L))
+      setNum(ast, N, ~ast->Data[L].Val);
+    else if (ast->Kind[L] == NOT)
+      replaceWith(ast, N, ast->LHS[L]);
+    return;
+  // !c
+  case LOGIC_NOT:
+    if (isNum(ast, L))
+      setNum(ast, N, !ast->Data[L].Val);
+    return;
+  // c ? x : y
+  case CONDITION: {
+    NodeId Cond = ast->Data[N].Cond;
+    if (isNum(ast, Cond))
+      replaceWith(ast, N, ast->Data[Cond].Val ? L : R);
+    return;
+  }
+  // 左部无副作用时只保留右部
+  case COMMA:
+    if (isPure(ast, L))
+      replaceWith(ast, N, R);
+    return;
+  // 除数为 0 时给出警告，留待运行时求值
+  case DIV:
+  case MOD:
+  case DIV_ASSIGN:
+  case MOD_ASSIGN:
+    if (isNumOf(ast, R, 0)) {
+      warnAt(Arg, ast->Loc[N], "division by zero");
+      return;
+    }
+    break;
+  default:
+    break;
+  }
+
+  // 两侧都是常数时直接求值
+  long Val;
+  if (isNum(ast, L) && isNum(ast, R) &&
+      evalBinary(ast->Kind[N], ast->Data[L].Val, ast->Data[R].Val, &Val)) {
+    setNum(ast, N, Val);
+    return;
+  }
+  simplifyBinary(ast, N, L, R);
+}
+
+void fold(Function *func) { astVisit(func->Tree, foldNode, func->lexer); }
@@ -0,0 +1,236 @@
+#include "Compiler.h"
+#include <stdatomic.h>
+
+// 字符串池块大小
+#define STR_POOL_CHUNK (64 * 1024)
+
+// 符号按块存放，块一经分配不再移动，查找时无需加锁
+#define SYM_BLOCK_BITS 12
+#define SYM_BLOCK_SIZE (1u << SYM_BLOCK_BITS)
+#define SYM_BLOCK_MAX 65536
+
+// 哈希表，开放寻址，槽位存放符号编号，0 为空槽
+typedef struct SymTable SymTable;
+struct SymTable {
+  SymTable *prev;               // 扩容前的旧表，其他线程可能仍在读取，重置时释放
+  unsigned int mask;            // 容量 - 1
+  _Atomic unsigned int slots[]; // 槽位
+};
+
+// 字符串池块，块链表供重置时释放
+typedef struct PoolChunk PoolChunk;
+struct PoolChunk {
+  PoolChunk *next; // 下一块
+  char data[];     // 字符串
+};
+
+// 驻留表，由编译上下文持有，词法分析与语法分析共用，
+// 并行词法分析时多个线程同时使用
+// 查找不加锁，新增符号与扩容在锁内进行，槽位写入以 release 语义发布
+struct InternTable {
+  Symbol *blocks[SYM_BLOCK_MAX]; // 符号块，符号编号的高位为块下标
+  _Atomic(SymTable *) tab;       // 当前哈希表
+  unsigned int len;              // 符号个数 + 1，0 号不使用
+  PoolChunk *chunks;             // 字符串池块链表，含单独分配的超长字符串
+  char *pool;                    // 当前字符串池块的空闲位置
+  size_t poolLeft;               // 当前字符串池块剩余字节
+  pthread_mutex_t lock;          // 保护新增符号
+};
+
+InternTable *newInternTable(void) {
+  InternTable *T = calloc(1, sizeof(InternTable));
+  if (!T)
+    error("out of memory");
+  T->len = 1;
+  pthread_mutex_init(&T->lock, NULL);
+  return T;
+}
+
+void resetInternTable(InternTable *T) {
+  // 编译单元结束后没有其他线程在使用，旧表与字符串池全部释放
+  SymTable *Tab = atomic_load_explicit(&T->tab, memory_order_relaxed);
+  if (Tab) {
+    while (Tab->prev) {
+      SymTable *Prev = Tab->prev;
+      Tab->prev = Prev->prev;
+      free(Prev);
+    }
+    for (unsigned int i = 0; i <= Tab->mask; i++)
+      atomic_store_explicit(&Tab->slots[i], 0, memory_order_relaxed);
+  }
+  while (T->chunks) {
+    PoolChunk *Next = T->chunks->next;
+    free(T->chunks);
+    T->chunks = Next;
+  }
+  T->pool = NULL;
+  T->poolLeft = 0;
+
+  // 保留当前哈希表与首个符号块供下一编译单元使用
+  for (unsigned int i = 1; i < SYM_BLOCK_MAX && T->blocks[i]; i++) {
+    free(T->blocks[i]);
+    T->blocks[i] = NULL;
+  }
+  T->len = 1;
+}
+
+void freeInternTable(InternTable *T) {
+  resetInternTable(T);
+  free(atomic_load_explicit(&T->tab, memory_order_relaxed));
+  free(T->blocks[0]);
+  pthread_mutex_destroy(&T->lock);
+  free(T);
+}
+
+/**
+ * @brief FNV-1a 字符串哈希
+ *
+ * @param Str 字符串
+ * @param Len 长度
+ * @return unsigned int 哈希值
+ */
+static unsigned int hashStr(const char *Str, unsigned int Len) {
+  unsigned int H = 2166136261u;
+  for (unsigned int i = 0; i < Len; i++) {
+    H ^= (unsigned char)Str[i];
+    H *= 16777619u;
+  }
+  return H;
+}
+
+/**
+ * @brief 从字符串池中复制一份以 '\0' 结尾的字符串，调用方持有锁
+ *
+ * @param T 驻留表
+ * @param Str 字符串
+ * @param Len 长度
+ * @return char* 池中的副本，内存不足时为 NULL
+ */
+static char *poolStrndup(InternTable *T, const char *Str, unsigned int Len) {
+  if (T->poolLeft < Len + 1) {
+    // 超长字符串单独成块，避免浪费当前池块
+    bool Own = Len + 1 > STR_POOL_CHUNK / 4;
+    PoolChunk *Chunk =
+        malloc(sizeof(PoolChunk) + (Own ? Len + 1 : STR_POOL_CHUNK));
+    if (!Chunk)
+      return NULL;
+    Chunk->next = T->chunks;
+    T->chunks = Chunk;
+    if (Own) {
+      memcpy(Chunk->data, Str, Len);
+      Chunk->data[Len] = '\0';
+      return Chunk->data;
+    }
+    T->pool = Chunk->data;
+    T->poolLeft = STR_POOL_CHUNK;
+  }
+  char *Copy = T->pool;
+  memcpy(Copy, Str, Len);
+  Copy[Len] = '\0';
+  T->pool += Len + 1;
+  T->poolLeft -= Len + 1;
+  return Copy;
+}
+
+/**
+ * @brief 在哈希表中查找字符串
+ *
+ * @param T 驻留表
+ * @param Tab 哈希表
+ * @param Str 字符串
+ * @param Len 长度
+ * @param H 哈希值
+ * @param Slot 未找到时返回可插入的空槽
+ * @return unsigned int 符号编号，未找到时为 0
+ */
+static unsigned int lookup(const InternTable *T, SymTable *Tab,
+                           const char *Str, unsigned int Len, unsigned int H,
+                           unsigned int *Slot) {
+  unsigned int S = H & Tab->mask;
+  for (;; S = (S + 1) & Tab->mask) {
+    unsigned int Id =
+        atomic_load_explicit(&Tab->slots[S], memory_order_acquire);
+    if (!Id)
+      break;
+    const Symbol *Sym = symbolOf(T, Id);
+    if (Sym->hash == H && Sym->len == Len && !memcmp(Sym->name, Str, Len))
+      return Id;
+  }
+  *Slot = S;
+  return 0;
+}
+
+/**
+ * @brief 哈希表扩容为原来两倍，重新放入全部符号后发布，调用方持有锁
+ *
+ * @param T 驻留表
+ * @return SymTable* 新哈希表，内存不足时为 NULL，原表不变
+ */
+static SymTable *growTable(InternTable *T) {
+  SymTable *Old = atomic_load_explicit(&T->tab, memory_order_relaxed);
+  unsigned int Cap = Old ? (Old->mask + 1) * 2 : 1024;
+  SymTable *Tab = calloc(1, sizeof(SymTable) + Cap * sizeof(unsigned int));
+  if (!Tab)
+    return NULL;
+  Tab->prev = Old;
+  Tab->mask = Cap - 1;
+  for (unsigned int Id = 1; Id < T->len; Id++) {
+    unsigned int Slot = symbolOf(T, Id)->hash & Tab->mask;
+    while (atomic_load_explicit(&Tab->slots[Slot], memory_order_relaxed))
+      Slot = (Slot + 1) & Tab->mask;
+    atomic_store_explicit(&Tab->slots[Slot], Id, memory_order_relaxed);
+  }
+  atomic_store_explicit(&T->tab, Tab, memory_order_release);
+  return Tab;
+}
+
+// 释放锁后报错，报错处理器跳回后其他线程仍能驻留
+static void unlockAndFail(InternTable *T, const char *Msg) {
+  pthread_mutex_unlock(&T->lock);
+  error("%s", Msg);
+}
+
+unsigned int intern(InternTable *T, const char *Str, unsigned int Len) {
+  unsigned int H = hashStr(Str, Len);
+  unsigned int Slot;
+
+  // 多数标识符已驻留，不加锁查找
+  SymTable *Tab = atomic_load_explicit(&T->tab, memory_order_acquire);
+  unsigned int Id = Tab ? lookup(T, Tab, Str, Len, H, &Slot) : 0;
+  if (Id)
+    return Id;
+
+  pthread_mutex_lock(&T->lock);
+  // 装载因子超过 1/2 时扩容
+  Tab = atomic_load_explicit(&T->tab, memory_order_relaxed);
+  if (!Tab || 2 * T->len >= Tab->mask) {
+    if (!(Tab = growTable(T)))
+      unlockAndFail(T, "out of memory");
+  }
+
+  // 加锁前其他线程可能已新增该符号
+  Id = lookup(T, Tab, Str, Len, H, &Slot);
+  if (!Id) {
+    // 出错时不改动驻留表，符号个数在符号写好之后才增加
+    Id = T->len;
+    if (Id >> SYM_BLOCK_BITS >= SYM_BLOCK_MAX)
+      unlockAndFail(T, "too many identifiers");
+    Symbol **Block = &T->blocks[Id >> SYM_BLOCK_BITS];
+    if (!*Block && !(*Block = malloc(SYM_BLOCK_SIZE * sizeof(Symbol))))
+      unlockAndFail(T, "out of memory");
+    Symbol *Sym = &(*Block)[Id & (SYM_BLOCK_SIZE - 1)];
+    if (!(Sym->name = poolStrndup(T, Str, Len)))
+      unlockAndFail(T, "out of memory");
+    T->len++;
+    Sym->len = Len;
+    Sym->hash = H;
+    // 符号写完后再发布槽位，不加锁的查找者看到编号时符号已完整
+    atomic_store_explicit(&Tab->slots[Slot], Id, memory_order_release);
+  }
+  pthread_mutex_unlock(&T->lock);
+  return Id;
+}
+
+const Symbol *symbolOf(const InternTable *T, unsigned int Id) {
+  return &T->blocks[Id >> SYM_BLOCK_BITS][Id & (SYM_BLOCK_SIZE - 1)];
+}
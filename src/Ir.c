@@ -0,0 +1,407 @@
+#include "Compiler.h"
+
+// SSA 形式的中间表示
+// 函数由基本块组成，块中的每条有值的指令定义一个虚拟寄存器，只赋值一次
+// 块、指令与 φ 的操作数表都从编译单元内存区分配，编译结束时整体释放
+
+// 操作名，下标为 IrOp
+static const char *const IrOpNames[] = {
+    [IR_CONST] = "const", [IR_UNDEF] = "undef", [IR_PHI] = "phi",
+    [IR_ADD] = "add",     [IR_SUB] = "sub",     [IR_MUL] = "mul",
+    [IR_DIV] = "div",     [IR_REM] = "rem",     [IR_SHL] = "shl",
+    [IR_SHR] = "shr",     [IR_AND] = "and",     [IR_OR] = "or",
+    [IR_XOR] = "xor",     [IR_EQ] = "eq",       [IR_NE] = "ne",
+    [IR_LT] = "lt",       [IR_LE] = "le",       [IR_NEG] = "neg",
+    [IR_NOT] = "not",     [IR_ZEXT] = "zext",   [IR_JMP] = "jmp",
+    [IR_BR] = "br",       [IR_RET] = "ret",
+};
+
+// 类型名，下标为 IrType
+static const char *const IrTypeNames[] = {
+    [IR_VOID] = "void",
+    [IR_I1] = "i1",
+    [IR_I64] = "i64",
+};
+
+IrFunc *newIrFunc(Arena *arena) {
+  IrFunc *F = arenaAlloc(arena, sizeof(IrFunc));
+  F->arena = arena;
+  F->NumValues = 1;
+  irPlaceBlock(F, irNewBlock(F));
+  return F;
+}
+
+IrBlock *irNewBlock(IrFunc *F) {
+  return arenaAlloc(F->arena, sizeof(IrBlock));
+}
+
+void irPlaceBlock(IrFunc *F, IrBlock *B) {
+  B->Id = F->NumBlocks++;
+  if (F->Tail)
+    F->Tail->Next = B;
+  else
+    F->Entry = B;
+  F->Tail = B;
+}
+
+void irAddPred(IrFunc *F, IrBlock *B, IrBlock *Pred) {
+  // 前驱通常只有一两个，容量不足时在内存区中重新分配
+  if (B->NumPreds == B->PredCap) {
+    unsigned int Cap = B->PredCap ? B->PredCap * 2 : 2;
+    IrBlock **Preds = arenaAlloc(F->arena, Cap * sizeof(IrBlock *));
+    if (B->NumPreds)
+      memcpy(Preds, B->Preds, B->NumPreds * sizeof(IrBlock *));
+    B->Preds = Preds;
+    B->PredCap = Cap;
+  }
+  B->Preds[B->NumPreds++] = Pred;
+}
+
+// 新建指令，有值时分配值编号
+static IrInst *newInst(IrFunc *F, IrOp Op, IrType Type) {
+  IrInst *I = arenaAlloc(F->arena, sizeof(IrInst));
+  I->Op = Op;
+  I->Type = Type;
+  if (Type != IR_VOID)
+    I->Id = F->NumValues++;
+  return I;
+}
+
+IrInst *irAppend(IrFunc *F, IrBlock *B, IrOp Op, IrType Type, IrInst *A,
+                 IrInst *Bv) {
+  IrInst *I = newInst(F, Op, Type);
+  I->Args[0] = A;
+  I->Args[1] = Bv;
+  if (B->Last)
+    B->Last->Next = I;
+  else
+    B->First = I;
+  B->Last = I;
+  return I;
+}
+
+IrInst *irPhi(IrFunc *F, IrBlock *B, IrType Type) {
+  IrInst *I = irAppend(F, B, IR_PHI, Type, NULL, NULL);
+  I->PhiArgs = arenaAlloc(F->arena, B->NumPreds * sizeof(IrInst *));
+  return I;
+}
+
+IrInst *irUndef(IrFunc *F) {
+  if (F->Undef)
+    return F->Undef;
+  // 加在入口块开头，支配全部的块
+  IrInst *I = newInst(F, IR_UNDEF, IR_I64);
+  I->Next = F->Entry->First;
+  F->Entry->First = I;
+  if (!F->Entry->Last)
+    F->Entry->Last = I;
+  F->Undef = I;
+  return I;
+}
+
+// 两个块在支配树中的最近公共祖先，编号较大的一方先向上走
+static IrBlock *intersect(IrBlock *A, IrBlock *B) {
+  while (A != B) {
+    while (A->Id > B->Id)
+      A = A->Idom;
+    while (B->Id > A->Id)
+      B = B->Idom;
+  }
+  return A;
+}
+
+void irDominators(IrFunc *F) {
+  // 按拓扑序处理时前驱的直接支配者都已求出，不必迭代
+  for (IrBlock *B = F->Entry; B; B = B->Next) {
+    B->DomChild = B->DomSibling = NULL;
+    if (B == F->Entry) {
+      B->Idom = NULL;
+      continue;
+    }
+    IrBlock *Idom = B->Preds[0];
+    for (unsigned int i = 1; i < B->NumPreds; i++)
+      Idom = intersect(Idom, B->Preds[i]);
+    B->Idom = Idom;
+    B->DomSibling = Idom->DomChild;
+    Idom->DomChild = B;
+  }
+
+  // 先序遍历支配树，沿 Idom 返回，不需要栈
+  unsigned int N = 0;
+  IrBlock *B = F->Entry;
+  B->DomIn = N++;
+  while (B) {
+    if (B->DomChild) {
+      B = B->DomChild;
+      B->DomIn = N++;
+      continue;
+    }
+    // 没有子节点时离开，直到找到下一个兄弟节点
+    while (B) {
+      B->DomOut = N++;
+      if (B->DomSibling) {
+        B = B->DomSibling;
+        B->DomIn = N++;
+        break;
+      }
+      B = B->Idom;
+    }
+  }
+}
+
+// A 是否支配 B
+static bool dominates(const IrBlock *A, const IrBlock *B) {
+  return A->DomIn <= B->DomIn && B->DomOut <= A->DomOut;
+}
+
+// 中间表示检查的状态
+typedef struct {
+  IrFunc *F;
+  IrBlock **DefBlock;   // 各值所在的块
+  unsigned int *DefPos; // 各值在所在块中的位置
+} Verifier;
+
+// 检查失败时报错
+static void check(bool OK, const IrBlock *B, const char *Msg) {
+  if (!OK)
+    error("invalid IR in bb%u: %s", B->Id, Msg);
+}
+
+/**
+ * @brief 检查操作数的定义支配这次使用
+ *
+ * @param V 检查状态
+ * @param Arg 操作数
+ * @param B 使用所在的块，φ 的操作数为对应的前驱
+ * @param Pos 使用在块中的位置，φ 的操作数为前驱末尾
+ */
+static void checkUse(Verifier *V, const IrInst *Arg, IrBlock *B,
+                     unsigned int Pos) {
+  check(Arg && Arg->Id && Arg->Id < V->F->NumValues && V->DefBlock[Arg->Id],
+        B, "operand is not a value");
+  IrBlock *Def = V->DefBlock[Arg->Id];
+  if (Def == B)
+    check(V->DefPos[Arg->Id] < Pos, B, "use before definition");
+  else
+    check(dominates(Def, B), B, "definition does not dominate use");
+}
+
+// 检查操作数的类型
+static void checkArgs(const IrInst *I, const IrBlock *B, unsigned int Num,
+                      IrType Type) {
+  for (unsigned int i = 0; i < 2; i++) {
+    if (i < Num)
+      check(I->Args[i] && I->Args[i]->Type == Type, B, "operand type");
+    else
+      check(!I->Args[i], B, "extra operand");
+  }
+}
+
+/**
+ * @brief 检查一条指令的操作数个数、类型与结果类型
+ *
+ * @param I 指令
+ * @param B 所在块
+ */
+static void checkTypes(const IrInst *I, const IrBlock *B) {
+  switch (I->Op) {
+  case IR_CONST:
+    check(I->Type == IR_I64 || (I->Type == IR_I1 && (I->Imm & ~1L) == 0), B,
+          "const type");
+    return;
+  case IR_UNDEF:
+    check(I->Type == IR_I64, B, "undef type");
+    return;
+  case IR_PHI:
+    check(I->Type == IR_I64 || I->Type == IR_I1, B, "phi type");
+    for (unsigned int i = 0; i < B->NumPreds; i++)
+      check(I->PhiArgs[i] && I->PhiArgs[i]->Type == I->Type, B,
+            "phi operand type");
+    return;
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_DIV:
+  case IR_REM:
+  case IR_SHL:
+  case IR_SHR:
+  case IR_AND:
+  case IR_OR:
+  case IR_XOR:
+    check(I->Type == IR_I64, B, "result type");
+    checkArgs(I, B, 2, IR_I64);
+    return;
+  case IR_EQ:
+  case IR_NE:
+  case IR_LT:
+  case IR_LE:
+    check(I->Type == IR_I1, B, "result type");
+    checkArgs(I, B, 2, IR_I64);
+    return;
+  case IR_NEG:
+  case IR_NOT:
+  case IR_RET:
+    check(I->Type == (I->Op == IR_RET ? IR_VOID : IR_I64), B, "result type");
+    checkArgs(I, B, 1, IR_I64);
+    return;
+  case IR_ZEXT:
+    check(I->Type == IR_I64, B, "result type");
+    checkArgs(I, B, 1, IR_I1);
+    return;
+  case IR_BR:
+    check(I->Type == IR_VOID, B, "result type");
+    checkArgs(I, B, 1, IR_I1);
+    return;
+  case IR_JMP:
+    check(I->Type == IR_VOID, B, "result type");
+    checkArgs(I, B, 0, IR_VOID);
+    return;
+  default:
+    check(false, B, "unknown operation");
+  }
+}
+
+// 指令是否为终结指令
+static bool isTerminator(const IrInst *I) {
+  return I->Op == IR_JMP || I->Op == IR_BR || I->Op == IR_RET;
+}
+
+// Pred 在 B 的前驱中出现的次数
+static unsigned int countPred(const IrBlock *B, const IrBlock *Pred) {
+  unsigned int N = 0;
+  for (unsigned int i = 0; i < B->NumPreds; i++)
+    N += B->Preds[i] == Pred;
+  return N;
+}
+
+void verifyIr(IrFunc *F) {
+  // 块结构：φ 在前，终结指令只在末尾，跳转只能向后
+  unsigned int Id = 0;
+  for (IrBlock *B = F->Entry; B; B = B->Next) {
+    check(B->Id == Id++, B, "block id out of layout order");
+    check(B->Last && isTerminator(B->Last), B, "missing terminator");
+    check((B == F->Entry) == (B->NumPreds == 0), B,
+          "only the entry block has no predecessor");
+    bool Body = false;
+    for (IrInst *I = B->First; I; I = I->Next) {
+      check(I == B->Last ? !I->Next : !isTerminator(I), B,
+            "terminator in the middle of a block");
+      check(I->Op != IR_PHI || !Body, B, "phi after other instructions");
+      check(I->Op != IR_UNDEF || (B == F->Entry && I == F->Undef), B,
+            "undef outside the entry block");
+      Body |= I->Op != IR_PHI;
+      check((I->Type != IR_VOID) == (I->Id != 0), B, "value id");
+    }
+    for (unsigned int i = 0; i < irNumSuccs(B->Last); i++) {
+      IrBlock *S = B->Last->Succs[i];
+      check(S && S->Id > B->Id && S->Id < F->NumBlocks, B,
+            "successor is not a later block");
+      check(countPred(S, B) == 1, B, "successor does not list this block");
+    }
+    for (unsigned int i = 0; i < B->NumPreds; i++) {
+      IrBlock *P = B->Preds[i];
+      check(P->Id < B->Id, B, "predecessor is not an earlier block");
+      check(i == 0 || B->Preds[i - 1]->Id < P->Id, B,
+            "predecessors out of layout order");
+      bool Found = false;
+      for (unsigned int s = 0; s < irNumSuccs(P->Last); s++)
+        Found |= P->Last->Succs[s] == B;
+      check(Found, B, "predecessor does not jump here");
+    }
+  }
+  check(Id == F->NumBlocks, F->Tail, "block count");
+
+  irDominators(F);
+  Verifier V = {F, calloc(F->NumValues, sizeof(IrBlock *)),
+                calloc(F->NumValues, sizeof(unsigned int))};
+  if (!V.DefBlock || !V.DefPos)
+    error("out of memory");
+
+  // 各值只定义一次；按拓扑序检查，使用之前定义已记录
+  for (IrBlock *B = F->Entry; B; B = B->Next) {
+    unsigned int Pos = 0;
+    for (IrInst *I = B->First; I; I = I->Next, Pos++) {
+      checkTypes(I, B);
+      if (I->Op == IR_PHI) {
+        for (unsigned int i = 0; i < B->NumPreds; i++) {
+          IrBlock *P = B->Preds[i];
+          checkUse(&V, I->PhiArgs[i], P, UINT32_MAX);
+        }
+      } else if (I->Op != IR_CONST && I->Op != IR_UNDEF) {
+        for (unsigned int i = 0; i < 2 && I->Args[i]; i++)
+          checkUse(&V, I->Args[i], B, Pos);
+      }
+      if (I->Id) {
+        check(I->Id < F->NumValues && !V.DefBlock[I->Id], B,
+              "value defined twice");
+        V.DefBlock[I->Id] = B;
+        V.DefPos[I->Id] = Pos;
+      }
+    }
+  }
+  free(V.DefBlock);
+  free(V.DefPos);
+}
+
+// 输出值的名称
+static void printValue(StrBuf *B, const IrInst *I) {
+  strBufPrintf(B, "%%%u", I->Id);
+}
+
+void irPrintInst(StrBuf *B, const IrInst *I, const IrBlock *Block) {
+  if (I->Id) {
+    printValue(B, I);
+    strBufPrintf(B, " = %s %s", IrOpNames[I->Op], IrTypeNames[I->Type]);
+  } else {
+    strBufPrintf(B, "%s", IrOpNames[I->Op]);
+  }
+
+  switch (I->Op) {
+  case IR_CONST:
+    strBufPrintf(B, " %ld", I->Imm);
+    return;
+  case IR_UNDEF:
+    return;
+  case IR_PHI:
+    for (unsigned int i = 0; i < Block->NumPreds; i++) {
+      strBufPrintf(B, i ? ", [" : " [");
+      printValue(B, I->PhiArgs[i]);
+      strBufPrintf(B, ", bb%u]", Block->Preds[i]->Id);
+    }
+    return;
+  case IR_JMP:
+    strBufPrintf(B, " bb%u", I->Succs[0]->Id);
+    return;
+  case IR_BR:
+    strBufPrintf(B, " ");
+    printValue(B, I->Args[0]);
+    strBufPrintf(B, ", bb%u, bb%u", I->Succs[0]->Id, I->Succs[1]->Id);
+    return;
+  default:
+    break;
+  }
+  for (unsigned int i = 0; i < 2 && I->Args[i]; i++) {
+    strBufPrintf(B, i ? ", " : " ");
+    printValue(B, I->Args[i]);
+  }
+}
+
+void dumpIr(StrBuf *B, IrFunc *F) {
+  irDominators(F);
+  strBufPrintf(B, "func main {\n");
+  for (IrBlock *Block = F->Entry; Block; Block = Block->Next) {
+    strBufPrintf(B, "bb%u:", Block->Id);
+    // 块首注释列出前驱与直接支配者
+    for (unsigned int i = 0; i < Block->NumPreds; i++)
+      strBufPrintf(B, i ? ", bb%u" : "  ; preds bb%u", Block->Preds[i]->Id);
+    if (Block->Idom)
+      strBufPrintf(B, "; idom bb%u", Block->Idom->Id);
+    strBufPrintf(B, "\n");
+    for (IrInst *I = Block->First; I; I = I->Next) {
+      strBufPrintf(B, "  ");
+      irPrintInst(B, I, Block);
+      strBufPrintf(B, "\n");
+    }
+  }
+  strBufPrintf(B, "}\n");
+}
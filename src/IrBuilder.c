@@ -0,0 +1,634 @@
+#include "Compiler.h"
+
+// 由语法树构造 SSA 形式的中间表示
+// 各变量的当前值记录在 vals 中，赋值只改写当前值，不产生指令
+// 条件与逻辑运算的分支中改写的变量记入写入日志，汇合时为两侧不同的值加入 φ
+// 语言中没有循环与跳转语句，块按构造顺序布局即为拓扑序，
+// 汇合块的前驱在放入布局之前都已确定，读取变量时不必向前驱查找
+
+// 构造栈帧，Stage 为该节点已完成的步骤数
+typedef struct {
+  NodeId Node;          // 表达式节点
+  unsigned int Stage;   // 已完成的步骤数
+  IrInst *Val;          // 先求值的子节点、真分支或左部流入汇合块的值
+  IrBlock *Else;        // 条件运算符的假分支
+  IrBlock *Join;        // 条件与逻辑运算符的汇合块
+  unsigned int LogBase; // 进入分支前的写入日志位置
+  unsigned int ArmLog;  // 条件运算符真分支结束时的写入日志位置
+} BuildFrame;
+
+// 写入日志项，记录分支中被改写的变量
+typedef struct {
+  unsigned int Var; // 变量编号
+  IrInst *Old;      // 改写前的值，为空时尚未赋值
+  IrInst *Arm;      // 真分支结束时的值
+} LogEntry;
+
+struct IrBuilder {
+  IrFunc *F;    // 正在构造的中间表示
+  Ast *ast;     // 语法树
+  IrBlock *Cur; // 当前块，return 之后为空
+
+  // 变量
+  IrInst **vals;       // 各变量的当前值，为空时尚未赋值
+  unsigned int *mark;  // 汇合时为变量去重，等于 markGen 的已处理
+  unsigned int markGen; // 当前去重标记
+  unsigned int varCap; // vals 与 mark 的容量
+
+  // 写入日志，只在分支之中记录
+  LogEntry *log;         // 日志
+  unsigned int logTop;   // 日志长度
+  unsigned int logCap;   // 日志容量
+  unsigned int armDepth; // 尚未汇合的分支层数
+
+  // 构造用的栈，树的深度只受内存限制
+  BuildFrame *frames;    // 表达式构造栈
+  unsigned int frameCap; // 表达式构造栈容量
+  NodeId *stmts;         // 各层代码块中待构造的 BLOCK 节点
+  unsigned int stmtCap;  // 语句栈容量
+  unsigned int *need;    // 各节点求值需要的临时值个数
+  unsigned char *effect; // 各节点子树读写变量的情况，EFFECT_READ 与 EFFECT_WRITE
+  unsigned int needCap;  // need 与 effect 的容量
+};
+
+// 子树读取变量
+#define EFFECT_READ 1
+// 子树写入变量
+#define EFFECT_WRITE 2
+
+// 复合赋值运算符对应的二元运算
+static const NodeKind AssignOps[] = {
+    [MUL_ASSIGN] = MUL, [DIV_ASSIGN] = DIV, [MOD_ASSIGN] = MOD,
+    [ADD_ASSIGN] = ADD, [SUB_ASSIGN] = SUB, [SHL_ASSIGN] = SHL,
+    [SHR_ASSIGN] = SHR, [AND_ASSIGN] = AND, [XOR_ASSIGN] = XOR,
+    [OR_ASSIGN] = OR,
+};
+
+// 二元运算节点对应的操作，比较运算另行处理
+static const unsigned char BinOps[] = {
+    [ADD] = IR_ADD, [SUB] = IR_SUB, [MUL] = IR_MUL, [DIV] = IR_DIV,
+    [MOD] = IR_REM, [SHL] = IR_SHL, [SHR] = IR_SHR, [AND] = IR_AND,
+    [OR] = IR_OR,   [XOR] = IR_XOR,
+};
+
+// 在当前块末尾加入指令
+static IrInst *emit(IrBuilder *builder, IrOp Op, IrType Type, IrInst *A,
+                    IrInst *Bv) {
+  return irAppend(builder->F, builder->Cur, Op, Type, A, Bv);
+}
+
+// 常数
+static IrInst *constant(IrBuilder *builder, IrType Type, long Val) {
+  IrInst *I = emit(builder, IR_CONST, Type, NULL, NULL);
+  I->Imm = Val;
+  return I;
+}
+
+// 以当前块跳转到 Target 结束
+static void jumpTo(IrBuilder *builder, IrBlock *Target) {
+  IrInst *I = emit(builder, IR_JMP, IR_VOID, NULL, NULL);
+  I->Succs[0] = Target;
+  irAddPred(builder->F, Target, builder->Cur);
+}
+
+// 以当前块按 Cond 跳转到 Then 或 Else 结束
+static void branchTo(IrBuilder *builder, IrInst *Cond, IrBlock *Then,
+                     IrBlock *Else) {
+  IrInst *I = emit(builder, IR_BR, IR_VOID, Cond, NULL);
+  I->Succs[0] = Then;
+  I->Succs[1] = Else;
+  irAddPred(builder->F, Then, builder->Cur);
+  irAddPred(builder->F, Else, builder->Cur);
+}
+
+// 整数转为条件，比较结果直接使用
+static IrInst *toBool(IrBuilder *builder, IrInst *V) {
+  if (V->Op == IR_ZEXT)
+    return V->Args[0];
+  if (V->Op == IR_CONST)
+    return constant(builder, IR_I1, V->Imm != 0);
+  return emit(builder, IR_NE, IR_I1, V, constant(builder, IR_I64, 0));
+}
+
+// 比较结果扩展为整数
+static IrInst *fromBool(IrBuilder *builder, IrInst *C) {
+  return emit(builder, IR_ZEXT, IR_I64, C, NULL);
+}
+
+// 读取变量的当前值，尚未赋值时为 undef
+static IrInst *readVar(IrBuilder *builder, Obj *Var) {
+  IrInst *V = builder->vals[Var->Index];
+  return V ? V : irUndef(builder->F);
+}
+
+// 改写变量的当前值，在分支之中时记入写入日志
+static void writeVar(IrBuilder *builder, Obj *Var, IrInst *V) {
+  if (builder->armDepth) {
+    builder->log = growStack(builder->log, &builder->logCap, builder->logTop,
+                             sizeof(LogEntry));
+    builder->log[builder->logTop++] =
+        (LogEntry){Var->Index, builder->vals[Var->Index], NULL};
+  }
+  builder->vals[Var->Index] = V;
+}
+
+/**
+ * @brief 结束真分支：记下其中改写的变量在分支末尾的值，再恢复为进入分支前的值
+ *
+ * @param builder 构造器
+ * @param Base 进入分支前的写入日志位置
+ */
+static void closeArm(IrBuilder *builder, unsigned int Base) {
+  LogEntry *Log = builder->log;
+  for (unsigned int i = Base; i < builder->logTop; i++)
+    Log[i].Arm = builder->vals[Log[i].Var];
+  // 倒序恢复，同一变量最后恢复的是最早的旧值
+  for (unsigned int i = builder->logTop; i-- > Base;)
+    builder->vals[Log[i].Var] = Log[i].Old;
+}
+
+// 两个前驱流入的值不同时在当前块加入 φ
+static IrInst *merge(IrBuilder *builder, IrType Type, IrInst *A, IrInst *Bv) {
+  if (A == Bv)
+    return A;
+  IrInst *Phi = irPhi(builder->F, builder->Cur, Type);
+  Phi->PhiArgs[0] = A ? A : irUndef(builder->F);
+  Phi->PhiArgs[1] = Bv ? Bv : irUndef(builder->F);
+  return Phi;
+}
+
+/**
+ * @brief 在汇合块中合并两侧改写的变量，第一个前驱的改写已由 closeArm 结束，
+ * 第二个前驱的改写仍在当前值中；日志压缩为每个变量一项，供外层分支使用
+ *
+ * @param builder 构造器，当前块为汇合块
+ * @param Base 进入分支前的写入日志位置
+ * @param Mid 第二个前驱的改写在日志中的起始位置
+ */
+static void mergeArms(IrBuilder *builder, unsigned int Base,
+                      unsigned int Mid) {
+  LogEntry *Log = builder->log;
+  unsigned int Gen = ++builder->markGen;
+  unsigned int Out = Base;
+  for (unsigned int i = Base; i < builder->logTop; i++) {
+    LogEntry E = Log[i];
+    if (builder->mark[E.Var] == Gen)
+      continue;
+    builder->mark[E.Var] = Gen;
+    // 变量的第一项记录的是分支之前的值
+    IrInst *A = i < Mid ? E.Arm : E.Old;
+    builder->vals[E.Var] = merge(builder, IR_I64, A, builder->vals[E.Var]);
+    Log[Out++] = (LogEntry){E.Var, E.Old, NULL};
+  }
+  // 最外层的分支汇合后不再需要日志
+  builder->logTop = --builder->armDepth ? Out : Base;
+}
+
+/**
+ * @brief 取得被赋值的变量
+ *
+ * @param builder 构造器
+ * @param node 左值节点
+ * @return Obj* 变量
+ */
+static Obj *lvalue(IrBuilder *builder, NodeId node) {
+  Ast *ast = builder->ast;
+  if (ast->Kind[node] == VAR)
+    return ast->Data[node].Var;
+
+  error("Not Assignable\n");
+  return NULL;
+}
+
+/**
+ * @brief 生成二元运算，比较运算的结果扩展为整数
+ *
+ * @param builder 构造器
+ * @param Kind 运算符节点种类
+ * @param L 左值
+ * @param R 右值
+ * @return IrInst* 结果
+ */
+static IrInst *binary(IrBuilder *builder, NodeKind Kind, IrInst *L,
+                      IrInst *R) {
+  switch (Kind) {
+  case EQ:
+    return fromBool(builder, emit(builder, IR_EQ, IR_I1, L, R));
+  case NE:
+    return fromBool(builder, emit(builder, IR_NE, IR_I1, L, R));
+  case LT:
+    return fromBool(builder, emit(builder, IR_LT, IR_I1, L, R));
+  case GT:
+    return fromBool(builder, emit(builder, IR_LT, IR_I1, R, L));
+  case LE:
+    return fromBool(builder, emit(builder, IR_LE, IR_I1, L, R));
+  case GE:
+    return fromBool(builder, emit(builder, IR_LE, IR_I1, R, L));
+  case ADD:
+  case SUB:
+  case MUL:
+  case DIV:
+  case MOD:
+  case SHL:
+  case SHR:
+  case AND:
+  case OR:
+  case XOR:
+    return emit(builder, BinOps[Kind], IR_I64, L, R);
+  default:
+    break;
+  }
+  error("invalid expresion");
+  return NULL;
+}
+
+/**
+ * @brief 二元运算是否先对左部求值
+ * 先求值需要更深的一侧，另一侧的值只多占一个临时值，同时存活的值最少
+ * 一侧写入变量时，另一侧须既不读也不写变量，交换顺序才不改变结果
+ *
+ * @param builder 构造器，need 与 effect 已算出子节点的值
+ * @param node 二元运算节点
+ * @return true 先左部
+ * @return false 先右部
+ */
+static bool leftFirst(IrBuilder *builder, NodeId node) {
+  Ast *ast = builder->ast;
+  NodeId L = ast->LHS[node], R = ast->RHS[node];
+  if (builder->need[L] <= builder->need[R])
+    return false;
+  unsigned char EL = builder->effect[L], ER = builder->effect[R];
+  return !((EL & EFFECT_WRITE) && ER) && !((ER & EFFECT_WRITE) && EL);
+}
+
+/**
+ * @brief 计算各节点求值需要的临时值个数，即 Sethi-Ullman 标号
+ * 子节点编号小于父节点，按编号顺序一遍即可算出
+ *
+ * @param builder 构造器
+ */
+static void needRegs(IrBuilder *builder) {
+  Ast *ast = builder->ast;
+  if (ast->Len > builder->needCap) {
+    // 分配成功后才记录容量，失败时下一编译单元重新分配
+    builder->needCap = 0;
+    free(builder->need);
+    free(builder->effect);
+    builder->need = malloc(ast->Len * sizeof(unsigned int));
+    builder->effect = malloc(ast->Len);
+    if (!builder->need || !builder->effect)
+      error("out of memory");
+    builder->needCap = ast->Len;
+  }
+
+  unsigned int *Need = builder->need;
+  unsigned char *Effect = builder->effect;
+  Need[0] = Effect[0] = 0;
+  for (NodeId N = 1; N < ast->Len; N++) {
+    unsigned int L = Need[ast->LHS[N]], R = Need[ast->RHS[N]];
+    Effect[N] = Effect[ast->LHS[N]] | Effect[ast->RHS[N]];
+    switch (ast->Kind[N]) {
+    case BLOCK:
+    case EXPR_STMT:
+    case RETURN:
+      Need[N] = 0;
+      break;
+    case NUM:
+      Need[N] = 1;
+      break;
+    case VAR:
+      Need[N] = 1;
+      Effect[N] = EFFECT_READ;
+      break;
+    case NEG:
+    case NOT:
+    case LOGIC_NOT:
+      Need[N] = L;
+      break;
+    case ASSIGN:
+      Need[N] = R;
+      Effect[N] = Effect[ast->RHS[N]] | EFFECT_WRITE;
+      break;
+    case COMMA:
+    case LOGIC_AND:
+    case LOGIC_OR:
+      Need[N] = L > R ? L : R;
+      break;
+    case CONDITION: {
+      unsigned int C = Need[ast->Data[N].Cond];
+      Need[N] = L > R ? L : R;
+      Need[N] = C > Need[N] ? C : Need[N];
+      Effect[N] |= Effect[ast->Data[N].Cond];
+      break;
+    }
+    case MUL_ASSIGN:
+    case DIV_ASSIGN:
+    case MOD_ASSIGN:
+    case ADD_ASSIGN:
+    case SUB_ASSIGN:
+    case SHL_ASSIGN:
+    case SHR_ASSIGN:
+    case AND_ASSIGN:
+    case XOR_ASSIGN:
+    case OR_ASSIGN:
+      // 变量的值另占一个临时值
+      Need[N] = R > 2 ? R : 2;
+      Effect[N] |= EFFECT_READ | EFFECT_WRITE;
+      break;
+    default:
+      // 先求值的一侧的值留到另一侧求值之后
+      if (leftFirst(builder, N))
+        Need[N] = R + 1 > L ? R + 1 : L;
+      else
+        Need[N] = L + 1 > R ? L + 1 : R;
+      break;
+    }
+  }
+}
+
+/**
+ * @brief 构造表达式的中间表示
+ * 以显式栈代替递归，每个栈帧按步骤构造一个节点，子节点入栈后先构造子节点，
+ * 子节点完成后其值在 Last 中
+ *
+ * @param builder 构造器
+ * @param node 表达式节点
+ * @return IrInst* 表达式的值
+ */
+static IrInst *buildExpr(IrBuilder *builder, NodeId node) {
+  Ast *ast = builder->ast;
+  IrFunc *F = builder->F;
+  unsigned int Top = 0;
+  builder->frames =
+      growStack(builder->frames, &builder->frameCap, Top, sizeof(BuildFrame));
+  builder->frames[Top++] = (BuildFrame){.Node = node};
+  IrInst *Last = NULL;
+
+  while (Top) {
+    BuildFrame *Fr = &builder->frames[Top - 1];
+    node = Fr->Node;
+    // 本步骤要构造的子节点，为空时本节点已构造完毕，值在 Last 中
+    NodeId Child = 0;
+    IrInst *C;
+    IrBlock *Then;
+    Obj *Var;
+
+    switch (ast->Kind[node]) {
+    case NUM:
+      Last = constant(builder, IR_I64, ast->Data[node].Val);
+      break;
+    case VAR:
+      Last = readVar(builder, ast->Data[node].Var);
+      break;
+    case NEG:
+    case NOT:
+    case LOGIC_NOT:
+      if (Fr->Stage++ == 0) {
+        Child = ast->LHS[node];
+        break;
+      }
+      if (ast->Kind[node] == NEG)
+        Last = emit(builder, IR_NEG, IR_I64, Last, NULL);
+      else if (ast->Kind[node] == NOT)
+        Last = emit(builder, IR_NOT, IR_I64, Last, NULL);
+      else
+        Last = fromBool(builder, emit(builder, IR_EQ, IR_I1, Last,
+                                      constant(builder, IR_I64, 0)));
+      break;
+    // 赋值只改写变量的当前值，右部的值即为表达式的值
+    case ASSIGN:
+      if (Fr->Stage++ == 0) {
+        lvalue(builder, ast->LHS[node]);
+        Child = ast->RHS[node];
+        break;
+      }
+      writeVar(builder, lvalue(builder, ast->LHS[node]), Last);
+      break;
+    // 复合赋值，右部求值后再读取左部的变量
+    case MUL_ASSIGN:
+    case DIV_ASSIGN:
+    case MOD_ASSIGN:
+    case ADD_ASSIGN:
+    case SUB_ASSIGN:
+    case SHL_ASSIGN:
+    case SHR_ASSIGN:
+    case AND_ASSIGN:
+    case XOR_ASSIGN:
+    case OR_ASSIGN:
+      if (Fr->Stage++ == 0) {
+        lvalue(builder, ast->LHS[node]);
+        Child = ast->RHS[node];
+        break;
+      }
+      Var = lvalue(builder, ast->LHS[node]);
+      Last = binary(builder, AssignOps[ast->Kind[node]], readVar(builder, Var),
+                    Last);
+      writeVar(builder, Var, Last);
+      break;
+    // 逗号，值为右部的值
+    case COMMA:
+      if (Fr->Stage < 2)
+        Child = Fr->Stage++ == 0 ? ast->LHS[node] : ast->RHS[node];
+      break;
+    // 条件运算符，两个分支在汇合块中合并
+    case CONDITION:
+      switch (Fr->Stage++) {
+      case 0:
+        Child = ast->Data[node].Cond;
+        break;
+      case 1:
+        C = toBool(builder, Last);
+        Then = irNewBlock(F);
+        Fr->Else = irNewBlock(F);
+        Fr->Join = irNewBlock(F);
+        branchTo(builder, C, Then, Fr->Else);
+        irPlaceBlock(F, Then);
+        builder->Cur = Then;
+        Fr->LogBase = builder->logTop;
+        builder->armDepth++;
+        Child = ast->LHS[node];
+        break;
+      case 2:
+        Fr->Val = Last;
+        closeArm(builder, Fr->LogBase);
+        Fr->ArmLog = builder->logTop;
+        jumpTo(builder, Fr->Join);
+        irPlaceBlock(F, Fr->Else);
+        builder->Cur = Fr->Else;
+        Child = ast->RHS[node];
+        break;
+      default:
+        jumpTo(builder, Fr->Join);
+        irPlaceBlock(F, Fr->Join);
+        builder->Cur = Fr->Join;
+        Last = merge(builder, IR_I64, Fr->Val, Last);
+        mergeArms(builder, Fr->LogBase, Fr->ArmLog);
+        break;
+      }
+      break;
+    // 逻辑与或，左部已能确定结果时跳过右部，直接到汇合块
+    case LOGIC_AND:
+    case LOGIC_OR:
+      switch (Fr->Stage++) {
+      case 0:
+        Child = ast->LHS[node];
+        break;
+      case 1:
+        C = toBool(builder, Last);
+        Fr->Val = constant(builder, IR_I1, ast->Kind[node] == LOGIC_OR);
+        Then = irNewBlock(F);
+        Fr->Join = irNewBlock(F);
+        if (ast->Kind[node] == LOGIC_AND)
+          branchTo(builder, C, Then, Fr->Join);
+        else
+          branchTo(builder, C, Fr->Join, Then);
+        irPlaceBlock(F, Then);
+        builder->Cur = Then;
+        Fr->LogBase = builder->logTop;
+        builder->armDepth++;
+        Child = ast->RHS[node];
+        break;
+      default:
+        C = toBool(builder, Last);
+        jumpTo(builder, Fr->Join);
+        irPlaceBlock(F, Fr->Join);
+        builder->Cur = Fr->Join;
+        // φ 在汇合块最前，扩展在变量的 φ 之后
+        Last = merge(builder, IR_I1, Fr->Val, C);
+        mergeArms(builder, Fr->LogBase, Fr->LogBase);
+        Last = fromBool(builder, Last);
+        break;
+      }
+      break;
+    // 二元运算
+    default:
+      switch (Fr->Stage++) {
+      case 0:
+        // 没有右子树的节点，如 & 与 *，目前无法生成
+        if (!ast->RHS[node])
+          error("invalid expresion");
+        // 先构造需要更深的一侧
+        Child = leftFirst(builder, node) ? ast->LHS[node] : ast->RHS[node];
+        break;
+      case 1:
+        Fr->Val = Last;
+        Child = leftFirst(builder, node) ? ast->RHS[node] : ast->LHS[node];
+        break;
+      default:
+        if (leftFirst(builder, node))
+          Last = binary(builder, ast->Kind[node], Fr->Val, Last);
+        else
+          Last = binary(builder, ast->Kind[node], Last, Fr->Val);
+        break;
+      }
+      break;
+    }
+
+    if (!Child) {
+      Top--;
+      continue;
+    }
+    builder->frames = growStack(builder->frames, &builder->frameCap, Top,
+                                sizeof(BuildFrame));
+    builder->frames[Top++] = (BuildFrame){.Node = Child};
+  }
+  return Last;
+}
+
+/**
+ * @brief 构造语句的中间表示，return 之后的语句不可能执行，不再构造
+ * 代码块不递归构造，每层代码块在语句栈中记录下一个待构造的 BLOCK 节点
+ *
+ * @param builder 构造器
+ * @param node 代码块
+ */
+static void buildStmt(IrBuilder *builder, NodeId node) {
+  Ast *ast = builder->ast;
+  unsigned int Top = 0;
+  builder->stmts =
+      growStack(builder->stmts, &builder->stmtCap, Top, sizeof(NodeId));
+  builder->stmts[Top++] = node;
+
+  while (Top) {
+    NodeId Cell = builder->stmts[Top - 1];
+    // 本层代码块已构造完毕
+    if (!Cell) {
+      Top--;
+      continue;
+    }
+    builder->stmts[Top - 1] = ast->RHS[Cell];
+    node = ast->LHS[Cell];
+    // 空代码块
+    if (!node)
+      continue;
+
+    switch (ast->Kind[node]) {
+    case EXPR_STMT:
+      buildExpr(builder, ast->LHS[node]);
+      break;
+    case BLOCK:
+      builder->stmts =
+          growStack(builder->stmts, &builder->stmtCap, Top, sizeof(NodeId));
+      builder->stmts[Top++] = node;
+      break;
+    case RETURN:
+      emit(builder, IR_RET, IR_VOID, buildExpr(builder, ast->LHS[node]), NULL);
+      builder->Cur = NULL;
+      return;
+    default:
+      error("invalid statement");
+    }
+  }
+}
+
+IrBuilder *newIrBuilder(void) {
+  IrBuilder *builder = calloc(1, sizeof(IrBuilder));
+  if (!builder)
+    error("out of memory");
+  return builder;
+}
+
+void freeIrBuilder(IrBuilder *builder) {
+  free(builder->vals);
+  free(builder->mark);
+  free(builder->log);
+  free(builder->frames);
+  free(builder->stmts);
+  free(builder->need);
+  free(builder->effect);
+  free(builder);
+}
+
+IrFunc *buildIr(IrBuilder *builder, Function *func, Arena *arena) {
+  // 变量按链表顺序编号
+  unsigned int NumVars = 0;
+  for (Obj *Var = func->localObjs; Var; Var = Var->Next)
+    Var->Index = NumVars++;
+  if (NumVars > builder->varCap) {
+    builder->varCap = 0;
+    free(builder->vals);
+    free(builder->mark);
+    builder->vals = malloc(NumVars * sizeof(IrInst *));
+    builder->mark = malloc(NumVars * sizeof(unsigned int));
+    if (!builder->vals || !builder->mark)
+      error("out of memory");
+    builder->varCap = NumVars;
+  }
+  if (NumVars) {
+    memset(builder->vals, 0, NumVars * sizeof(IrInst *));
+    memset(builder->mark, 0, NumVars * sizeof(unsigned int));
+  }
+  builder->markGen = 0;
+  builder->logTop = builder->armDepth = 0;
+
+  builder->ast = func->Tree;
+  builder->F = newIrFunc(arena);
+  builder->Cur = builder->F->Entry;
+  needRegs(builder);
+  buildStmt(builder, func->Body);
+
+  // 没有 return 时返回 0，同 C99 中的 main 函数
+  if (builder->Cur)
+    emit(builder, IR_RET, IR_VOID, constant(builder, IR_I64, 0), NULL);
+  return builder->F;
+}
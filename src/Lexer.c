@@ -1,261 +1,1047 @@
 #include "Compiler.h"
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 // static为仅限本文件内可用，类似于C++类的private声明
 
 /**
- * @brief 从文件地址获取文件文本
+ * @brief 确保文本缓冲区容量不小于 Cap，保留已有内容
  *
- * @param fpath 指定文件地址 若为-则从标准输入读取
- * @return char* 文件文本
+ * @param lexer 词法分析器
+ * @param Cap 所需容量
  */
-static char *readFile(const char *fpath) {
-
-  // 读取文件内容
-  FILE *fptr;
-  if (strcmp(fpath, "-") == 0) {
-    // 如果文件名是"-"，那么就从输入中读取
-    fptr = stdin;
-  } else {
-    fptr = fopen(fpath, "r");
-    if (!fptr) {
-      // errno为系统最后一次的错误代码
-      // strerror以字符串的形式输出错误代码
-      error("cannot open %s: %s", fpath, strerror(errno));
-    }
-  }
-
-  // 返回的字符串
-  char *fText;
-  // 返回字符串长度
-  size_t fTextLen;
+static void reserveText(Lexer *lexer, size_t Cap) {
+  if (Cap <= lexer->textCap)
+    return;
+  if (Cap < 4096)
+    Cap = 4096;
+  char *Buf = realloc(lexer->textBuf, Cap);
+  if (!Buf)
+    error("out of memory");
+  lexer->textBuf = Buf;
+  lexer->textCap = Cap;
+}
 
-  // 将fText映射到文件流Out中
-  // 对Out文件的读写操作将同步到fText中，同时长度也将同步到fTextLen中
-  FILE *Out = open_memstream(&fText, &fTextLen);
+/**
+ * @brief 从文件描述符一次性读入文本缓冲区，用于标准输入和管道等无法映射的文件
+ *
+ * @param lexer 词法分析器，文本读入其文本缓冲区
+ * @param fd 文件描述符
+ * @param hint 预估文件长度，未知时为0
+ * @param fTextLen 返回读取文本长度
+ * @return char* 文件文本，末尾带 SCAN_PADDING 个 0 字节
+ */
+static char *readStream(Lexer *lexer, int fd, size_t hint,
+                        size_t *fTextLen) {
+  // 缓冲区容量，至少为末尾的 0 字节预留 SCAN_PADDING 字节
+  reserveText(lexer, hint + SCAN_PADDING + 1);
+  size_t Len = 0;
 
-  // 读取整个文件
   while (true) {
+    // 缓冲区将满时倍增，直接读入缓冲区尾部，不经过中间缓冲
+    if (lexer->textCap - Len <= SCAN_PADDING)
+      reserveText(lexer, lexer->textCap * 2);
 
-    // 数组指针BufTemp，数组元素大小1，数组元素个数4096，文件流指针
-    char BufTmp[4096];
-
-    // fread从文件流中读取数据到数组中
-    int N = fread(BufTmp, 1, sizeof(BufTmp), fptr);
-
-    // 检查是否读取出新的字符串
+    ssize_t N =
+        read(fd, lexer->textBuf + Len, lexer->textCap - Len - SCAN_PADDING);
+    if (N < 0) {
+      if (errno == EINTR)
+        continue;
+      // 出错时不再返回调用方，由此关闭打开的文件
+      int Err = errno;
+      if (fd != STDIN_FILENO)
+        close(fd);
+      error("cannot read input: %s", strerror(Err));
+    }
     if (N == 0)
       break;
-
-    // 向Out文件流中写入字符串
-    // 相当于向fText中写入字符串
-    fwrite(BufTmp, 1, N, Out);
+    Len += N;
   }
 
-  // 读取完成关闭文件
-  if (fptr != stdin) {
-    fclose(fptr);
+  // 写入哨兵，扫描器可能越过结尾读取
+  memset(lexer->textBuf + Len, 0, SCAN_PADDING);
+  *fTextLen = Len;
+  return lexer->textBuf;
+}
+
+/**
+ * @brief 从文件地址获取文件文本
+ *
+ * 普通文件直接 mmap 只读映射，不发生拷贝。映射最后一页中文件末尾之后的部分
+ * 由内核补 0，恰好充当 '\0' 哨兵，因此仅当这部分不少于 SCAN_PADDING 字节时
+ * 才映射；其余情况(标准输入、管道、空文件、大小恰为整页、末页剩余不足)
+ * 退回一次性读入缓冲区。
+ *
+ * @param lexer 词法分析器，记录文本长度与是否映射
+ * @param fpath 指定文件地址 若为-则从标准输入读取
+ * @return char* 文件文本，fText[fTextLen] 之后至少有 SCAN_PADDING 个 0
+ */
+static char *readFile(Lexer *lexer, const char *fpath) {
+  // 如果文件名是"-"，那么就从标准输入中读取
+  if (strcmp(fpath, "-") == 0) {
+    return readStream(lexer, STDIN_FILENO, 0, &lexer->fTextLen);
   }
 
-  // 刷新流缓冲区，确保内容写入
-  fflush(Out);
+  int fd = open(fpath, O_RDONLY);
+  if (fd < 0) {
+    // errno为系统最后一次的错误代码
+    // strerror以字符串的形式输出错误代码
+    error("cannot open %s: %s", fpath, strerror(errno));
+  }
 
-  // 确保最后一行'\n'结尾
-  if (fTextLen == 0 || fText[fTextLen - 1] != '\n') {
-    fputc('\n', Out);
+  struct stat St;
+  if (fstat(fd, &St) < 0) {
+    close(fd);
+    error("cannot stat %s: %s", fpath, strerror(errno));
   }
 
-  // 确保fText文件至少有结尾
-  fputc('\0', Out);
+  char *fText;
+  size_t PageSize = sysconf(_SC_PAGESIZE);
+  if (S_ISREG(St.st_mode) && St.st_size % PageSize != 0 &&
+      PageSize - St.st_size % PageSize >= SCAN_PADDING) {
+    // 映射文件，映射区域在关闭文件描述符后依然有效
+    // 映射长度含末尾的 0 字节，它们与文件同在最后一页内；
+    // 大小恰为整页时末尾之后已是下一页，访问会引发 SIGBUS，改为读取
+    fText = mmap(NULL, St.st_size + SCAN_PADDING, PROT_READ, MAP_PRIVATE, fd,
+                 0);
+    if (fText != MAP_FAILED) {
+      // 文本为顺序读取
+      posix_madvise(fText, St.st_size, POSIX_MADV_SEQUENTIAL);
+      lexer->fTextLen = St.st_size;
+      lexer->fMapped = true;
+      close(fd);
+      return fText;
+    }
+  }
 
-  // 返回指针待编译字符串指针
+  // 无法映射，退回读取
+  fText = readStream(lexer, fd, S_ISREG(St.st_mode) ? St.st_size : 0,
+                     &lexer->fTextLen);
+  close(fd);
   return fText;
 }
 
+// 标点符号 DFA 状态，除 S_DEAD 与 S_START 外，状态以已读入的前缀命名
+enum {
+  S_DEAD,  // 死状态，无法继续匹配
+  S_START, // 初始状态
+
+  // 只能由单个字符构成的标点符号
+  S_LBRACKET, // [
+  S_RBRACKET, // ]
+  S_LPAREN,   // (
+  S_RPAREN,   // )
+  S_LBRACE,   // {
+  S_RBRACE,   // }
+  S_TILDE,    // ~
+  S_QUESTION, // ?
+  S_SEMI,     // ;
+  S_COMMA,    // ,
+
+  // 可作为更长标点符号前缀的状态
+  S_DOT,                 // .
+  S_DOT_DOT,             // .. 不接受，回退为 .
+  S_ELLIPSIS,            // ...
+  S_MINUS,               // -
+  S_ARROW,               // ->
+  S_DEC,                 // --
+  S_SUB_ASSIGN,          // -=
+  S_PLUS,                // +
+  S_INC,                 // ++
+  S_ADD_ASSIGN,          // +=
+  S_AMP,                 // &
+  S_LOGAND,              // &&
+  S_AND_ASSIGN,          // &=
+  S_STAR,                // *
+  S_MUL_ASSIGN,          // *=
+  S_NOT,                 // !
+  S_NE,                  // !=
+  S_SLASH,               // /
+  S_DIV_ASSIGN,          // /=
+  S_PERCENT,             // %
+  S_MOD_ASSIGN,          // %=
+  S_PCT_GT,              // %> 即 }
+  S_PCT_COLON,           // %: 即 #
+  S_PCT_COLON_PCT,       // %:% 不接受，回退为 %:
+  S_PCT_COLON_PCT_COLON, // %:%: 即 ##
+  S_LT,                  // <
+  S_LE,                  // <=
+  S_SHL,                 // <<
+  S_SHL_ASSIGN,          // <<=
+  S_LT_COLON,            // <: 即 [
+  S_LT_PCT,              // <% 即 {
+  S_GT,                  // >
+  S_GE,                  // >=
+  S_SHR,                 // >>
+  S_SHR_ASSIGN,          // >>=
+  S_ASSIGN,              // =
+  S_EQ,                  // ==
+  S_CARET,               // ^
+  S_XOR_ASSIGN,          // ^=
+  S_PIPE,                // |
+  S_LOGOR,               // ||
+  S_OR_ASSIGN,           // |=
+  S_COLON,               // :
+  S_COLON_GT,            // :> 即 ]
+  S_HASH,                // #
+  S_HASHHASH,            // ##
+
+  S_NUM, // 状态个数
+};
+
+// 标点符号 DFA 状态转移表，PunctDFA[状态][字符] 为下一状态，未列出的为 S_DEAD
+// 只覆盖 ASCII，'\0' 哨兵必然转移到 S_DEAD，因此无需长度检查
+static const unsigned char PunctDFA[S_NUM][128] = {
+    [S_START] =
+        {
+            ['['] = S_LBRACKET, [']'] = S_RBRACKET, ['('] = S_LPAREN,
+            [')'] = S_RPAREN,   ['{'] = S_LBRACE,   ['}'] = S_RBRACE,
+            ['~'] = S_TILDE,    ['?'] = S_QUESTION, [';'] = S_SEMI,
+            [','] = S_COMMA,    ['.'] = S_DOT,      ['-'] = S_MINUS,
+            ['+'] = S_PLUS,     ['&'] = S_AMP,      ['*'] = S_STAR,
+            ['!'] = S_NOT,      ['/'] = S_SLASH,    ['%'] = S_PERCENT,
+            ['<'] = S_LT,       ['>'] = S_GT,       ['='] = S_ASSIGN,
+            ['^'] = S_CARET,    ['|'] = S_PIPE,     [':'] = S_COLON,
+            ['#'] = S_HASH,
+        },
+    [S_DOT] = {['.'] = S_DOT_DOT},
+    [S_DOT_DOT] = {['.'] = S_ELLIPSIS},
+    [S_MINUS] = {['>'] = S_ARROW, ['-'] = S_DEC, ['='] = S_SUB_ASSIGN},
+    [S_PLUS] = {['+'] = S_INC, ['='] = S_ADD_ASSIGN},
+    [S_AMP] = {['&'] = S_LOGAND, ['='] = S_AND_ASSIGN},
+    [S_STAR] = {['='] = S_MUL_ASSIGN},
+    [S_NOT] = {['='] = S_NE},
+    [S_SLASH] = {['='] = S_DIV_ASSIGN},
+    [S_PERCENT] = {['='] = S_MOD_ASSIGN, ['>'] = S_PCT_GT,
+                   [':'] = S_PCT_COLON},
+    [S_PCT_COLON] = {['%'] = S_PCT_COLON_PCT},
+    [S_PCT_COLON_PCT] = {[':'] = S_PCT_COLON_PCT_COLON},
+    [S_LT] = {['='] = S_LE, ['<'] = S_SHL, [':'] = S_LT_COLON,
+              ['%'] = S_LT_PCT},
+    [S_SHL] = {['='] = S_SHL_ASSIGN},
+    [S_GT] = {['='] = S_GE, ['>'] = S_SHR},
+    [S_SHR] = {['='] = S_SHR_ASSIGN},
+    [S_ASSIGN] = {['='] = S_EQ},
+    [S_CARET] = {['='] = S_XOR_ASSIGN},
+    [S_PIPE] = {['|'] = S_LOGOR, ['='] = S_OR_ASSIGN},
+    [S_COLON] = {['>'] = S_COLON_GT},
+    [S_HASH] = {['#'] = S_HASHHASH},
+};
+
+// 接受状态对应的词法单元编号，非接受状态为 TK_NONE
+static const unsigned char PunctAccept[S_NUM] = {
+    [S_LBRACKET] = P_LBRACKET,
+    [S_RBRACKET] = P_RBRACKET,
+    [S_LPAREN] = P_LPAREN,
+    [S_RPAREN] = P_RPAREN,
+    [S_LBRACE] = P_LBRACE,
+    [S_RBRACE] = P_RBRACE,
+    [S_TILDE] = P_TILDE,
+    [S_QUESTION] = P_QUESTION,
+    [S_SEMI] = P_SEMI,
+    [S_COMMA] = P_COMMA,
+    [S_DOT] = P_DOT,
+    [S_ELLIPSIS] = P_ELLIPSIS,
+    [S_MINUS] = P_MINUS,
+    [S_ARROW] = P_ARROW,
+    [S_DEC] = P_DEC,
+    [S_SUB_ASSIGN] = P_SUB_ASSIGN,
+    [S_PLUS] = P_PLUS,
+    [S_INC] = P_INC,
+    [S_ADD_ASSIGN] = P_ADD_ASSIGN,
+    [S_AMP] = P_AMP,
+    [S_LOGAND] = P_LOGAND,
+    [S_AND_ASSIGN] = P_AND_ASSIGN,
+    [S_STAR] = P_STAR,
+    [S_MUL_ASSIGN] = P_MUL_ASSIGN,
+    [S_NOT] = P_NOT,
+    [S_NE] = P_NE,
+    [S_SLASH] = P_SLASH,
+    [S_DIV_ASSIGN] = P_DIV_ASSIGN,
+    [S_PERCENT] = P_PERCENT,
+    [S_MOD_ASSIGN] = P_MOD_ASSIGN,
+    [S_PCT_GT] = P_RBRACE,
+    [S_PCT_COLON] = P_HASH,
+    [S_PCT_COLON_PCT_COLON] = P_HASHHASH,
+    [S_LT] = P_LT,
+    [S_LE] = P_LE,
+    [S_SHL] = P_SHL,
+    [S_SHL_ASSIGN] = P_SHL_ASSIGN,
+    [S_LT_COLON] = P_LBRACKET,
+    [S_LT_PCT] = P_LBRACE,
+    [S_GT] = P_GT,
+    [S_GE] = P_GE,
+    [S_SHR] = P_SHR,
+    [S_SHR_ASSIGN] = P_SHR_ASSIGN,
+    [S_ASSIGN] = P_ASSIGN,
+    [S_EQ] = P_EQ,
+    [S_CARET] = P_CARET,
+    [S_XOR_ASSIGN] = P_XOR_ASSIGN,
+    [S_PIPE] = P_PIPE,
+    [S_LOGOR] = P_LOGOR,
+    [S_OR_ASSIGN] = P_OR_ASSIGN,
+    [S_COLON] = P_COLON,
+    [S_COLON_GT] = P_RBRACKET,
+    [S_HASH] = P_HASH,
+    [S_HASHHASH] = P_HASHHASH,
+};
+
 /**
- * @brief 检查Str是否由SubStr开头
+ * @brief 由标点符号 DFA 按最长匹配读取一个标点符号
+ * 途经的非接受状态(.. 与 %:%)在失配时回退到最近一次接受的位置
  *
- * @param Str 待检测字符串
- * @param SubStr 匹配字符串
- * @return true 相同
- * @return false 不同
+ * @param Str 待检测字符串起始
+ * @param Id 返回标点符号编号
+ * @return unsigned int 标点符号长度，若不是返回0
  */
-static bool startWith(const char *Str, const char *SubStr) {
-  // 比较s1和s2的前n个字符是否相同
-  return !strncmp(Str, SubStr, strlen(SubStr));
+static unsigned int punctLen(const char *Str, TokenId *Id) {
+  unsigned int State = S_START;
+  unsigned int Len = 0;
+  for (unsigned int i = 0;; i++) {
+    unsigned char C = Str[i];
+    State = C < 128 ? PunctDFA[State][C] : S_DEAD;
+    if (State == S_DEAD)
+      return Len;
+    if (PunctAccept[State] != TK_NONE) {
+      *Id = PunctAccept[State];
+      Len = i + 1;
+    }
+  }
 }
 
 /**
- * @brief 获取C语言操作符长度
+ * @brief 读取整数字面量，返回字面量之后的位置
+ * 十六进制 0[xX][0-9a-fA-F]+，八进制 0[0-7]*，十进制 [1-9][0-9]*
  *
- * @param Ptr 待检测字符串起始
- * @return unsigned int 操作符长度，若不是返回0
+ * @param lexer 词法分析器
+ * @param P 字面量起始位置
+ * @param Val 返回字面量的值
+ * @return const char* 字面量之后的位置，值超出 unsigned long 时为 NULL
  */
-static unsigned int punctLen(const char *str) {
-  if (startWith(str, "==") || startWith(str, "!=") || startWith(str, "<=") ||
-      startWith(str, ">=")) {
-    return 2;
+static const char *readNumber(Lexer *lexer, const char *P,
+                              unsigned long *Val) {
+  unsigned long V = 0;
+
+  if (P[0] != '0') {
+    // 十进制，先由扫描器找到数字序列结尾，再累加
+    const char *End = lexer->scan->skipDigit(P + 1);
+    for (; P != End; P++) {
+      unsigned int D = *P - '0';
+      if (V > (ULONG_MAX - D) / 10)
+        return NULL;
+      V = V * 10 + D;
+    }
+  } else if ((P[1] == 'x' || P[1] == 'X') && isxdigit((unsigned char)P[2])) {
+    // 十六进制
+    for (P += 2; isxdigit((unsigned char)*P); P++) {
+      unsigned int D = *P <= '9' ? *P - '0' : (*P | 0x20) - 'a' + 10;
+      if (V > ULONG_MAX >> 4)
+        return NULL;
+      V = V << 4 | D;
+    }
+  } else {
+    // 八进制
+    for (P++; *P >= '0' && *P <= '7'; P++) {
+      if (V > ULONG_MAX >> 3)
+        return NULL;
+      V = V << 3 | (*P - '0');
+    }
   }
-  return ispunct(*str) ? 1 : 0;
+
+  *Val = V;
+  return P;
 }
 
 /**
- * @brief 获取变量名长度 [a-zA-Z_][a-zA-Z0-9_]*
+ * @brief 重置词法分析器，只保留空闲词法单元块与文本缓冲区
  *
- * @param str 待检测字符串
- * @return unsigned int 能形成的最长字符串长度
+ * @param lexer 词法分析器
+ * @param Name 报错时使用的文件名
  */
-static unsigned int varLen(const char *str) {
-  // [a-zA-Z_]
-  if (isalpha(*str) || *str == '_') {
-    const char *tempChar = str;
-    // [a-zA-Z0-9_]*
-    while (isalnum(*tempChar) || *tempChar == '_') {
-      tempChar++;
-    }
-    return tempChar - str;
-  }
-  return 0;
+static void resetLexer(Lexer *lexer, const char *Name) {
+  strBufClear(&lexer->workerDiag);
+  *lexer = (Lexer){.freeChunks = lexer->freeChunks,
+                   .textBuf = lexer->textBuf,
+                   .textCap = lexer->textCap,
+                   .workerDiag = lexer->workerDiag};
+  lexer->fPath = Name;
+  lexer->scan = bestScanner();
+  lexer->lexJobs = cpuCount();
+}
+
+void loadFile(Lexer *lexer, const char *fpath) {
+  resetLexer(lexer, fpath);
+
+  // 初始化词法分析器参数
+  lexer->fText = readFile(lexer, fpath);
+  // 词法单元以 32 位偏移记录位置
+  if (lexer->fTextLen > UINT32_MAX)
+    error("%s: file too large", fpath);
+}
+
+void loadText(Lexer *lexer, const char *Name, const char *Text, size_t Len) {
+  resetLexer(lexer, Name);
+  if (Len > UINT32_MAX)
+    error("%s: file too large", Name);
+
+  // 复制到文本缓冲区，末尾补上扫描器所需的 0
+  reserveText(lexer, Len + SCAN_PADDING + 1);
+  memcpy(lexer->textBuf, Text, Len);
+  memset(lexer->textBuf + Len, 0, SCAN_PADDING);
+  lexer->fText = lexer->textBuf;
+  lexer->fTextLen = Len;
 }
 
 /**
- * @brief 检查字符串是否为16进制开头标志 [ "0x" || "0X" ]
+ * @brief 建立行首表，记录每行行首在源文件中的偏移
  *
- * @param str 待检测字符串
+ * @param lexer 词法分析器
  */
-static bool isHexStart(const char *str) {
-  //检查开头是否符合
-  if (startWith(str, "0x") || startWith(str, "0X")) {
-    return true;
+static void buildLines(Lexer *lexer) {
+  unsigned int Cap = 1024;
+  unsigned int *Starts = malloc(Cap * sizeof(unsigned int));
+  if (!Starts)
+    error("out of memory");
+  unsigned int N = 0;
+  Starts[N++] = 0;
+
+  const char *P = lexer->fText;
+  const char *End = lexer->fText + lexer->fTextLen;
+  while ((P = memchr(P, '\n', End - P))) {
+    P++;
+    if (N == Cap) {
+      Cap *= 2;
+      unsigned int *Grown = realloc(Starts, Cap * sizeof(unsigned int));
+      if (!Grown) {
+        free(Starts);
+        error("out of memory");
+      }
+      Starts = Grown;
+    }
+    Starts[N++] = P - lexer->fText;
   }
-  return false;
+
+  lexer->lineStarts = Starts;
+  lexer->lineCount = N;
+}
+
+SourceLoc locate(Lexer *lexer, size_t Offset) {
+  if (!lexer->lineStarts)
+    buildLines(lexer);
+
+  // 二分查找不大于 Offset 的最后一个行首
+  unsigned int Lo = 0, Hi = lexer->lineCount;
+  while (Hi - Lo > 1) {
+    unsigned int Mid = Lo + (Hi - Lo) / 2;
+    if (lexer->lineStarts[Mid] <= Offset)
+      Lo = Mid;
+    else
+      Hi = Mid;
+  }
+
+  SourceLoc Loc;
+  Loc.row = Lo + 1;
+  Loc.col = Offset - lexer->lineStarts[Lo] + 1;
+  Loc.line = lexer->fText + lexer->lineStarts[Lo];
+  const char *End = lexer->fText + lexer->fTextLen;
+  const char *Nl = memchr(Loc.line, '\n', End - Loc.line);
+  Loc.lineLen = (Nl ? Nl : End) - Loc.line;
+  return Loc;
 }
 
 /**
- * @brief 检查字符串是否为8进制数字 0[0-9a-fA-F]+
+ * @brief 获取当前单调时钟时间
  *
- * @param str 待检测字符串
+ * @return double 秒
  */
-static bool isOctStart(const char *str) {
-  if (startWith(str, "0")) {
-    return true;
-  }
-  return false;
+static double lexClock(void) {
+  struct timespec Ts;
+  clock_gettime(CLOCK_MONOTONIC, &Ts);
+  return Ts.tv_sec + Ts.tv_nsec / 1e9;
 }
 
-Lexer *newLexer(const char *fpath) {
-
-  // 动态申请词法分析器空间
-  Lexer *lexer = calloc(1, sizeof(Lexer));
+/**
+ * @brief 取得一个空的词法单元块，优先重用已回收的块
+ * 块按 TOKEN_CHUNK_BYTES 对齐，以便由词法单元地址求得所在块
+ *
+ * @param lexer 词法分析器
+ * @return TokenChunk* 空词法单元块
+ */
+static TokenChunk *takeChunk(Lexer *lexer) {
+  TokenChunk *chunk;
+  if (lexer->mode == LEX_THREAD)
+    pthread_mutex_lock(&lexer->lock);
+  chunk = lexer->freeChunks;
+  if (chunk)
+    lexer->freeChunks = chunk->next;
+  if (lexer->mode == LEX_THREAD)
+    pthread_mutex_unlock(&lexer->lock);
 
-  // 初始化词法分析器参数
-  // lexer->fText = readFile(fpath); // 测试时请注释此条
-  lexer->fText = fpath; // 测试时请使用此条
-  lexer->fPath = fpath;
-  lexer->tokListHead = calloc(1, sizeof(Token));
-  lexer->curRowNum = 1;
-  lexer->curColNum = 1;
-
-  //返回词法分析器指针
-  return lexer;
+  if (!chunk) {
+    chunk = aligned_alloc(TOKEN_CHUNK_BYTES, TOKEN_CHUNK_BYTES);
+    if (!chunk)
+      error("out of memory");
+    lexer->chunkCount++;
+  }
+  chunk->next = NULL;
+  chunk->lexer = lexer;
+  chunk->text = lexer->fText;
+  chunk->len = 0;
+  chunk->valLen = 0;
+  return chunk;
 }
 
-Token *analysis(Lexer *lexer) {
-  //初始化读取位置
-  lexer->curReadPtr = lexer->fText;
-  lexer->curLinePtr = lexer->fText;
+/**
+ * @brief 产生一个词法单元块，块满时以 LINK_FLAG 结尾，文本结束时以 EOF_FLAG
+ * 结尾。遇到无法识别的字符或过大的整数字面量时同样以 EOF_FLAG 结尾并标记
+ * failed，由语法分析器拉取到该块时再报错，使报错顺序与词法分析方式无关
+ *
+ * @param lexer 词法分析器
+ * @return TokenChunk* 新产生的词法单元块
+ */
+static TokenChunk *lexChunk(Lexer *lexer) {
+  double Start = lexClock();
+  TokenChunk *chunk = takeChunk(lexer);
 
   //当前token指针
-  Token *CurTok = lexer->tokListHead;
-
-  //循环读取lexer->curReadPtr
-  while (*(lexer->curReadPtr)) {
-
-    //空白符处理
-    if (isspace(*(lexer->curReadPtr))) {
-      //回车符处理
-      if (*(lexer->curReadPtr) == '\n') {
-        // 读取行位置+1，列位置重置
-        ++(lexer->curRowNum);
-        lexer->curColNum = 0;
-        // 更新读取行首指针
-        lexer->curLinePtr = lexer->curReadPtr + 1;
+  Token *CurTok;
+
+  //循环读取lexer->curReadPtr，直到块内只剩衔接标记的位置
+  while (chunkHasRoom(chunk)) {
+    const char *P = lexer->curReadPtr;
+    unsigned int Offset = P - lexer->fText;
+    unsigned char Class = CharClass[(unsigned char)*P];
+
+    //空白符处理，扫描器一次跳过整段空白，行列号在报错时才计算
+    if (Class & CC_SPACE) {
+      lexer->curReadPtr = lexer->scan->skipSpace(P);
+      // 片段结尾之前必为空白符，只需在此检查是否到达片段结尾
+      if (lexer->curReadPtr == lexer->curEndPtr) {
+        newToken(chunk, EOF_FLAG, lexer->curReadPtr - lexer->fText);
+        lexer->done = true;
+        break;
       }
-      //更新读取位置
-      ++(lexer->curReadPtr);
-      ++(lexer->curColNum);
       continue;
     }
 
     //解析数字 [0-9]*
-    if (isdigit(*(lexer->curReadPtr))) {
-      //尾插法生成token队列
-      CurTok->nextTok =
-          newToken(VAL_INTEGER, lexer->curReadPtr, lexer->fPath,
-                   lexer->curLinePtr, lexer->curRowNum, lexer->curColNum);
-      CurTok = CurTok->nextTok;
-
-      //获取数字值，读取位置移动
-      if (isHexStart(lexer->curReadPtr)) {
-        CurTok->intVal =
-            strtoul(lexer->curReadPtr, (char **)&(lexer->curReadPtr), 16);
-      } else if (isOctStart(lexer->curReadPtr)) {
-        CurTok->intVal =
-            strtoul(lexer->curReadPtr, (char **)&(lexer->curReadPtr), 8);
-      } else {
-        CurTok->intVal =
-            strtoul(lexer->curReadPtr, (char **)&(lexer->curReadPtr), 10);
+    if (Class & CC_DIGIT) {
+      //获取数字值和长度
+      unsigned long Val;
+      const char *End = readNumber(lexer, P, &Val);
+      if (End) {
+        //在词法单元块尾部追加token，读取位置移动
+        CurTok = newToken(chunk, VAL_INTEGER, Offset);
+        setTokInt(CurTok, Val);
+        CurTok->len = End - P;
+        lexer->curReadPtr = End;
+        continue;
       }
 
-      //获取token文本长度
-      CurTok->len = lexer->curReadPtr - CurTok->text;
-      //更新词法分析器读取位置
-      lexer->curColNum += CurTok->len;
-      continue;
+      //超出范围的字面量同无法处理的字符，读取位置停在字面量上，留待报错
+      lexer->failed = true;
+      lexer->failMsg = "integer literal too large";
+      newToken(chunk, EOF_FLAG, Offset);
+      lexer->done = true;
+      break;
     }
 
     // 解析变量名 [a-zA-Z_][a-zA-Z0-9_]*
-    unsigned int VarLen = varLen(lexer->curReadPtr);
-    if (VarLen) {
-      CurTok->nextTok =
-          newToken(ID, lexer->curReadPtr, lexer->fPath, lexer->curLinePtr,
-                   lexer->curRowNum, lexer->curColNum);
-      CurTok = CurTok->nextTok;
-      CurTok->len = VarLen;
-
-      // 检查转换关键字Token
+    if (Class & CC_ALPHA) {
+      CurTok = newToken(chunk, ID, Offset);
+      CurTok->len = lexer->scan->skipIdent(P + 1) - P;
+
+      // 检查转换关键字Token，其余标识符驻留为符号
       convert(CurTok);
+      if (CurTok->kind == ID)
+        CurTok->symId = intern(lexer->interns, P, CurTok->len);
 
       //更新词法分析器读取位置
-      lexer->curColNum += CurTok->len;
       lexer->curReadPtr += CurTok->len;
       continue;
     }
 
-    //解析各类操作符
-    unsigned int PunctLen = punctLen(lexer->curReadPtr);
-    if (PunctLen) {
-      //尾插法生成token队列
-      CurTok->nextTok =
-          newToken(PUNCT, lexer->curReadPtr, lexer->fPath, lexer->curLinePtr,
-                   lexer->curRowNum, lexer->curColNum);
-      CurTok = CurTok->nextTok;
-      CurTok->len = PunctLen;
+    //解析各类操作符，$ @ ` 等不构成标点符号的字符按无法处理的字符报错
+    TokenId Id;
+    unsigned int Len;
+    if ((Class & CC_PUNCT) && (Len = punctLen(P, &Id))) {
+      CurTok = newToken(chunk, PUNCT, Offset);
+      CurTok->len = Len;
+      CurTok->id = Id;
       //更新词法分析器读取位置
-      lexer->curColNum += CurTok->len;
-      lexer->curReadPtr += CurTok->len;
+      lexer->curReadPtr += Len;
+      continue;
+    }
+
+    //目前无法处理的字符，读取位置停在该字符上，留待报错
+    if (*P != '\0') {
+      lexer->failed = true;
+      lexer->failMsg = "invalid token";
+    }
+
+    //插入最后一个文本终结token EOF_FLAG
+    newToken(chunk, EOF_FLAG, Offset);
+    lexer->done = true;
+    break;
+  }
+
+  if (!lexer->done) {
+    // 块已满，末尾写入衔接标记
+    chunk->toks[chunk->len++].kind = LINK_FLAG;
+  }
+  // 块尾的衔接标记与 EOF_FLAG 不计入词法单元个数
+  lexer->tokCount += chunk->len - 1;
+  lexer->lexTime += lexClock() - Start;
+  return chunk;
+}
+
+/**
+ * @brief 在调用线程中报告工作线程记下的错误
+ *
+ * @param Diag 工作线程的报错信息，扩容失败时可能为空
+ */
+static void workerError(StrBuf *Diag) {
+  // 报错信息以换行结尾，error 会再补上
+  if (Diag->len && Diag->buf[Diag->len - 1] == '\n')
+    Diag->buf[--Diag->len] = '\0';
+  error("%s", Diag->len ? Diag->buf : "out of memory");
+}
+
+/**
+ * @brief 流水线模式下的词法分析线程，产生的块放入环形缓冲区
+ * 出错时标记 aborted 并唤醒语法分析器，由其报告错误
+ *
+ * @param Arg 词法分析器
+ */
+static void *lexThread(void *Arg) {
+  Lexer *lexer = Arg;
+  ErrorHandler Handler = {.diag = &lexer->workerDiag};
+  setErrorHandler(&Handler);
+  if (setjmp(Handler.jmp)) {
+    pthread_mutex_lock(&lexer->lock);
+    lexer->aborted = true;
+    pthread_cond_signal(&lexer->notEmpty);
+    pthread_mutex_unlock(&lexer->lock);
+    return NULL;
+  }
+
+  while (!lexer->done) {
+    TokenChunk *chunk = lexChunk(lexer);
+
+    pthread_mutex_lock(&lexer->lock);
+    // 环形缓冲区已满时等待语法分析器取走
+    while (lexer->ringLen == LEX_RING_SIZE && !lexer->stop)
+      pthread_cond_wait(&lexer->notFull, &lexer->lock);
+    if (lexer->stop) {
+      pthread_mutex_unlock(&lexer->lock);
+      free(chunk);
+      break;
+    }
+    lexer->ring[(lexer->ringHead + lexer->ringLen) % LEX_RING_SIZE] = chunk;
+    lexer->ringLen++;
+    pthread_cond_signal(&lexer->notEmpty);
+    pthread_mutex_unlock(&lexer->lock);
+  }
+  return NULL;
+}
+
+/**
+ * @brief 获取下一个词法单元块并接在已交给语法分析器的块之后
+ *
+ * @param lexer 词法分析器
+ * @return TokenChunk* 下一个词法单元块
+ */
+static TokenChunk *pullChunk(Lexer *lexer) {
+  TokenChunk *chunk;
+  if (lexer->mode == LEX_THREAD) {
+    // 从环形缓冲区取出，缓冲区为空时等待词法分析线程
+    pthread_mutex_lock(&lexer->lock);
+    while (lexer->ringLen == 0 && !lexer->aborted)
+      pthread_cond_wait(&lexer->notEmpty, &lexer->lock);
+    // 已取完出错之前产生的块
+    if (lexer->ringLen == 0) {
+      pthread_mutex_unlock(&lexer->lock);
+      workerError(&lexer->workerDiag);
+    }
+    chunk = lexer->ring[lexer->ringHead];
+    lexer->ringHead = (lexer->ringHead + 1) % LEX_RING_SIZE;
+    lexer->ringLen--;
+    pthread_cond_signal(&lexer->notFull);
+    pthread_mutex_unlock(&lexer->lock);
+  } else {
+    chunk = lexChunk(lexer);
+  }
+
+  if (lexer->lastChunk)
+    lexer->lastChunk->next = chunk;
+  else
+    lexer->firstChunk = chunk;
+  lexer->lastChunk = chunk;
+
+  // 语法分析器到达出错位置所在的块时报错
+  if (lexer->failed && chunk->toks[chunk->len - 1].kind == EOF_FLAG)
+    errorAt(lexer, "%s", lexer->failMsg);
+  return chunk;
+}
+
+Token *linkTok(Token *Tok) {
+  TokenChunk *chunk = tokenChunkOf(Tok);
+  if (!chunk->next)
+    pullChunk(chunk->lexer);
+  return chunk->next->toks;
+}
+
+void releaseTokens(Token *Keep) {
+  TokenChunk *Cur = tokenChunkOf(Keep);
+  Lexer *lexer = Cur->lexer;
+
+  if (lexer->mode == LEX_THREAD)
+    pthread_mutex_lock(&lexer->lock);
+  // Keep 所在块之前的块都已被语法分析器读完，放回空闲链表
+  while (lexer->firstChunk != Cur) {
+    TokenChunk *chunk = lexer->firstChunk;
+    lexer->firstChunk = chunk->next;
+    chunk->next = lexer->freeChunks;
+    lexer->freeChunks = chunk;
+  }
+  if (lexer->mode == LEX_THREAD)
+    pthread_mutex_unlock(&lexer->lock);
+}
+
+/**
+ * @brief 释放词法单元块链表
+ *
+ * @param chunk 链表首块
+ */
+static void freeChunkList(TokenChunk *chunk) {
+  while (chunk) {
+    TokenChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
+
+void freeTokens(Lexer *lexer) {
+  if (lexer->mode == LEX_THREAD && !lexer->stop) {
+    // 语法分析可能未读到 EOF_FLAG 就已结束，通知词法分析线程退出
+    pthread_mutex_lock(&lexer->lock);
+    lexer->stop = true;
+    pthread_cond_signal(&lexer->notFull);
+    pthread_mutex_unlock(&lexer->lock);
+    pthread_join(lexer->thread, NULL);
+
+    for (unsigned int i = 0; i < lexer->ringLen; i++)
+      free(lexer->ring[(lexer->ringHead + i) % LEX_RING_SIZE]);
+    lexer->ringLen = 0;
+    pthread_mutex_destroy(&lexer->lock);
+    pthread_cond_destroy(&lexer->notEmpty);
+    pthread_cond_destroy(&lexer->notFull);
+  }
+
+  // 全部放回空闲链表，供下一编译单元使用
+  TokenChunk *chunk = lexer->firstChunk;
+  while (chunk) {
+    TokenChunk *next = chunk->next;
+    chunk->next = lexer->freeChunks;
+    lexer->freeChunks = chunk;
+    chunk = next;
+  }
+  lexer->firstChunk = lexer->lastChunk = NULL;
+}
+
+void closeLexer(Lexer *lexer) {
+  freeTokens(lexer);
+  if (lexer->fMapped)
+    munmap((void *)lexer->fText, lexer->fTextLen + SCAN_PADDING);
+  free(lexer->lineStarts);
+  lexer->fText = NULL;
+  lexer->fMapped = false;
+  lexer->lineStarts = NULL;
+}
+
+void freeLexer(Lexer *lexer) {
+  closeLexer(lexer);
+  freeChunkList(lexer->freeChunks);
+  free(lexer->textBuf);
+  strBufFree(&lexer->workerDiag);
+  *lexer = (Lexer){0};
+}
+
+// 并行模式下每个片段的最小字节数，过小的文本不值得切分
+#define LEX_PIECE_MIN (1024 * 1024)
+// 并行模式下每个线程平均分到的片段数，片段多于线程以平衡负载
+#define LEX_PIECES_PER_JOB 4
+
+/**
+ * @brief 跳过字符串或字符常量，未闭合时停在行尾换行符或 '\0' 上
+ *
+ * @param P 起始引号位置
+ * @return const char* 常量之后的位置
+ */
+static const char *skipQuoted(const char *P) {
+  char Quote = *P++;
+  while (*P != Quote && *P != '\n' && *P != '\0') {
+    // 转义字符与续行
+    if (*P == '\\' && P[1] != '\0')
+      P++;
+    P++;
+  }
+  return *P == Quote ? P + 1 : P;
+}
+
+/**
+ * @brief 跳过注释，行注释停在行尾换行符上
+ *
+ * @param P 注释起始 / 位置
+ * @return const char* 注释之后的位置
+ */
+static const char *skipComment(const char *P) {
+  if (P[1] == '/') {
+    // 行注释，续行时注释延续到下一行
+    for (P += 2; *P != '\n' && *P != '\0'; P++) {
+      if (P[0] == '\\' && P[1] == '\n')
+        P++;
+    }
+    return P;
+  }
+
+  // 块注释
+  for (P += 2; *P != '\0'; P++) {
+    if (P[0] == '*' && P[1] == '/')
+      return P + 2;
+  }
+  return P;
+}
+
+/**
+ * @brief 将文本切分为至多 N 个片段，写入各片段的起止位置
+ *
+ * 只在字符串、字符常量与注释之外的换行处切分，片段从换行之后首个非空白符开始，
+ * 因此任何词法单元都不会跨越片段，且前一片段必然经由空白符到达片段结尾。
+ * 文本中的 '\0' 视为文本结尾。
+ *
+ * @param lexer 词法分析器
+ * @param Pieces 片段词法分析器数组，至少 N 个
+ * @param N 最多片段个数
+ * @return unsigned int 实际片段个数
+ */
+static unsigned int splitText(const Lexer *lexer, Lexer *Pieces,
+                              unsigned int N) {
+  const char *Text = lexer->fText;
+  size_t Step = lexer->fTextLen / N;
+  const char *Target = Text + Step;
+  const char *P = Text;
+  unsigned int Cnt = 1;
+
+  Pieces[0].curReadPtr = Text;
+
+  while (true) {
+    const char *Run = P;
+    P = lexer->scan->skipPlain(P);
+
+    // 本段普通代码越过了切分目标，在其中切分目标之后的最后一个换行处切分
+    if (Cnt < N && P > Target) {
+      const char *Lo = Run > Target ? Run : Target;
+      const char *B = P;
+      while (B > Lo && B[-1] != '\n')
+        B--;
+      if (B > Lo) {
+        // 换行之后至 P 之间都是普通代码，跳过其中的空白符
+        while (CharClass[(unsigned char)*B] & CC_SPACE)
+          B++;
+        if (*B != '\0') {
+          Pieces[Cnt - 1].curEndPtr = B;
+          Pieces[Cnt].curReadPtr = B;
+          Cnt++;
+          Target = Text + Step * Cnt;
+        }
+      }
+    }
+
+    if (*P == '\0')
+      break;
+    if (*P == '/' && (P[1] == '/' || P[1] == '*'))
+      P = skipComment(P);
+    else if (*P == '/')
+      P++;
+    else
+      P = skipQuoted(P);
+  }
+
+  // 最后一个片段以 '\0' 结尾
+  Pieces[Cnt - 1].curEndPtr = NULL;
+  return Cnt;
+}
+
+/**
+ * @brief 分析一个片段。片段结尾的 EOF_FLAG 改为 LINK_FLAG，
+ * 以便与下一片段的块首尾相接；出错的片段保留 EOF_FLAG
+ *
+ * @param Piece 片段词法分析器
+ */
+static void lexPieceChunks(Lexer *Piece) {
+  TokenChunk *Prev = NULL;
+  do {
+    TokenChunk *chunk = lexChunk(Piece);
+    if (Piece->lastChunk)
+      Piece->lastChunk->next = chunk;
+    else
+      Piece->firstChunk = chunk;
+    Prev = Piece->lastChunk;
+    Piece->lastChunk = chunk;
+  } while (!Piece->done);
+
+  if (Piece->failed || !Piece->curEndPtr)
+    return;
+
+  TokenChunk *Last = Piece->lastChunk;
+  if (Last->len == 1 && Prev) {
+    // 末块只有 EOF_FLAG，丢弃后由前一块尾部的 LINK_FLAG 衔接
+    free(Last);
+    Prev->next = NULL;
+    Piece->lastChunk = Prev;
+    Piece->chunkCount--;
+  } else {
+    Last->toks[Last->len - 1].kind = LINK_FLAG;
+  }
+}
+
+/**
+ * @brief 并行模式下的任务函数，分析一个片段，出错时标记 aborted
+ *
+ * @param Arg 片段词法分析器数组
+ * @param Job 片段下标
+ */
+static void lexPiece(void *Arg, unsigned int Job) {
+  Lexer *Piece = (Lexer *)Arg + Job;
+  // 首个片段可能在调用线程中分析，结束时恢复其报错处理器
+  ErrorHandler Handler = {.diag = &Piece->workerDiag};
+  ErrorHandler *Outer = setErrorHandler(&Handler);
+  if (setjmp(Handler.jmp)) {
+    Piece->aborted = true;
+    setErrorHandler(Outer);
+    return;
+  }
+  lexPieceChunks(Piece);
+  setErrorHandler(Outer);
+}
+
+/**
+ * @brief 并行分析全部文本，按顺序拼接各片段的词法单元块
+ * 结果与顺序分析完全相同，出错时报告第一个出错片段中的位置
+ *
+ * @param lexer 词法分析器
+ */
+static void lexParallel(Lexer *lexer) {
+  double Start = lexClock();
+
+  unsigned int N = lexer->lexJobs * LEX_PIECES_PER_JOB;
+  if (N > lexer->fTextLen / LEX_PIECE_MIN)
+    N = lexer->fTextLen / LEX_PIECE_MIN;
+  if (N == 0)
+    N = 1;
+
+  // 每个片段使用一份词法分析器副本，只共享只读的文本
+  Lexer *Pieces = calloc(N, sizeof(Lexer));
+  if (!Pieces)
+    error("out of memory");
+  for (unsigned int i = 0; i < N; i++) {
+    Pieces[i].mode = LEX_EAGER;
+    Pieces[i].fText = lexer->fText;
+    Pieces[i].fPath = lexer->fPath;
+    Pieces[i].fTextLen = lexer->fTextLen;
+    Pieces[i].scan = lexer->scan;
+    Pieces[i].interns = lexer->interns;
+  }
+  N = splitText(lexer, Pieces, N);
+  parallelFor(lexer->lexJobs, N, lexPiece, Pieces);
+
+  // 有片段报错时丢弃全部片段，报告其中第一个的错误
+  for (unsigned int i = 0; i < N; i++) {
+    if (!Pieces[i].aborted)
       continue;
+    StrBuf Diag = Pieces[i].workerDiag;
+    Pieces[i].workerDiag = lexer->workerDiag;
+    lexer->workerDiag = Diag;
+    for (unsigned int j = 0; j < N; j++) {
+      freeChunkList(Pieces[j].firstChunk);
+      strBufFree(&Pieces[j].workerDiag);
     }
+    free(Pieces);
+    workerError(&lexer->workerDiag);
+  }
 
-    //目前无法处理的字符
-    errorAt(lexer, "invalid token");
+  for (unsigned int i = 0; i < N; i++) {
+    Lexer *Piece = &Pieces[i];
+    lexer->tokCount += Piece->tokCount;
+    lexer->chunkCount += Piece->chunkCount;
+    for (TokenChunk *chunk = Piece->firstChunk; chunk; chunk = chunk->next)
+      chunk->lexer = lexer;
+
+    if (lexer->lastChunk)
+      lexer->lastChunk->next = Piece->firstChunk;
+    else
+      lexer->firstChunk = Piece->firstChunk;
+    lexer->lastChunk = Piece->lastChunk;
+
+    if (Piece->failed || i == N - 1) {
+      // 出错位置之后的片段不再需要
+      for (unsigned int j = i + 1; j < N; j++)
+        freeChunkList(Pieces[j].firstChunk);
+      lexer->curReadPtr = Piece->curReadPtr;
+      lexer->failed = Piece->failed;
+      lexer->failMsg = Piece->failMsg;
+      break;
+    }
   }
+  for (unsigned int i = 0; i < N; i++)
+    strBufFree(&Pieces[i].workerDiag);
+  free(Pieces);
 
-  //插入最后一个文本终结token EOF_FLAG
-  CurTok->nextTok =
-      newToken(EOF_FLAG, lexer->curReadPtr, lexer->fText, lexer->curLinePtr,
-               lexer->curRowNum, lexer->curColNum);
+  lexer->done = true;
+  lexer->lexTime = lexClock() - Start;
+  if (lexer->failed)
+    errorAt(lexer, "%s", lexer->failMsg);
+}
 
-  // lexer->tokListHead只是一个头节点，有效信息为其nextToken
-  return lexer->tokListHead->nextTok;
-}
\ No newline at end of file
+Token *analysis(Lexer *lexer) {
+  //初始化读取位置
+  lexer->curReadPtr = lexer->fText;
+
+  switch (lexer->mode) {
+  case LEX_EAGER:
+    // 一次产生全部词法单元块
+    do {
+      pullChunk(lexer);
+    } while (!lexer->done);
+    break;
+  case LEX_THREAD:
+    // 启动词法分析线程，之后的块都从环形缓冲区取得
+    pthread_mutex_init(&lexer->lock, NULL);
+    pthread_cond_init(&lexer->notEmpty, NULL);
+    pthread_cond_init(&lexer->notFull, NULL);
+    if (pthread_create(&lexer->thread, NULL, lexThread, lexer)) {
+      // 没有词法分析线程需要等待
+      lexer->stop = true;
+      error("cannot create lexer thread");
+    }
+    pullChunk(lexer);
+    break;
+  case LEX_PARALLEL:
+    // 多个线程同时分析各片段，之后拼接
+    lexParallel(lexer);
+    break;
+  case LEX_STREAM:
+    // 只产生首块，其余由 nextTok 按需拉取
+    pullChunk(lexer);
+    break;
+  }
+
+  // 首个块的首个词法单元即为序列开头
+  return lexer->firstChunk->toks;
+}
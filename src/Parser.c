@@ -1,368 +1,672 @@
 #include "Compiler.h"
 
-static Obj *LOCALOBJS;
+// 块作用域
+typedef struct Scope Scope;
+struct Scope {
+  Scope *Up; // 外层作用域
+  Obj *Vars; // 本作用域中的变量，经 ScopeNext 串接
+  int Depth; // 作用域深度，函数作用域为1
+};
+
+// 表达式解析栈中的运算符，括号与 "?" 作为优先级为 PREC_NONE 的标记入栈
+typedef struct {
+  unsigned char Kind; // 节点种类，PARANTHESES 为 "(" 标记，CONDITION 为 "?" 标记
+  unsigned char Prec; // 优先级
+  Token *Tok;         // 运算符词法单元
+} ExprOp;
+
+// 解析用的栈，栈深只受内存限制，各编译单元复用
+typedef struct {
+  unsigned int *Blocks;          // 未结束的代码块，值为其首条语句在语句栈中的下标
+  unsigned int BlockCap;         // 代码块栈容量
+  NodeId *Stmts;                 // 未结束的代码块中已解析的语句
+  unsigned int StmtTop, StmtCap; // 语句栈顶与容量
+  ExprOp *Ops;                   // 表达式运算符栈
+  unsigned int OpTop, OpCap;     // 运算符栈顶与容量
+  NodeId *Vals;                  // 表达式运算对象栈
+  unsigned int ValTop, ValCap;   // 运算对象栈顶与容量
+} ParseStacks;
+
+// 语法分析器，一个编译单元内的解析状态，栈、绑定表与语法树各编译单元复用
+struct Parser {
+  Arena *arena;               // 当前编译单元的内存区，变量与作用域均从中分配
+  const InternTable *interns; // 当前编译单元的驻留表，变量名由此取得
+  Ast tree;                   // 语法树，下一编译单元开始时清空
+  Obj *localObjs;             // 当前函数的局部变量
+
+  // 当前作用域与函数作用域
+  Scope *scope;
+  Scope *funcScope;
+
+  // 变量绑定表，下标为符号编号，值为该名称当前可见的最内层变量
+  // 退出作用域时恢复被遮蔽的变量，函数作用域退出后全部为空，可供下一编译单元使用
+  Obj **bindings;
+  unsigned int bindCap;
+
+  ParseStacks stacks; // 解析用的栈
+};
 
 // Rest: 分析后剩余词法单元队列指针存放位置
 // Token: 要分析的词法单元
 
+// 代码块与表达式用显式栈解析，嵌套深度不受 C 栈大小限制
 // program = "{" block  //限制程序必须被 { } 包起来
-// block = stmt* "}"
-// stmt = "return" expr ";" | "{" block | exprStmt
+// block = ("{" block | stmt)* "}"
+// stmt = "return" expr ";" | declaration | exprStmt
+// declaration = "int" declarator ("," declarator)* ";"
+// declarator = ident ("=" assign)?
 // exprStmt = expr? ";"
-// expr = assign
-// assign = equality ( "=" assign )?
-// equality = relational ("==" relational | "!=" relational)*
-// relational = add ("<" add | "<=" add | ">" add | ">=" add)*
-// shift = add ("<<" add | ">>" add)*
-// add = mul ("+" mul | "-" mul)*
-// mul = unary ("*" unary | "/" unary | "%" unary)*
-// unary = ("+" | "-"| "*" | "&") unary | primary
+// expr = binary(PREC_COMMA)
+// assign = binary(PREC_ASSIGN)
+// binary = unary (binop binary | "?" expr ":" binary)*
+// unary = ("+" | "-" | "++" | "--" | "*" | "&" | "~" | "!")* primary
 // primary = "(" expr ")" | num | id
-static Node *block(Token **Rest, Token *Tok);
-static Node *stmt(Token **Rest, Token *Tok);
-static Node *exprStmt(Token **Rest, Token *Tok);
-static Node *expr(Token **Rest, Token *Tok);
-static Node *assign(Token **Rest, Token *Tok);
-static Node *equality(Token **Rest, Token *Tok);
-static Node *relational(Token **Rest, Token *Tok);
-static Node *add(Token **Rest, Token *Tok);
-static Node *mul(Token **Rest, Token *Tok);
-static Node *unary(Token **Rest, Token *Tok);
-static Node *primary(Token **Rest, Token *Tok);
+static NodeId block(Parser *parser, Token **Rest, Token *Tok);
+static NodeId stmt(Parser *parser, Token **Rest, Token *Tok);
+static NodeId declaration(Parser *parser, Token **Rest, Token *Tok);
+static NodeId exprStmt(Parser *parser, Token **Rest, Token *Tok);
+static NodeId expr(Parser *parser, Token **Rest, Token *Tok);
+static NodeId assign(Parser *parser, Token **Rest, Token *Tok);
+static NodeId binary(Parser *parser, Token **Rest, Token *Tok, int MinPrec);
+static NodeId primary(Parser *parser, Token **Rest, Token *Tok);
 
 /**
- * @brief 创建新节点返回指针
+ * @brief 创建新节点返回编号
  *
+ * @param parser 语法分析器
  * @param kind 节点类型
- * @return Node* 新节点指针
+ * @param Tok 节点对应的词法单元
+ * @return NodeId 新节点编号
  */
-static Node *newNode(NodeKind kind) {
-  Node *node = calloc(1, sizeof(Node));
-  node->Kind = kind;
+static NodeId newNode(Parser *parser, NodeKind kind, Token *Tok) {
+  NodeId node = astNew(&parser->tree, kind);
+  parser->tree.Loc[node] = Tok->offset;
   return node;
 }
 
 /**
  * @brief 新建单叉树
  *
+ * @param parser 语法分析器
  * @param kind 节点种类
- * @param LHS 子节点指针
- * @return Node* 新单叉树指针
+ * @param LHS 子节点编号
+ * @param Tok 节点对应的词法单元
+ * @return NodeId 新单叉树编号
  */
-static Node *newUnaryNode(NodeKind kind, Node *LHS) {
-  Node *node = newNode(kind);
-  node->LHS = LHS;
+static NodeId newUnaryNode(Parser *parser, NodeKind kind, NodeId LHS,
+                           Token *Tok) {
+  NodeId node = newNode(parser, kind, Tok);
+  parser->tree.LHS[node] = LHS;
   return node;
 }
 
 /**
  * @brief 新建二叉树节点
  *
+ * @param parser 语法分析器
  * @param kind 节点种类
- * @param LHS 左子树指针
- * @param RHS 右子树指针
- * @return Node* 新节点指针
+ * @param LHS 左子树编号
+ * @param RHS 右子树编号
+ * @param Tok 节点对应的词法单元
+ * @return NodeId 新节点编号
  */
-static Node *newBinaryNode(NodeKind kind, Node *LHS, Node *RHS) {
-  Node *node = newNode(kind);
-  node->LHS = LHS;
-  node->RHS = RHS;
+static NodeId newBinaryNode(Parser *parser, NodeKind kind, NodeId LHS,
+                            NodeId RHS, Token *Tok) {
+  NodeId node = newNode(parser, kind, Tok);
+  parser->tree.LHS[node] = LHS;
+  parser->tree.RHS[node] = RHS;
   return node;
 }
 
 /**
  * @brief 新建数字节点
  *
+ * @param parser 语法分析器
  * @param value 数字值
- * @return Node* 新节点指针
+ * @param Tok 节点对应的词法单元
+ * @return NodeId 新节点编号
  */
-static Node *newNumNode(long value) {
-  Node *node = calloc(1, sizeof(Node));
-  node->Kind = NUM;
-  node->Val = value;
+static NodeId newNumNode(Parser *parser, long value, Token *Tok) {
+  NodeId node = newNode(parser, NUM, Tok);
+  parser->tree.Data[node].Val = value;
   return node;
 }
 
 /**
  * @brief 新建变量节点
  *
+ * @param parser 语法分析器
  * @param obj 变量结构体指针
- * @return Node* 新变量节点指针
+ * @param Tok 节点对应的词法单元
+ * @return NodeId 新变量节点编号
  */
 
-static Node *newVarNode(Obj *obj) {
-  Node *node = newNode(VAR);
-  node->Var = obj;
+static NodeId newVarNode(Parser *parser, Obj *obj, Token *Tok) {
+  NodeId node = newNode(parser, VAR, Tok);
+  parser->tree.Data[node].Var = obj;
   return node;
 }
 
-// 在链表中新增一个变量
-static Obj *newLVar(char *Name) {
-  Obj *var = calloc(1, sizeof(Obj));
-  var->Name = Name;
+/**
+ * @brief 语句入栈，所在代码块结束时串接
+ *
+ * @param parser 语法分析器
+ * @param node 语句
+ */
+static void pushStmt(Parser *parser, NodeId node) {
+  ParseStacks *S = &parser->stacks;
+  S->Stmts = growStack(S->Stmts, &S->StmtCap, S->StmtTop, sizeof(NodeId));
+  S->Stmts[S->StmtTop++] = node;
+}
+
+/**
+ * @brief 将语句栈中从 Base 开始的语句出栈，从后向前串接为代码块
+ * 后创建的 BLOCK 节点在前，子节点编号始终小于父节点
+ *
+ * @param parser 语法分析器
+ * @param Base 首条语句在语句栈中的下标
+ * @param Tok 代码块结束处的词法单元，空代码块以此为位置
+ * @return NodeId 代码块的首个 BLOCK 节点，空代码块为单个空 BLOCK 节点
+ */
+static NodeId popBlock(Parser *parser, unsigned int Base, Token *Tok) {
+  ParseStacks *S = &parser->stacks;
+  NodeId Cell = 0;
+  while (S->StmtTop > Base) {
+    NodeId Stmt = S->Stmts[--S->StmtTop];
+    NodeId Next = Cell;
+    // 串接用的节点与其语句位置相同
+    Cell = astNew(&parser->tree, BLOCK);
+    parser->tree.LHS[Cell] = Stmt;
+    parser->tree.RHS[Cell] = Next;
+    parser->tree.Loc[Cell] = parser->tree.Loc[Stmt];
+  }
+  return Cell ? Cell : newNode(parser, BLOCK, Tok);
+}
+
+// 进入新的块作用域
+static void enterScope(Parser *parser) {
+  Scope *S = arenaAlloc(parser->arena, sizeof(Scope));
+  S->Up = parser->scope;
+  S->Depth = parser->scope ? parser->scope->Depth + 1 : 1;
+  parser->scope = S;
+  // 函数体最外层的块作用域即函数作用域
+  if (S->Depth == 1)
+    parser->funcScope = S;
+}
+
+// 退出当前块作用域，恢复被本作用域变量遮蔽的外层变量
+static void leaveScope(Parser *parser) {
+  for (Obj *var = parser->scope->Vars; var; var = var->ScopeNext)
+    parser->bindings[var->SymId] = var->Shadow;
+  parser->scope = parser->scope->Up;
+}
+
+/**
+ * @brief 在作用域中新增一个变量，同时加入函数的变量链表
+ *
+ * @param parser 语法分析器
+ * @param SymId 变量名符号编号
+ * @param S 所在作用域
+ * @return Obj* 新变量指针
+ */
+static Obj *newLVar(Parser *parser, unsigned int SymId, Scope *S) {
+  // 绑定表按符号编号增长
+  if (SymId >= parser->bindCap) {
+    unsigned int Cap = parser->bindCap ? parser->bindCap : 1024;
+    while (Cap <= SymId)
+      Cap *= 2;
+    Obj **Bindings = realloc(parser->bindings, Cap * sizeof(Obj *));
+    if (!Bindings)
+      error("out of memory");
+    parser->bindings = Bindings;
+    memset(parser->bindings + parser->bindCap, 0,
+           (Cap - parser->bindCap) * sizeof(Obj *));
+    parser->bindCap = Cap;
+  }
+
+  Obj *var = arenaAlloc(parser->arena, sizeof(Obj));
+  var->SymId = SymId;
+  var->Name = symbolOf(parser->interns, SymId)->name;
+  var->Depth = S->Depth;
   // 将变量插入头部
-  var->Next = LOCALOBJS;
-  LOCALOBJS = var;
+  var->Next = parser->localObjs;
+  parser->localObjs = var;
+  // 加入作用域，遮蔽外层同名变量
+  var->ScopeNext = S->Vars;
+  S->Vars = var;
+  var->Shadow = parser->bindings[SymId];
+  parser->bindings[SymId] = var;
   return var;
 }
 
 /**
- * @brief 从Objs队列中查找与Tok字面量相同的对象，没找到则返回 NULL
+ * @brief 查找与Tok同名的当前可见的变量，没找到则返回 NULL
+ * 标识符均已驻留，由符号编号直接索引绑定表
  *
- * @param Objs 变量队列
+ * @param parser 语法分析器
  * @param Tok  查找词法单元
  * @return Obj* 变量指针
  */
-static Obj *findVar(const Token *Tok) {
-  for (Obj *var = LOCALOBJS; var; var = var->Next) {
-    if (strlen(var->Name) == Tok->len &&
-        !strncmp(var->Name, Tok->text, Tok->len)) {
-      return var;
-    }
-  }
-  return NULL;
+static Obj *findVar(Parser *parser, const Token *Tok) {
+  return Tok->symId < parser->bindCap ? parser->bindings[Tok->symId] : NULL;
 }
 
-// 解析组合语句
-// block = stmt* "}"
-static Node *block(Token **Rest, Token *Tok) {
+// 解析组合语句，每个组合语句是一个块作用域
+// 嵌套的代码块压入未结束代码块栈，不递归解析
+// block = ("{" block | stmt)* "}"
+static NodeId block(Parser *parser, Token **Rest, Token *Tok) {
+  ParseStacks *S = &parser->stacks;
+  unsigned int Top = 0;
+  S->Blocks = growStack(S->Blocks, &S->BlockCap, Top, sizeof(unsigned int));
+  S->Blocks[Top] = S->StmtTop;
+  enterScope(parser);
 
-  // 建立 stmt 队列
-  Node *headNode = calloc(1, sizeof(Node));
-  Node *curNode = headNode;
-  while (!equal(Tok, "}")) {
-    curNode->Next = stmt(&Tok, Tok);
-    curNode = curNode->Next;
-  }
-  // LHS 和 Body 是 union 结构，所以赋值给 LHS 同时也是赋值给 Body
-  Node *node = newUnaryNode(BLOCK, headNode->Next);
-  free(headNode);
+  while (true) {
+    if (equal(Tok, P_RBRACE)) {
+      // 代码块结束，作为一条语句加入外层代码块
+      NodeId node = popBlock(parser, S->Blocks[Top], Tok);
+      leaveScope(parser);
+      Tok = skip(Tok, P_RBRACE);
+      if (Top == 0) {
+        *Rest = Tok;
+        return node;
+      }
+      Top--;
+      pushStmt(parser, node);
+      continue;
+    }
 
-  *Rest = skip(Tok, "}");
-  return node;
+    // 之前的语句已分析完毕，回收其词法单元
+    releaseTokens(Tok);
+
+    // "{" block
+    if (equal(Tok, P_LBRACE)) {
+      Top++;
+      S->Blocks =
+          growStack(S->Blocks, &S->BlockCap, Top, sizeof(unsigned int));
+      S->Blocks[Top] = S->StmtTop;
+      enterScope(parser);
+      Tok = nextTok(Tok);
+      continue;
+    }
+
+    // stmt
+    pushStmt(parser, stmt(parser, &Tok, Tok));
+  }
 }
 
 // 解析语句
-// stmt = "return" expr ";" | "{" block | exprStmt
-static Node *stmt(Token **Rest, Token *Tok) {
+// stmt = "return" expr ";" | declaration | exprStmt
+static NodeId stmt(Parser *parser, Token **Rest, Token *Tok) {
   // "return" expr ";"
-  if (equal(Tok, "return")) {
-    Node *node = newUnaryNode(RETURN, expr(&Tok, Tok->nextTok));
-    *Rest = skip(Tok, ";");
+  if (equal(Tok, KW_RETURN)) {
+    Token *Start = Tok;
+    NodeId Val = expr(parser, &Tok, nextTok(Tok));
+    NodeId node = newUnaryNode(parser, RETURN, Val, Start);
+    *Rest = skip(Tok, P_SEMI);
     return node;
   }
-  // "{" block
-  if (equal(Tok, "{")) {
-    Node *node = newUnaryNode(BLOCK, block(Rest, Tok->nextTok));
-    return node;
+
+  // declaration
+  if (equal(Tok, KW_INT)) {
+    return declaration(parser, Rest, nextTok(Tok));
   }
 
   // exprStmt
-  return exprStmt(Rest, Tok);
+  return exprStmt(parser, Rest, Tok);
+}
+
+// 解析变量声明，变量属于当前块作用域，可遮蔽外层同名变量
+// declaration = "int" declarator ("," declarator)* ";"
+// declarator = ident ("=" assign)?
+static NodeId declaration(Parser *parser, Token **Rest, Token *Tok) {
+  ParseStacks *S = &parser->stacks;
+  unsigned int Base = S->StmtTop;
+
+  while (true) {
+    if (Tok->kind != ID)
+      errorTok(Tok, "expected a variable name");
+    Obj *Old = findVar(parser, Tok);
+    if (Old && Old->Depth == parser->scope->Depth)
+      errorTok(Tok, "redefinition of '%s'", Old->Name);
+    Obj *var = newLVar(parser, Tok->symId, parser->scope);
+    Token *Name = Tok;
+    Tok = nextTok(Tok);
+
+    // 带初始值的声明转换为赋值语句
+    if (equal(Tok, P_ASSIGN)) {
+      Token *Eq = Tok;
+      NodeId LHS = newVarNode(parser, var, Name);
+      NodeId RHS = assign(parser, &Tok, nextTok(Tok));
+      NodeId init = newBinaryNode(parser, ASSIGN, LHS, RHS, Eq);
+      pushStmt(parser, newUnaryNode(parser, EXPR_STMT, init, Name));
+    }
+
+    if (!equal(Tok, P_COMMA))
+      break;
+    Tok = nextTok(Tok);
+  }
+
+  *Rest = skip(Tok, P_SEMI);
+  return popBlock(parser, Base, Tok);
 }
 
 // 解析表达式语句
 // exprStmt = expr? ";"
-static Node *exprStmt(Token **Rest, Token *Tok) {
+static NodeId exprStmt(Parser *parser, Token **Rest, Token *Tok) {
   // ";"
-  if (equal(Tok, ";")) {
-    *Rest = skip(Tok, ";");
-    return newNode(BLOCK);
+  if (equal(Tok, P_SEMI)) {
+    *Rest = skip(Tok, P_SEMI);
+    return newNode(parser, BLOCK, Tok);
   }
   // expr? ";"
-  Node *node = newUnaryNode(EXPR_STMT, expr(&Tok, Tok));
-  *Rest = skip(Tok, ";");
+  Token *Start = Tok;
+  NodeId Val = expr(parser, &Tok, Tok);
+  NodeId node = newUnaryNode(parser, EXPR_STMT, Val, Start);
+  *Rest = skip(Tok, P_SEMI);
   return node;
 }
 
+// 二元运算符优先级，由低到高，PREC_NONE 表示不是二元运算符
+typedef enum {
+  PREC_NONE,
+  PREC_COMMA,    // ,
+  PREC_ASSIGN,   // = *= /= %= += -= <<= >>= &= ^= |=
+  PREC_COND,     // ?:
+  PREC_LOGOR,    // ||
+  PREC_LOGAND,   // &&
+  PREC_BITOR,    // |
+  PREC_BITXOR,   // ^
+  PREC_BITAND,   // &
+  PREC_EQUALITY, // == !=
+  PREC_RELATION, // < > <= >=
+  PREC_SHIFT,    // << >>
+  PREC_ADD,      // + -
+  PREC_MUL,      // * / %
+  PREC_UNARY,    // 前缀一元运算符
+} Prec;
+
+// 二元运算符表，下标为词法单元编号，其余编号均为 PREC_NONE
+static const struct {
+  unsigned char Prec; // 优先级
+  unsigned char Kind; // 对应的节点种类
+} BinOps[TK_ID_NUM] = {
+    [P_COMMA] = {PREC_COMMA, COMMA},
+    [P_ASSIGN] = {PREC_ASSIGN, ASSIGN},
+    [P_MUL_ASSIGN] = {PREC_ASSIGN, MUL_ASSIGN},
+    [P_DIV_ASSIGN] = {PREC_ASSIGN, DIV_ASSIGN},
+    [P_MOD_ASSIGN] = {PREC_ASSIGN, MOD_ASSIGN},
+    [P_ADD_ASSIGN] = {PREC_ASSIGN, ADD_ASSIGN},
+    [P_SUB_ASSIGN] = {PREC_ASSIGN, SUB_ASSIGN},
+    [P_SHL_ASSIGN] = {PREC_ASSIGN, SHL_ASSIGN},
+    [P_SHR_ASSIGN] = {PREC_ASSIGN, SHR_ASSIGN},
+    [P_AND_ASSIGN] = {PREC_ASSIGN, AND_ASSIGN},
+    [P_XOR_ASSIGN] = {PREC_ASSIGN, XOR_ASSIGN},
+    [P_OR_ASSIGN] = {PREC_ASSIGN, OR_ASSIGN},
+    [P_QUESTION] = {PREC_COND, CONDITION},
+    [P_LOGOR] = {PREC_LOGOR, LOGIC_OR},
+    [P_LOGAND] = {PREC_LOGAND, LOGIC_AND},
+    [P_PIPE] = {PREC_BITOR, OR},
+    [P_CARET] = {PREC_BITXOR, XOR},
+    [P_AMP] = {PREC_BITAND, AND},
+    [P_EQ] = {PREC_EQUALITY, EQ},
+    [P_NE] = {PREC_EQUALITY, NE},
+    [P_LT] = {PREC_RELATION, LT},
+    [P_GT] = {PREC_RELATION, GT},
+    [P_LE] = {PREC_RELATION, LE},
+    [P_GE] = {PREC_RELATION, GE},
+    [P_SHL] = {PREC_SHIFT, SHL},
+    [P_SHR] = {PREC_SHIFT, SHR},
+    [P_PLUS] = {PREC_ADD, ADD},
+    [P_MINUS] = {PREC_ADD, SUB},
+    [P_STAR] = {PREC_MUL, MUL},
+    [P_SLASH] = {PREC_MUL, DIV},
+    [P_PERCENT] = {PREC_MUL, MOD},
+};
+
+// 前缀运算符对应的节点种类，下标为词法单元编号
+static const unsigned char PrefixOps[TK_ID_NUM] = {
+    [P_MINUS] = NEG, [P_AMP] = ADDR,      [P_STAR] = DEADDR,
+    [P_TILDE] = NOT, [P_NOT] = LOGIC_NOT,
+};
+
 // 解析表达式
-// expr = assign
-static Node *expr(Token **Rest, Token *Tok) {
-  // assign
-  return assign(Rest, Tok);
+// expr = binary(PREC_COMMA)
+static NodeId expr(Parser *parser, Token **Rest, Token *Tok) {
+  return binary(parser, Rest, Tok, PREC_COMMA);
 }
 
-// 解析赋值表达式
-// assign = equality ("=" assign)?
-static Node *assign(Token **Rest, Token *Tok) {
-  // equality
-  Node *node = equality(&Tok, Tok);
+// 解析赋值表达式，即不含逗号运算符的表达式
+// assign = binary(PREC_ASSIGN)
+static NodeId assign(Parser *parser, Token **Rest, Token *Tok) {
+  return binary(parser, Rest, Tok, PREC_ASSIGN);
+}
 
-  if (equal(Tok, "=")) {
-    node = newBinaryNode(ASSIGN, node, assign(&Tok, Tok->nextTok));
-  }
-  *Rest = Tok;
-  return node;
+/**
+ * @brief 运算符入栈
+ *
+ * @param parser 语法分析器
+ * @param Kind 节点种类
+ * @param Prec 优先级
+ * @param Tok 运算符词法单元
+ */
+static void pushOp(Parser *parser, NodeKind Kind, int Prec, Token *Tok) {
+  ParseStacks *S = &parser->stacks;
+  S->Ops = growStack(S->Ops, &S->OpCap, S->OpTop, sizeof(ExprOp));
+  S->Ops[S->OpTop++] = (ExprOp){Kind, Prec, Tok};
 }
 
-// 解析相等性
-// equality = relational ("==" relational | "!=" relational)*
-static Node *equality(Token **Rest, Token *Tok) {
-  // relational
-  Node *node = relational(&Tok, Tok);
+/**
+ * @brief 运算对象入栈
+ *
+ * @param parser 语法分析器
+ * @param node 运算对象
+ */
+static void pushVal(Parser *parser, NodeId node) {
+  ParseStacks *S = &parser->stacks;
+  S->Vals = growStack(S->Vals, &S->ValCap, S->ValTop, sizeof(NodeId));
+  S->Vals[S->ValTop++] = node;
+}
 
-  while (true) {
-    // "==" relational
-    if (equal(Tok, "==")) {
-      node = newBinaryNode(EQ, node, relational(&Tok, Tok->nextTok));
+/**
+ * @brief 归约栈顶优先级高于 Prec 的运算符，右结合时同级运算符留在栈中
+ * 标记的优先级为 PREC_NONE，归约停在最内层的标记上
+ *
+ * @param parser 语法分析器
+ * @param Prec 优先级
+ */
+static void reduce(Parser *parser, int Prec) {
+  ParseStacks *S = &parser->stacks;
+  // 赋值与条件运算符右结合
+  bool RightAssoc = Prec == PREC_ASSIGN || Prec == PREC_COND;
+  while (S->OpTop) {
+    ExprOp Op = S->Ops[S->OpTop - 1];
+    if (Op.Prec < Prec || (Op.Prec == Prec && RightAssoc) ||
+        Op.Prec == PREC_NONE)
+      return;
+    S->OpTop--;
+
+    NodeId *Vals = S->Vals;
+    unsigned int Top = S->ValTop;
+    // unary
+    if (Op.Prec == PREC_UNARY) {
+      Vals[Top - 1] = newUnaryNode(parser, Op.Kind, Vals[Top - 1], Op.Tok);
       continue;
     }
-    // "!=" relational
-    if (equal(Tok, "!=")) {
-      node = newBinaryNode(NE, node, relational(&Tok, Tok->nextTok));
+    // cond "?" expr ":" binary
+    if (Op.Kind == CONDITION) {
+      NodeId node = newBinaryNode(parser, CONDITION, Vals[Top - 2],
+                                  Vals[Top - 1], Op.Tok);
+      parser->tree.Data[node].Cond = Vals[Top - 3];
+      Vals[Top - 3] = node;
+      S->ValTop -= 2;
       continue;
     }
-    *Rest = Tok;
-    return node;
+    // binary binop binary
+    Vals[Top - 2] =
+        newBinaryNode(parser, Op.Kind, Vals[Top - 2], Vals[Top - 1], Op.Tok);
+    S->ValTop--;
   }
 }
 
-// 解析比较关系
-// relational = add ("<" add | "<=" add | ">" add | ">=" add)*
-static Node *relational(Token **Rest, Token *Tok) {
-  // add
-  Node *node = add(&Tok, Tok);
+// 运算符优先级分析法解析二元、赋值与条件运算符，只接受优先级不低于 MinPrec 的运算符
+// 运算符与运算对象各用一个栈，括号、前缀与右结合运算符的嵌套都不递归
+// binary = unary (binop binary | "?" expr ":" binary)*
+// unary = ("+" | "-" | "&" | "*" | "~" | "!")* primary
+static NodeId binary(Parser *parser, Token **Rest, Token *Tok, int MinPrec) {
+  ParseStacks *S = &parser->stacks;
+  S->OpTop = S->ValTop = 0;
+  // 未闭合的 "(" 与 "?" 个数，其中的表达式不受 MinPrec 限制
+  unsigned int Open = 0;
+
   while (true) {
-    // "<" add
-    if (equal(Tok, "<")) {
-      node = newBinaryNode(LT, node, add(&Tok, Tok->nextTok));
+    // 运算对象：前缀运算符与 "(" 入栈，直到遇到 primary
+    switch (Tok->id) {
+    // "(" expr ")"
+    case P_LPAREN:
+      pushOp(parser, PARANTHESES, PREC_NONE, Tok);
+      Open++;
+      Tok = nextTok(Tok);
       continue;
-    }
-    // "<=" add
-    if (equal(Tok, "<=")) {
-      node = newBinaryNode(LE, node, add(&Tok, Tok->nextTok));
+    // "+" unary
+    case P_PLUS:
+      Tok = nextTok(Tok);
       continue;
-    }
-    // ">" add
-    if (equal(Tok, ">")) {
-      node = newBinaryNode(GT, node, add(&Tok, Tok->nextTok));
+    // 词法分析按最长匹配切分出 "++" 与 "--"，在支持自增自减之前报错
+    case P_INC:
+    case P_DEC:
+      errorTok(Tok, "increment/decrement not supported");
       continue;
-    }
-    // ">=" add
-    if (equal(Tok, ">=")) {
-      node = newBinaryNode(GE, node, add(&Tok, Tok->nextTok));
+    // "-" unary | "&" unary | "*" unary | "~" unary | "!" unary
+    case P_MINUS:
+    case P_AMP:
+    case P_STAR:
+    case P_TILDE:
+    case P_NOT:
+      pushOp(parser, PrefixOps[Tok->id], PREC_UNARY, Tok);
+      Tok = nextTok(Tok);
       continue;
+    default:
+      break;
     }
-    *Rest = Tok;
-    return node;
-  }
-}
-
-// 加减法关系
-// add = mul ("+" mul | "-" mul)*
-static Node *add(Token **Rest, Token *Tok) {
-  // mul
-  Node *node = mul(&Tok, Tok);
 
-  while (true) {
-    // "+" mul
-    if (equal(Tok, "+")) {
-      node = newBinaryNode(ADD, node, mul(&Tok, Tok->nextTok));
-      continue;
-    }
-    // "-" mul
-    if (equal(Tok, "-")) {
-      node = newBinaryNode(SUB, node, mul(&Tok, Tok->nextTok));
-      continue;
+    // primary
+    pushVal(parser, primary(parser, &Tok, Tok));
+
+    // 运算符：")" 闭合括号后仍需要运算符，其余运算符之后需要运算对象
+    while (Open && equal(Tok, P_RPAREN)) {
+      reduce(parser, PREC_COMMA);
+      if (S->Ops[S->OpTop - 1].Kind != PARANTHESES)
+        skip(Tok, P_COLON);
+      S->OpTop--;
+      Open--;
+      Tok = nextTok(Tok);
     }
-    *Rest = Tok;
-    return node;
-  }
-}
-
-// 乘除取余关系
-// mul = unary ("*" unary | "/" unary )
-static Node *mul(Token **Rest, Token *Tok) {
-  // unary
-  Node *node = unary(&Tok, Tok);
 
-  while (true) {
-    // "*" unary
-    if (equal(Tok, "*")) {
-      node = newBinaryNode(MUL, node, unary(&Tok, Tok->nextTok));
+    // ":" binary，"?" 标记变为条件运算符
+    if (Open && equal(Tok, P_COLON)) {
+      reduce(parser, PREC_COMMA);
+      if (S->Ops[S->OpTop - 1].Kind != CONDITION)
+        skip(Tok, P_RPAREN);
+      S->Ops[S->OpTop - 1].Prec = PREC_COND;
+      Open--;
+      Tok = nextTok(Tok);
       continue;
     }
-    // "/" unary
-    if (equal(Tok, "/")) {
-      node = newBinaryNode(DIV, node, unary(&Tok, Tok->nextTok));
-      continue;
-    }
-    *Rest = Tok;
-    return node;
-  }
-}
-
-// 解析一元运算符
-// unary = ("+" | "-" | "&" | "*")* unary | primary
-static Node *unary(Token **Rest, Token *Tok) {
-
-  // "+" unary
-  if (equal(Tok, "+")) {
-    return unary(Rest, Tok->nextTok);
-  }
-
-  // "-" unary
-  if (equal(Tok, "-")) {
-    return newUnaryNode(NEG, unary(Rest, Tok->nextTok));
-  }
 
-  // "&" unary
-  if (equal(Tok, "&")) {
-    return newUnaryNode(ADDR, unary(Rest, Tok->nextTok));
+    // 后置的 "++" 与 "--" 同样不支持
+    if (Tok->id == P_INC || Tok->id == P_DEC)
+      errorTok(Tok, "increment/decrement not supported");
+
+    // 非二元运算符的优先级为 PREC_NONE，表达式结束
+    int Prec = BinOps[Tok->id].Prec;
+    if (Prec == PREC_NONE || (!Open && Prec < MinPrec))
+      break;
+    NodeKind Kind = BinOps[Tok->id].Kind;
+    reduce(parser, Prec);
+
+    // "?" expr ":"
+    if (Kind == CONDITION) {
+      pushOp(parser, CONDITION, PREC_NONE, Tok);
+      Open++;
+    } else {
+      // binop binary
+      pushOp(parser, Kind, Prec, Tok);
+    }
+    Tok = nextTok(Tok);
   }
 
-  // "*" unary
-  if (equal(Tok, "*")) {
-    return newUnaryNode(DEADDR, unary(Rest, Tok->nextTok));
-  }
+  // 归约剩余运算符，残留的标记说明缺少 ")" 或 ":"
+  reduce(parser, PREC_COMMA);
+  if (S->OpTop)
+    skip(Tok, S->Ops[S->OpTop - 1].Kind == PARANTHESES ? P_RPAREN : P_COLON);
 
-  // primary
-  return primary(Rest, Tok);
+  *Rest = Tok;
+  return S->Vals[0];
 }
 
-// primary = "(" expr ")" |num
-static Node *primary(Token **Rest, Token *Tok) {
-  if (equal(Tok, "(")) {
-    Node *node = expr(&Tok, Tok->nextTok);
-    *Rest = skip(Tok, ")");
-    return node;
-  }
-
+// 解析基本表达式，括号由 binary 处理
+// primary = num | id
+static NodeId primary(Parser *parser, Token **Rest, Token *Tok) {
   if (Tok->kind == VAL_INTEGER) {
-    Node *node = newNumNode(Tok->intVal);
-    *Rest = Tok->nextTok;
+    NodeId node = newNumNode(parser, tokInt(Tok), Tok);
+    *Rest = nextTok(Tok);
     return node;
   }
 
   if (Tok->kind == ID) {
-    Obj *var = findVar(Tok);
+    // 未声明的变量在首次使用时隐式加入函数作用域
+    Obj *var = findVar(parser, Tok);
     if (!var)
-      var = newLVar(strndup(Tok->text, Tok->len));
-    *Rest = Tok->nextTok;
-    return newVarNode(var);
+      var = newLVar(parser, Tok->symId, parser->funcScope);
+    *Rest = nextTok(Tok);
+    return newVarNode(parser, var, Tok);
   }
 
   errorTok(Tok, "expected an expression");
-  return NULL;
+  return 0;
 }
 
-Parser *newParser(Token *tokList) {
-  Parser *paser = calloc(1, sizeof(Parser));
-  paser->tokList = tokList;
-  return paser;
+Parser *newParser(void) {
+  Parser *parser = calloc(1, sizeof(Parser));
+  if (!parser)
+    error("out of memory");
+  return parser;
 }
 
-Function *parse(Parser *parser) {
+Function *parse(Parser *parser, Token *tokList, Arena *arena) {
 
-  // "{" block
-  Token *curTok = parser->tokList;
-  curTok = skip(curTok, "{");
+  // 每个编译单元从空的变量表开始
+  parser->arena = arena;
+  parser->interns = tokenChunkOf(tokList)->lexer->interns;
+  parser->localObjs = NULL;
+  parser->scope = parser->funcScope = NULL;
+  parser->stacks.StmtTop = 0;
+  // 语法树保留上一编译单元的容量
+  astReset(&parser->tree);
 
-  Function *prog = calloc(1, sizeof(Function));
-  prog->Body = block(&curTok, curTok);
-  prog->localObjs = LOCALOBJS;
+  // "{" block
+  Token *curTok = skip(tokList, P_LBRACE);
+
+  Function *prog = arenaAlloc(arena, sizeof(Function));
+  prog->Tree = &parser->tree;
+  prog->lexer = tokenChunkOf(curTok)->lexer;
+  prog->Body = block(parser, &curTok, curTok);
+  prog->localObjs = parser->localObjs;
+  return prog;
+}
 
-  parser->Func = prog;
+void abortParse(Parser *parser) {
+  while (parser->scope)
+    leaveScope(parser);
+}
 
-  return parser->Func;
-}
\ No newline at end of file
+void freeParser(Parser *parser) {
+  astFree(&parser->tree);
+  free(parser->bindings);
+  free(parser->stacks.Blocks);
+  free(parser->stacks.Stmts);
+  free(parser->stacks.Ops);
+  free(parser->stacks.Vals);
+  free(parser);
+}
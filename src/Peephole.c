@@ -0,0 +1,441 @@
+#include "Compiler.h"
+#include <limits.h>
+
+// 窥孔优化
+// 指令逐条移入已处理部分的末尾，每移入一条就在末尾的窗口上反复匹配规则表，
+// 改写后的指令可能与更早的指令组成新的窗口，因此一直匹配到没有规则可用为止
+// 已处理部分与待处理部分共用同一数组，已处理部分只会变短，不会覆盖待处理的指令
+
+// 窗口最多包含的指令条数
+#define MAX_WINDOW 3
+// 判断寄存器是否不再使用时，最多向后查看的指令条数，超出时当作仍在使用
+#define LIVE_SCAN 32
+// 无效位置
+#define NOWHERE UINT_MAX
+
+// 指令种类集合
+#define OPS(Op) (1ULL << OP_##Op)
+// 可以改为立即数形式的三寄存器运算
+#define IMM_ABLE                                                               \
+  (OPS(ADD) | OPS(SUB) | OPS(AND) | OPS(OR) | OPS(XOR) | OPS(SLT) | OPS(SLL) | \
+   OPS(SRA))
+// 不跳转的指令
+#define STRAIGHT (OPS(BEQZ) - 1)
+// 条件跳转
+#define BRANCH (OPS(BEQZ) | OPS(BNEZ))
+// 结果只为 0 或 1 的指令
+#define BOOLEAN (OPS(SLT) | OPS(SLTI) | OPS(SEQZ) | OPS(SNEZ))
+
+// 窥孔优化的状态
+typedef struct {
+  InstList *list;        // 指令序列
+  unsigned int top;      // 已处理部分的长度
+  unsigned int next;     // 下一条待处理指令的位置
+  long labelMin;         // labelAt 中第一个标签的编号
+  long labelMax;         // labelAt 中最后一个标签的编号
+  unsigned int returnAt; // .L.return 的位置
+} Peephole;
+
+// 规则：窗口中各条指令的种类依次属于 Ops 时调用 Apply，条件成立则改写并返回真
+// W 为窗口中各条指令在已处理部分中的位置，窗口末尾的指令总在已处理部分的末尾
+typedef struct {
+  const char *name;         // 规则名
+  unsigned int len;         // 窗口长度
+  uint64_t ops[MAX_WINDOW]; // 各条指令可取的种类
+  bool (*apply)(Peephole *P, const unsigned int *W);
+} Rule;
+
+// 立即数能否放进 12 位有符号立即数字段
+static bool isImm12(long V) { return V >= -2048 && V <= 2047; }
+
+// 指令是否读取寄存器 Reg
+static bool reads(const Inst *I, Register Reg) {
+  return I->Rs1 == Reg || I->Rs2 == Reg;
+}
+
+// 标签所在位置，不在本序列中时为 NOWHERE
+static unsigned int labelPos(const Peephole *P, long Label) {
+  if (Label == LABEL_RETURN)
+    return P->returnAt;
+  if (Label < P->labelMin || Label > P->labelMax)
+    return NOWHERE;
+  return P->list->labelAt[Label - P->labelMin];
+}
+
+/**
+ * @brief 记录各标签在指令序列中的位置
+ *
+ * @param P 窥孔优化状态
+ */
+static void indexLabels(Peephole *P) {
+  InstList *L = P->list;
+  P->labelMin = LONG_MAX;
+  P->labelMax = LONG_MIN;
+  P->returnAt = NOWHERE;
+  for (unsigned int i = 0; i < L->len; i++) {
+    if (L->buf[i].Op != OP_LABEL || L->buf[i].Imm == LABEL_RETURN)
+      continue;
+    if (L->buf[i].Imm < P->labelMin)
+      P->labelMin = L->buf[i].Imm;
+    if (L->buf[i].Imm > P->labelMax)
+      P->labelMax = L->buf[i].Imm;
+  }
+
+  if (P->labelMin <= P->labelMax) {
+    unsigned long Num = P->labelMax - P->labelMin + 1;
+    if (Num > L->labelCap) {
+      // 分配成功后才记录容量，失败时下一编译单元重新分配
+      L->labelCap = 0;
+      free(L->labelAt);
+      L->labelAt = malloc(Num * sizeof(unsigned int));
+      if (!L->labelAt)
+        error("out of memory");
+      L->labelCap = Num;
+    }
+    for (unsigned long i = 0; i < Num; i++)
+      L->labelAt[i] = NOWHERE;
+  }
+  for (unsigned int i = 0; i < L->len; i++) {
+    if (L->buf[i].Op != OP_LABEL)
+      continue;
+    if (L->buf[i].Imm == LABEL_RETURN)
+      P->returnAt = i;
+    else
+      L->labelAt[L->buf[i].Imm - P->labelMin] = i;
+  }
+}
+
+/**
+ * @brief 寄存器的值从待处理部分的 Pos 处起是否不再被读取
+ * 沿跳转继续查看，条件跳转两条路径都要查看；无法确定时当作仍在使用
+ *
+ * @param P 窥孔优化状态
+ * @param Reg 寄存器
+ * @param Pos 起始位置
+ * @param Budget 剩余可查看的指令条数，各路径共用
+ * @return true 寄存器在被读取之前就被改写，或函数已返回
+ * @return false 寄存器可能还会被读取
+ */
+static bool deadAt(const Peephole *P, Register Reg, unsigned int Pos,
+                   int *Budget) {
+  const InstList *L = P->list;
+  // 已处理部分已被改写，不能再查看
+  while (Pos >= P->next && Pos < L->len) {
+    const Inst *I = &L->buf[Pos++];
+    // 注释不计入查看的条数，-fverbose-asm 时结果不变
+    if (I->Op == OP_COMMENT)
+      continue;
+    if ((*Budget)-- <= 0)
+      return false;
+    switch (I->Op) {
+    case OP_LABEL:
+      continue;
+    // 返回后只有 a0 与被调用者保存的寄存器还有用
+    case OP_RET:
+      return (Reg >= R_A1 && Reg <= R_A7) || (Reg >= R_T0 && Reg <= R_T6);
+    case OP_J:
+      Pos = labelPos(P, I->Imm);
+      continue;
+    case OP_BEQZ:
+    case OP_BNEZ:
+      if (I->Rs1 == Reg || !deadAt(P, Reg, labelPos(P, I->Imm), Budget))
+        return false;
+      continue;
+    default:
+      if (reads(I, Reg))
+        return false;
+      if (I->Rd == Reg)
+        return true;
+      continue;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief 已处理部分末尾的指令执行之后，寄存器的值是否不再被读取
+ *
+ * @param P 窥孔优化状态
+ * @param Reg 寄存器
+ * @return true 不再被读取
+ * @return false 可能还会被读取
+ */
+static bool deadAfterTop(const Peephole *P, Register Reg) {
+  // 末尾之后紧接着就是待处理部分
+  const Inst *I = &P->list->buf[P->top - 1];
+  int Budget = LIVE_SCAN;
+  if (I->Op == OP_J)
+    return deadAt(P, Reg, labelPos(P, I->Imm), &Budget);
+  if (I->Op == OP_BEQZ || I->Op == OP_BNEZ)
+    return deadAt(P, Reg, labelPos(P, I->Imm), &Budget) &&
+           deadAt(P, Reg, P->next, &Budget);
+  return deadAt(P, Reg, P->next, &Budget);
+}
+
+// 删除已处理部分中 Pos 处的指令，之后的指令前移
+static void removeAt(Peephole *P, unsigned int Pos) {
+  Inst *Buf = P->list->buf;
+  memmove(&Buf[Pos], &Buf[Pos + 1], (P->top - Pos - 1) * sizeof(Inst));
+  P->top--;
+}
+
+// 交换条件跳转的条件
+static Opcode flipBranch(unsigned char Op) {
+  return Op == OP_BEQZ ? OP_BNEZ : OP_BEQZ;
+}
+
+// li t, c 之后使用 t 的运算改为立即数形式，t 之后不再使用时删去 li
+// li 与运算之间可以隔一条不涉及 t 的指令，Len 为窗口长度
+static bool foldImmIn(Peephole *P, const unsigned int *W, unsigned int Len) {
+  Inst *Buf = P->list->buf;
+  Inst *Li = &Buf[W[0]], *I = &Buf[W[Len - 1]];
+  Register T = Li->Rd;
+  long C = Li->Imm;
+  if (Len == 3 && (reads(&Buf[W[1]], T) || Buf[W[1]].Rd == T))
+    return false;
+
+  // 常数在右边，可交换的运算常数也可以在左边
+  Register X;
+  bool Commutative = I->Op == OP_ADD || I->Op == OP_AND || I->Op == OP_OR ||
+                     I->Op == OP_XOR;
+  if (I->Rs2 == T && I->Rs1 != T)
+    X = I->Rs1;
+  else if (I->Rs1 == T && I->Rs2 != T && Commutative)
+    X = I->Rs2;
+  else
+    return false;
+
+  Opcode Op;
+  switch (I->Op) {
+  case OP_ADD:
+    Op = OP_ADDI;
+    break;
+  case OP_SUB:
+    Op = OP_ADDI;
+    C = -C;
+    break;
+  case OP_AND:
+    Op = OP_ANDI;
+    break;
+  case OP_OR:
+    Op = OP_ORI;
+    break;
+  case OP_XOR:
+    Op = OP_XORI;
+    break;
+  case OP_SLT:
+    Op = OP_SLTI;
+    break;
+  // 移位量只取低 6 位
+  case OP_SLL:
+  case OP_SRA:
+    Op = I->Op == OP_SLL ? OP_SLLI : OP_SRAI;
+    C &= 63;
+    break;
+  default:
+    return false;
+  }
+  // -(-2048) 超出范围
+  if (!isImm12(C) || (I->Rd != T && !deadAfterTop(P, T)))
+    return false;
+
+  *I = (Inst){Op, I->Rd, X, R_ZERO, C};
+  removeAt(P, W[0]);
+  return true;
+}
+
+// li 紧接着运算
+static bool foldImm(Peephole *P, const unsigned int *W) {
+  return foldImmIn(P, W, 2);
+}
+
+// li 与运算之间隔一条指令
+static bool foldImmSkip(Peephole *P, const unsigned int *W) {
+  return foldImmIn(P, W, 3);
+}
+
+// addi/ori/xori/slli/srai d, x, 0 改为 mv d, x
+static bool zeroImm(Peephole *P, const unsigned int *W) {
+  Inst *I = &P->list->buf[W[0]];
+  if (I->Imm)
+    return false;
+  *I = (Inst){OP_MV, I->Rd, I->Rs1, R_ZERO, 0};
+  return true;
+}
+
+// 删去 mv x, x
+static bool selfMove(Peephole *P, const unsigned int *W) {
+  if (P->list->buf[W[0]].Rd != P->list->buf[W[0]].Rs1)
+    return false;
+  removeAt(P, W[0]);
+  return true;
+}
+
+// 栈帧没有移动过时，后语中的 mv sp, fp 不起作用
+// 向前查找前言中的 mv fp, sp，其间不能有改写 sp 与 fp 的指令
+// 跳转只能向前，到达这里的路径都只经过其间的指令
+static bool unmovedFrame(Peephole *P, const unsigned int *W) {
+  Inst *Buf = P->list->buf;
+  if (Buf[W[0]].Rd != R_SP || Buf[W[0]].Rs1 != R_FP)
+    return false;
+  for (unsigned int i = W[0]; i-- > 0;) {
+    if (Buf[i].Op == OP_MV && Buf[i].Rd == R_FP && Buf[i].Rs1 == R_SP) {
+      removeAt(P, W[0]);
+      return true;
+    }
+    if (Buf[i].Op != OP_COMMENT && (Buf[i].Rd == R_SP || Buf[i].Rd == R_FP))
+      return false;
+  }
+  return false;
+}
+
+// sd x, off(b) 之后的 ld y, off(b) 改为 mv y, x
+static bool storeLoad(Peephole *P, const unsigned int *W) {
+  Inst *Sd = &P->list->buf[W[0]], *Ld = &P->list->buf[W[1]];
+  if (Sd->Rs1 != Ld->Rs1 || Sd->Imm != Ld->Imm || Sd->Rs2 == Sd->Rs1)
+    return false;
+  *Ld = (Inst){OP_MV, Ld->Rd, Sd->Rs2, R_ZERO, 0};
+  return true;
+}
+
+// mv y, x 之后读取 y 的指令改为读取 x，y 之后不再使用时删去 mv
+// 不涉及 sp 与 fp，前言与后语保持原样
+static bool forwardMove(Peephole *P, const unsigned int *W) {
+  Inst *Mv = &P->list->buf[W[0]], *I = &P->list->buf[W[1]];
+  Register Y = Mv->Rd, X = Mv->Rs1;
+  if (Y < R_A0 || X < R_A0 || !reads(I, Y) ||
+      (I->Rd != Y && !deadAfterTop(P, Y)))
+    return false;
+  if (I->Rs1 == Y)
+    I->Rs1 = X;
+  if (I->Rs2 == Y)
+    I->Rs2 = X;
+  removeAt(P, W[0]);
+  return true;
+}
+
+// 删去跳到紧接着的标签的跳转
+static bool jumpToNext(Peephole *P, const unsigned int *W) {
+  if (P->list->buf[W[0]].Imm != P->list->buf[W[1]].Imm)
+    return false;
+  removeAt(P, W[0]);
+  return true;
+}
+
+// seqz d, x; xori d, d, 1 即 snez d, x，反之亦然
+static bool notBool(Peephole *P, const unsigned int *W) {
+  Inst *B = &P->list->buf[W[0]], *Xori = &P->list->buf[W[1]];
+  if (Xori->Imm != 1 || Xori->Rd != B->Rd || Xori->Rs1 != B->Rd)
+    return false;
+  B->Op = B->Op == OP_SEQZ ? OP_SNEZ : OP_SEQZ;
+  removeAt(P, W[1]);
+  return true;
+}
+
+// 按 seqz/snez d, x 的结果跳转，d 之后不再使用时直接按 x 跳转
+static bool branchOnBool(Peephole *P, const unsigned int *W) {
+  Inst *B = &P->list->buf[W[0]], *Br = &P->list->buf[W[1]];
+  if (Br->Rs1 != B->Rd || !deadAfterTop(P, B->Rd))
+    return false;
+  if (B->Op == OP_SEQZ)
+    Br->Op = flipBranch(Br->Op);
+  Br->Rs1 = B->Rs1;
+  removeAt(P, W[0]);
+  return true;
+}
+
+// 按取反后的比较结果跳转，结果之后不再使用时去掉 xori，改为相反的跳转
+static bool branchOnNot(Peephole *P, const unsigned int *W) {
+  Inst *B = &P->list->buf[W[0]], *Xori = &P->list->buf[W[1]],
+       *Br = &P->list->buf[W[2]];
+  if (Xori->Imm != 1 || Xori->Rd != B->Rd || Xori->Rs1 != B->Rd ||
+      Br->Rs1 != B->Rd || !deadAfterTop(P, B->Rd))
+    return false;
+  Br->Op = flipBranch(Br->Op);
+  removeAt(P, W[1]);
+  return true;
+}
+
+// 规则表，新规则加在这里
+static const Rule Rules[] = {
+    {"fold-imm", 2, {OPS(LI), IMM_ABLE}, foldImm},
+    {"fold-imm-skip", 3, {OPS(LI), STRAIGHT, IMM_ABLE}, foldImmSkip},
+    {"zero-imm",
+     1,
+     {OPS(ADDI) | OPS(ORI) | OPS(XORI) | OPS(SLLI) | OPS(SRAI)},
+     zeroImm},
+    {"self-move", 1, {OPS(MV)}, selfMove},
+    {"unmoved-frame", 1, {OPS(MV)}, unmovedFrame},
+    {"store-load", 2, {OPS(SD), OPS(LD)}, storeLoad},
+    {"forward-move", 2, {OPS(MV), STRAIGHT | BRANCH}, forwardMove},
+    {"jump-to-next", 2, {OPS(J) | BRANCH, OPS(LABEL)}, jumpToNext},
+    {"not-bool", 2, {OPS(SEQZ) | OPS(SNEZ), OPS(XORI)}, notBool},
+    {"branch-on-bool", 2, {OPS(SEQZ) | OPS(SNEZ), BRANCH}, branchOnBool},
+    {"branch-on-not", 3, {BOOLEAN, OPS(XORI), BRANCH}, branchOnNot},
+};
+
+/**
+ * @brief 在已处理部分末尾的窗口上依次尝试各规则
+ *
+ * @param P 窥孔优化状态
+ * @return true 有规则改写了指令
+ * @return false 没有规则可用
+ */
+static bool applyRules(Peephole *P) {
+  // 取末尾的若干条指令，跳过注释
+  const Inst *Buf = P->list->buf;
+  unsigned int Tail[MAX_WINDOW], N = 0;
+  for (unsigned int i = P->top; i-- > 0 && N < MAX_WINDOW;)
+    if (Buf[i].Op != OP_COMMENT)
+      Tail[MAX_WINDOW - ++N] = i;
+
+  for (unsigned int r = 0; r < sizeof(Rules) / sizeof(*Rules); r++) {
+    const Rule *R = &Rules[r];
+    if (R->len > N)
+      continue;
+    const unsigned int *W = Tail + MAX_WINDOW - R->len;
+    unsigned int i = 0;
+    while (i < R->len && (R->ops[i] >> Buf[W[i]].Op & 1))
+      i++;
+    if (i == R->len && R->apply(P, W))
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief 改写后退回末尾的几条指令，让更早的指令与改写结果组成窗口
+ * 如删去 li 后，之前的 sd 与之后的 ld 才相邻；退回的指令放回待处理部分之前的空位
+ *
+ * @param P 窥孔优化状态
+ */
+static void stepBack(Peephole *P) {
+  Inst *Buf = P->list->buf;
+  unsigned int N = 0;
+  while (P->top && P->top < P->next && N < MAX_WINDOW - 1) {
+    Inst *I = &Buf[--P->top];
+    if (I->Op != OP_COMMENT)
+      N++;
+    Buf[--P->next] = *I;
+    // 标签换了位置，跳转到它时要从新位置查看
+    if (I->Op == OP_LABEL && I->Imm == LABEL_RETURN)
+      P->returnAt = P->next;
+    else if (I->Op == OP_LABEL)
+      P->list->labelAt[I->Imm - P->labelMin] = P->next;
+  }
+}
+
+void peephole(InstList *L) {
+  Peephole P = {.list = L};
+  indexLabels(&P);
+
+  while (P.next < L->len) {
+    L->buf[P.top++] = L->buf[P.next++];
+    if (L->buf[P.top - 1].Op == OP_COMMENT)
+      continue;
+    // 改写后再次匹配，直到没有规则可用
+    while (applyRules(&P))
+      stepBack(&P);
+  }
+  L->len = P.top;
+}
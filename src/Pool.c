@@ -0,0 +1,55 @@
+#include "Compiler.h"
+#include <stdatomic.h>
+#include <unistd.h>
+
+// 一次并行执行的共享状态
+typedef struct {
+  atomic_uint next;                        // 下一个待领取的任务编号
+  unsigned int jobs;                       // 任务个数
+  void (*fn)(void *Arg, unsigned int Job); // 任务函数
+  void *arg;                               // 任务函数参数
+} ParallelFor;
+
+/**
+ * @brief 工作线程，不断领取任务编号直到全部分发完毕
+ *
+ * @param Arg 共享状态
+ */
+static void *worker(void *Arg) {
+  ParallelFor *PF = Arg;
+  unsigned int Job;
+  while ((Job = atomic_fetch_add(&PF->next, 1)) < PF->jobs)
+    PF->fn(PF->arg, Job);
+  return NULL;
+}
+
+void parallelFor(unsigned int Threads, unsigned int Jobs,
+                 void (*Fn)(void *Arg, unsigned int Job), void *Arg) {
+  ParallelFor PF = {.jobs = Jobs, .fn = Fn, .arg = Arg};
+  atomic_init(&PF.next, 0);
+
+  // 线程数不超过任务数，调用线程自身算作一个
+  if (Threads > Jobs)
+    Threads = Jobs;
+  // 无法分配线程数组时由调用线程完成全部任务
+  pthread_t *Tids = calloc(Threads, sizeof(pthread_t));
+  if (!Tids)
+    Threads = 1;
+  unsigned int Started = 0;
+  for (unsigned int i = 1; i < Threads; i++) {
+    // 无法创建更多线程时由已有线程完成剩余任务
+    if (pthread_create(&Tids[i], NULL, worker, &PF))
+      break;
+    Started = i;
+  }
+
+  worker(&PF);
+  for (unsigned int i = 1; i <= Started; i++)
+    pthread_join(Tids[i], NULL);
+  free(Tids);
+}
+
+unsigned int cpuCount(void) {
+  long N = sysconf(_SC_NPROCESSORS_ONLN);
+  return N > 0 ? N : 1;
+}
@@ -0,0 +1,262 @@
+#include "Compiler.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// 字符类别表，与 C locale 下的 isspace/isdigit/isalpha/ispunct 一致
+// 但不受 locale 影响，也不需要函数调用
+#define SP CC_SPACE
+#define DI (CC_DIGIT | CC_IDENT)
+#define AL (CC_ALPHA | CC_IDENT)
+#define PU CC_PUNCT
+const unsigned char CharClass[256] = {
+    // \0 - \x1f，其中 \t \n \v \f \r 为空白符
+    0, 0, 0, 0, 0, 0, 0, 0, 0, SP, SP, SP, SP, SP, 0, 0, //
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, //
+    // ' ' ! " # $ % & ' ( ) * + , - . /
+    SP, PU, PU, PU, PU, PU, PU, PU, PU, PU, PU, PU, PU, PU, PU, PU, //
+    // 0 - 9 : ; < = > ?
+    DI, DI, DI, DI, DI, DI, DI, DI, DI, DI, PU, PU, PU, PU, PU, PU, //
+    // @ A - O
+    PU, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, //
+    // P - Z [ \ ] ^ _
+    AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, PU, PU, PU, PU, AL, //
+    // ` a - o
+    PU, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, //
+    // p - z { | } ~ \x7f
+    AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, PU, PU, PU, PU, 0, //
+    // \x80 - \xff 均不属于任何类别
+};
+#undef SP
+#undef DI
+#undef AL
+#undef PU
+
+/************************标量实现************************/
+
+static const char *skipSpaceScalar(const char *P) {
+  while (CharClass[(unsigned char)*P] & CC_SPACE)
+    P++;
+  return P;
+}
+
+static const char *skipIdentScalar(const char *P) {
+  while (CharClass[(unsigned char)*P] & CC_IDENT)
+    P++;
+  return P;
+}
+
+static const char *skipDigitScalar(const char *P) {
+  while (CharClass[(unsigned char)*P] & CC_DIGIT)
+    P++;
+  return P;
+}
+
+static const char *skipPlainScalar(const char *P) {
+  for (;; P++) {
+    char C = *P;
+    if (C == '"' || C == '\'' || C == '/' || C == '\0')
+      return P;
+  }
+}
+
+/************************SSE2 实现************************/
+
+#if defined(__x86_64__)
+
+// 空白符: ' ' 或 '\t'(9) ~ '\r'(13)
+static inline __m128i isSpace128(__m128i V) {
+  __m128i Blank = _mm_cmpeq_epi8(V, _mm_set1_epi8(' '));
+  __m128i Ctrl = _mm_and_si128(_mm_cmpgt_epi8(V, _mm_set1_epi8('\t' - 1)),
+                               _mm_cmplt_epi8(V, _mm_set1_epi8('\r' + 1)));
+  return _mm_or_si128(Blank, Ctrl);
+}
+
+// 数字: '0' ~ '9'，最高位为1的字节按有符号比较为负数，不会误判
+static inline __m128i isDigit128(__m128i V) {
+  return _mm_and_si128(_mm_cmpgt_epi8(V, _mm_set1_epi8('0' - 1)),
+                       _mm_cmplt_epi8(V, _mm_set1_epi8('9' + 1)));
+}
+
+// 标识符字符: [a-zA-Z0-9_]，| 0x20 将大写字母转为小写
+static inline __m128i isIdent128(__m128i V) {
+  __m128i Lower = _mm_or_si128(V, _mm_set1_epi8(0x20));
+  __m128i Alpha =
+      _mm_and_si128(_mm_cmpgt_epi8(Lower, _mm_set1_epi8('a' - 1)),
+                    _mm_cmplt_epi8(Lower, _mm_set1_epi8('z' + 1)));
+  __m128i Under = _mm_cmpeq_epi8(V, _mm_set1_epi8('_'));
+  return _mm_or_si128(_mm_or_si128(Alpha, Under), isDigit128(V));
+}
+
+// 普通代码之外的字符: " ' / '\0'
+static inline __m128i isSpecial128(__m128i V) {
+  __m128i Quote = _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('"')),
+                               _mm_cmpeq_epi8(V, _mm_set1_epi8('\'')));
+  __m128i Other = _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('/')),
+                               _mm_cmpeq_epi8(V, _mm_setzero_si128()));
+  return _mm_or_si128(Quote, Other);
+}
+
+static const char *skipSpaceSSE2(const char *P) {
+  while (true) {
+    __m128i V = _mm_loadu_si128((const __m128i *)P);
+    unsigned int Other = ~_mm_movemask_epi8(isSpace128(V)) & 0xFFFF;
+    if (Other)
+      return P + __builtin_ctz(Other);
+    P += 16;
+  }
+}
+
+static const char *skipIdentSSE2(const char *P) {
+  while (true) {
+    __m128i V = _mm_loadu_si128((const __m128i *)P);
+    unsigned int Other = ~_mm_movemask_epi8(isIdent128(V)) & 0xFFFF;
+    if (Other)
+      return P + __builtin_ctz(Other);
+    P += 16;
+  }
+}
+
+static const char *skipDigitSSE2(const char *P) {
+  while (true) {
+    __m128i V = _mm_loadu_si128((const __m128i *)P);
+    unsigned int Other = ~_mm_movemask_epi8(isDigit128(V)) & 0xFFFF;
+    if (Other)
+      return P + __builtin_ctz(Other);
+    P += 16;
+  }
+}
+
+static const char *skipPlainSSE2(const char *P) {
+  while (true) {
+    __m128i V = _mm_loadu_si128((const __m128i *)P);
+    unsigned int Stop = _mm_movemask_epi8(isSpecial128(V));
+    if (Stop)
+      return P + __builtin_ctz(Stop);
+    P += 16;
+  }
+}
+
+/************************AVX2 实现************************/
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i isSpace256(__m256i V) {
+  __m256i Blank = _mm256_cmpeq_epi8(V, _mm256_set1_epi8(' '));
+  __m256i Ctrl =
+      _mm256_and_si256(_mm256_cmpgt_epi8(V, _mm256_set1_epi8('\t' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), V));
+  return _mm256_or_si256(Blank, Ctrl);
+}
+
+AVX2 static inline __m256i isDigit256(__m256i V) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(V, _mm256_set1_epi8('0' - 1)),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), V));
+}
+
+AVX2 static inline __m256i isIdent256(__m256i V) {
+  __m256i Lower = _mm256_or_si256(V, _mm256_set1_epi8(0x20));
+  __m256i Alpha =
+      _mm256_and_si256(_mm256_cmpgt_epi8(Lower, _mm256_set1_epi8('a' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), Lower));
+  __m256i Under = _mm256_cmpeq_epi8(V, _mm256_set1_epi8('_'));
+  return _mm256_or_si256(_mm256_or_si256(Alpha, Under), isDigit256(V));
+}
+
+AVX2 static inline __m256i isSpecial256(__m256i V) {
+  __m256i Quote =
+      _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8('"')),
+                      _mm256_cmpeq_epi8(V, _mm256_set1_epi8('\'')));
+  __m256i Other =
+      _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8('/')),
+                      _mm256_cmpeq_epi8(V, _mm256_setzero_si256()));
+  return _mm256_or_si256(Quote, Other);
+}
+
+AVX2 static const char *skipSpaceAVX2(const char *P) {
+  while (true) {
+    __m256i V = _mm256_loadu_si256((const __m256i *)P);
+    unsigned int Other = ~(unsigned int)_mm256_movemask_epi8(isSpace256(V));
+    if (Other)
+      return P + __builtin_ctz(Other);
+    P += 32;
+  }
+}
+
+AVX2 static const char *skipIdentAVX2(const char *P) {
+  while (true) {
+    __m256i V = _mm256_loadu_si256((const __m256i *)P);
+    unsigned int Other = ~(unsigned int)_mm256_movemask_epi8(isIdent256(V));
+    if (Other)
+      return P + __builtin_ctz(Other);
+    P += 32;
+  }
+}
+
+AVX2 static const char *skipDigitAVX2(const char *P) {
+  while (true) {
+    __m256i V = _mm256_loadu_si256((const __m256i *)P);
+    unsigned int Other = ~(unsigned int)_mm256_movemask_epi8(isDigit256(V));
+    if (Other)
+      return P + __builtin_ctz(Other);
+    P += 32;
+  }
+}
+
+AVX2 static const char *skipPlainAVX2(const char *P) {
+  while (true) {
+    __m256i V = _mm256_loadu_si256((const __m256i *)P);
+    unsigned int Stop = _mm256_movemask_epi8(isSpecial256(V));
+    if (Stop)
+      return P + __builtin_ctz(Stop);
+    P += 32;
+  }
+}
+
+#undef AVX2
+
+#endif // __x86_64__
+
+/************************扫描器选择************************/
+
+static const Scanner Scanners[] = {
+#if defined(__x86_64__)
+    {"avx2", skipSpaceAVX2, skipIdentAVX2, skipDigitAVX2, skipPlainAVX2},
+    {"sse2", skipSpaceSSE2, skipIdentSSE2, skipDigitSSE2, skipPlainSSE2},
+#endif
+    {"scalar", skipSpaceScalar, skipIdentScalar, skipDigitScalar,
+     skipPlainScalar},
+};
+
+#define SCANNER_NUM (sizeof(Scanners) / sizeof(Scanners[0]))
+
+/**
+ * @brief 当前CPU是否支持该扫描器
+ *
+ * @param scan 扫描器
+ */
+static bool scannerSupported(const Scanner *scan) {
+#if defined(__x86_64__)
+  if (scan->skipSpace == skipSpaceAVX2)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return true;
+}
+
+const Scanner *bestScanner(void) {
+  // Scanners 按优先顺序排列，选取第一个可用的
+  for (size_t i = 0; i < SCANNER_NUM; i++) {
+    if (scannerSupported(&Scanners[i]))
+      return &Scanners[i];
+  }
+  return &Scanners[SCANNER_NUM - 1];
+}
+
+const Scanner *findScanner(const char *Name) {
+  for (size_t i = 0; i < SCANNER_NUM; i++) {
+    if (!strcmp(Scanners[i].name, Name))
+      return scannerSupported(&Scanners[i]) ? &Scanners[i] : NULL;
+  }
+  return NULL;
+}
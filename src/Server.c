@@ -0,0 +1,613 @@
+#include "Compiler.h"
+#include "qcc.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// 编译服务协议，整数均为本机字节序的 uint32_t，一个连接上可依次发送多个请求
+// 请求：名称长度、源程序长度、名称、源程序
+// 应答：编译结果 QccStatus、汇编长度、诊断信息长度、汇编、诊断信息
+
+// 请求中名称与源程序的长度上限，超出时服务端断开连接
+#define MAX_NAME 4096
+#define MAX_SOURCE (256u << 20)
+
+// 每次从连接读取的最大字节数，请求按实际到达的数据逐步扩容
+#define READ_CHUNK (64 * 1024)
+
+// 一个客户端连接，客户端套接字为非阻塞的，请求分多次到达时在此累积，
+// 完整后才编译；应答一次发不完时暂存于此，待可写时继续发送
+// 以 EPOLLONESHOT 注册，同一时刻只被一个工作线程处理
+typedef struct Conn Conn;
+struct Conn {
+  Conn *prev;        // 连接链表的前一个连接
+  Conn *next;        // 连接链表的后一个连接
+  int fd;            // 客户端连接
+  uint32_t head[2];  // 请求头：名称长度、源程序长度
+  size_t got;        // 当前请求已收到的字节数，含请求头
+  char *req;         // 请求内容，依次存放名称、'\0' 与源程序
+  size_t reqCap;     // req 的容量
+  char *reply;       // 未发完的应答
+  size_t replyLen;   // 未发完的应答字节数，为 0 时没有待发的应答
+  size_t replySent;  // 其中已发送的字节数
+  size_t replyCap;   // reply 的容量
+};
+
+// 编译服务的共享状态
+typedef struct {
+  int epfd;             // 监听套接字、客户端连接与停止信号共用的 epoll
+  int listenFd;         // 监听套接字
+  int sigFd;            // 停止信号，可读后各工作线程退出
+  QccContext **ctxs;    // 各工作线程的编译上下文
+  pthread_mutex_t lock; // 保护连接链表
+  Conn *conns;          // 全部连接，停止服务时关闭其中仍未断开的
+} Server;
+
+// 读取请求或发送应答的进展
+typedef enum {
+  IO_DONE,  // 已读完一个请求或已发完应答
+  IO_AGAIN, // 暂时无法继续，等待 epoll 通知
+  IO_CLOSE, // 连接关闭、出错或请求无效，应关闭连接
+} IoState;
+
+/**
+ * @brief 读满 Len 字节
+ *
+ * @param Fd 文件描述符
+ * @param Buf 缓冲区
+ * @param Len 字节数
+ * @return true 读满
+ * @return false 连接关闭或出错
+ */
+static bool readAll(int Fd, void *Buf, size_t Len) {
+  char *P = Buf;
+  while (Len) {
+    ssize_t N = read(Fd, P, Len);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Len -= N;
+  }
+  return true;
+}
+
+/**
+ * @brief 发送全部分段，对端关闭时不产生 SIGPIPE
+ *
+ * @param Fd 套接字
+ * @param Iov 分段，发送时会被修改
+ * @param N 分段个数
+ * @return true 发送完毕
+ * @return false 连接关闭或出错
+ */
+static bool sendAll(int Fd, struct iovec *Iov, int N) {
+  while (N) {
+    struct msghdr Msg = {.msg_iov = Iov, .msg_iovlen = N};
+    ssize_t Sent = sendmsg(Fd, &Msg, MSG_NOSIGNAL);
+    if (Sent < 0 && errno == EINTR)
+      continue;
+    if (Sent < 0)
+      return false;
+    // 跳过已发送的分段
+    while (N && (size_t)Sent >= Iov->iov_len) {
+      Sent -= Iov->iov_len;
+      Iov++;
+      N--;
+    }
+    if (N) {
+      Iov->iov_base = (char *)Iov->iov_base + Sent;
+      Iov->iov_len -= Sent;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief 将描述符重新加入 epoll，等待下一次可读或可写
+ * 所有描述符都以 EPOLLONESHOT 注册，同一时刻只被一个工作线程处理
+ *
+ * @param S 编译服务
+ * @param Fd 文件描述符
+ * @param Tag 事件数据，连接为 Conn，监听套接字为 &S->listenFd
+ * @param Events EPOLLIN 或 EPOLLOUT
+ * @param Op EPOLL_CTL_ADD 或 EPOLL_CTL_MOD
+ * @return true 成功
+ * @return false 失败
+ */
+static bool arm(Server *S, int Fd, void *Tag, uint32_t Events, int Op) {
+  struct epoll_event Ev = {.events = Events | EPOLLONESHOT, .data.ptr = Tag};
+  return epoll_ctl(S->epfd, Op, Fd, &Ev) == 0;
+}
+
+/**
+ * @brief 关闭连接并从连接链表中移除
+ *
+ * @param S 编译服务
+ * @param C 连接
+ */
+static void closeConn(Server *S, Conn *C) {
+  pthread_mutex_lock(&S->lock);
+  if (C->prev)
+    C->prev->next = C->next;
+  else
+    S->conns = C->next;
+  if (C->next)
+    C->next->prev = C->prev;
+  pthread_mutex_unlock(&S->lock);
+
+  close(C->fd);
+  free(C->req);
+  free(C->reply);
+  free(C);
+}
+
+/**
+ * @brief 接受全部等待中的连接，设为非阻塞后加入连接链表
+ *
+ * @param S 编译服务
+ */
+static void acceptClients(Server *S) {
+  for (;;) {
+    int Fd = accept(S->listenFd, NULL, NULL);
+    if (Fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      // EAGAIN 时已全部接受，其他错误（如描述符耗尽）留待下次重试
+      break;
+    }
+    Conn *C = calloc(1, sizeof(Conn));
+    if (!C || fcntl(Fd, F_SETFL, fcntl(Fd, F_GETFL) | O_NONBLOCK)) {
+      free(C);
+      close(Fd);
+      continue;
+    }
+    C->fd = Fd;
+    pthread_mutex_lock(&S->lock);
+    C->next = S->conns;
+    if (S->conns)
+      S->conns->prev = C;
+    S->conns = C;
+    pthread_mutex_unlock(&S->lock);
+    if (!arm(S, Fd, C, EPOLLIN, EPOLL_CTL_ADD))
+      closeConn(S, C);
+  }
+  arm(S, S->listenFd, &S->listenFd, EPOLLIN, EPOLL_CTL_MOD);
+}
+
+/**
+ * @brief 确保请求缓冲区至少能放下 Size 字节
+ *
+ * @param C 连接
+ * @param Size 字节数
+ * @return true 成功
+ * @return false 内存不足
+ */
+static bool reserveReq(Conn *C, size_t Size) {
+  if (Size <= C->reqCap)
+    return true;
+  size_t Cap = C->reqCap ? C->reqCap * 2 : 4096;
+  if (Cap < Size)
+    Cap = Size;
+  char *Req = realloc(C->req, Cap);
+  if (!Req)
+    return false;
+  C->req = Req;
+  C->reqCap = Cap;
+  return true;
+}
+
+/**
+ * @brief 读取连接上已到达的数据，直到读完一个请求或暂无数据
+ * 只读取当前请求的字节，之后的请求留在套接字中
+ *
+ * @param C 连接
+ * @return IoState 读取进展
+ */
+static IoState readRequest(Conn *C) {
+  const size_t HeadLen = sizeof(C->head);
+  for (;;) {
+    char *Dst;
+    size_t Want;
+    if (C->got < HeadLen) {
+      Dst = (char *)C->head + C->got;
+      Want = HeadLen - C->got;
+    } else {
+      // 名称与源程序之间留出 '\0' 的位置，一次读取不跨越两者
+      size_t Body = C->got - HeadLen;
+      size_t NameLen = C->head[0];
+      size_t Total = NameLen + C->head[1];
+      if (Body == Total)
+        return IO_DONE;
+      Want = Body < NameLen ? NameLen - Body : Total - Body;
+      if (Want > READ_CHUNK)
+        Want = READ_CHUNK;
+      size_t Pos = Body < NameLen ? Body : Body + 1;
+      if (!reserveReq(C, Pos + Want))
+        return IO_CLOSE;
+      Dst = C->req + Pos;
+    }
+
+    ssize_t N = read(C->fd, Dst, Want);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return IO_AGAIN;
+    if (N <= 0)
+      return IO_CLOSE;
+    C->got += N;
+
+    // 请求头读满后检查长度，名称之后的 '\0' 总要有位置
+    if (C->got == HeadLen &&
+        (C->head[0] > MAX_NAME || C->head[1] > MAX_SOURCE ||
+         !reserveReq(C, C->head[0] + 1)))
+      return IO_CLOSE;
+  }
+}
+
+/**
+ * @brief 发送暂存的应答，直到发完或暂时无法发送
+ *
+ * @param C 连接
+ * @return IoState 发送进展
+ */
+static IoState sendPending(Conn *C) {
+  while (C->replySent < C->replyLen) {
+    ssize_t N = send(C->fd, C->reply + C->replySent,
+                     C->replyLen - C->replySent, MSG_NOSIGNAL);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return IO_AGAIN;
+    if (N < 0)
+      return IO_CLOSE;
+    C->replySent += N;
+  }
+  C->replyLen = C->replySent = 0;
+  return IO_DONE;
+}
+
+/**
+ * @brief 发送应答各分段，发不完时将剩余部分暂存到连接中
+ *
+ * @param C 连接
+ * @param Iov 分段，发送时会被修改
+ * @param N 分段个数
+ * @return IoState 发送进展
+ */
+static IoState sendReply(Conn *C, struct iovec *Iov, int N) {
+  while (N) {
+    struct msghdr Msg = {.msg_iov = Iov, .msg_iovlen = N};
+    ssize_t Sent = sendmsg(C->fd, &Msg, MSG_NOSIGNAL);
+    if (Sent < 0 && errno == EINTR)
+      continue;
+    if (Sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+      return IO_CLOSE;
+    if (Sent < 0)
+      break;
+    // 跳过已发送的分段
+    while (N && (size_t)Sent >= Iov->iov_len) {
+      Sent -= Iov->iov_len;
+      Iov++;
+      N--;
+    }
+    if (N) {
+      Iov->iov_base = (char *)Iov->iov_base + Sent;
+      Iov->iov_len -= Sent;
+    }
+  }
+  if (!N)
+    return IO_DONE;
+
+  // 汇编与诊断信息在上下文中，下一个请求会覆盖，复制剩余部分
+  size_t Left = 0;
+  for (int i = 0; i < N; i++)
+    Left += Iov[i].iov_len;
+  if (Left > C->replyCap) {
+    free(C->reply);
+    if (!(C->reply = malloc(Left))) {
+      C->replyCap = 0;
+      return IO_CLOSE;
+    }
+    C->replyCap = Left;
+  }
+  C->replyLen = 0;
+  for (int i = 0; i < N; i++) {
+    memcpy(C->reply + C->replyLen, Iov[i].iov_base, Iov[i].iov_len);
+    C->replyLen += Iov[i].iov_len;
+  }
+  return IO_AGAIN;
+}
+
+/**
+ * @brief 处理连接上的一次就绪：先发完暂存的应答，再读取请求，
+ * 请求完整时编译并发送应答。任何一步都不阻塞，暂时无法继续时等待 epoll 通知
+ *
+ * @param S 编译服务
+ * @param Ctx 编译上下文
+ * @param C 连接
+ * @return true 连接已重新加入 epoll
+ * @return false 应关闭连接
+ */
+static bool serveConn(Server *S, QccContext *Ctx, Conn *C) {
+  if (C->replyLen) {
+    IoState St = sendPending(C);
+    if (St != IO_DONE)
+      return St == IO_AGAIN && arm(S, C->fd, C, EPOLLOUT, EPOLL_CTL_MOD);
+  }
+
+  IoState St = readRequest(C);
+  if (St != IO_DONE)
+    return St == IO_AGAIN && arm(S, C->fd, C, EPOLLIN, EPOLL_CTL_MOD);
+  C->got = 0;
+  char *Name = C->req;
+  char *Src = Name + C->head[0] + 1;
+  Name[C->head[0]] = '\0';
+
+  // 编译结束时上下文已重置内存区与词法分析器，内存留给下一个请求
+  QccStatus Status = qccCompile(Ctx, Name, Src, C->head[1], NULL, 0, NULL);
+  size_t OutLen;
+  const char *Out = qccOutput(Ctx, &OutLen);
+  const char *Diag = qccDiagnostics(Ctx);
+  size_t DiagLen = strlen(Diag);
+  if (OutLen > UINT32_MAX || DiagLen > UINT32_MAX)
+    return false;
+
+  uint32_t Reply[3] = {Status, OutLen, DiagLen};
+  struct iovec Iov[3] = {
+      {Reply, sizeof(Reply)},
+      {(char *)Out, OutLen},
+      {(char *)Diag, DiagLen},
+  };
+  // 每次只处理一个请求，连接上的后续请求重新排队，多个客户端轮流得到服务
+  St = sendReply(C, Iov, 3);
+  if (St == IO_CLOSE)
+    return false;
+  return arm(S, C->fd, C, St == IO_DONE ? EPOLLIN : EPOLLOUT, EPOLL_CTL_MOD);
+}
+
+/**
+ * @brief 工作线程，从 epoll 领取就绪的描述符处理，直到收到停止信号
+ * 连接的读写都不阻塞，收到停止信号时只需处理完手头这一次就绪
+ *
+ * @param Arg 编译服务
+ * @param Job 工作线程编号
+ */
+static void serveWorker(void *Arg, unsigned int Job) {
+  Server *S = Arg;
+  QccContext *Ctx = S->ctxs[Job];
+
+  for (;;) {
+    struct epoll_event Ev;
+    int N = epoll_wait(S->epfd, &Ev, 1, -1);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N < 0)
+      break;
+
+    // 停止信号不读取，保持可读使所有工作线程都能看到
+    if (Ev.data.ptr == &S->sigFd)
+      break;
+    if (Ev.data.ptr == &S->listenFd) {
+      acceptClients(S);
+      continue;
+    }
+    Conn *C = Ev.data.ptr;
+    if (!serveConn(S, Ctx, C))
+      closeConn(S, C);
+  }
+}
+
+/**
+ * @brief 在 Path 上监听，替换崩溃的服务遗留的套接字文件
+ *
+ * @param Path 套接字路径
+ * @return int 监听套接字，失败时为 -1
+ */
+static int listenOn(const char *Path) {
+  struct sockaddr_un Addr = {.sun_family = AF_UNIX};
+  if (strlen(Path) >= sizeof(Addr.sun_path)) {
+    fprintf(stderr, "qcc: socket path too long: %s\n", Path);
+    return -1;
+  }
+  strcpy(Addr.sun_path, Path);
+
+  int Fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Fd < 0) {
+    fprintf(stderr, "qcc: cannot create socket: %s\n", strerror(errno));
+    return -1;
+  }
+
+  // 能连上说明已有服务在运行，否则遗留的套接字文件可以删除
+  struct stat St;
+  if (stat(Path, &St) == 0 && S_ISSOCK(St.st_mode)) {
+    if (connect(Fd, (struct sockaddr *)&Addr, sizeof(Addr)) == 0) {
+      fprintf(stderr, "qcc: server already running on %s\n", Path);
+      close(Fd);
+      return -1;
+    }
+    unlink(Path);
+  }
+
+  if (bind(Fd, (struct sockaddr *)&Addr, sizeof(Addr)) ||
+      listen(Fd, SOMAXCONN) ||
+      fcntl(Fd, F_SETFL, fcntl(Fd, F_GETFL) | O_NONBLOCK)) {
+    fprintf(stderr, "qcc: cannot listen on %s: %s\n", Path, strerror(errno));
+    close(Fd);
+    return -1;
+  }
+  return Fd;
+}
+
+int qccServe(const char *Path, unsigned Jobs, const char *const *Opts,
+             int NOpts) {
+  if (!Jobs)
+    Jobs = cpuCount();
+
+  // 每个工作线程一个编译上下文，选项无效时不启动服务
+  Server S = {.epfd = -1, .listenFd = -1, .sigFd = -1};
+  char *Diag;
+  S.ctxs = newContexts(Jobs, Opts, NOpts, &Diag);
+  if (!S.ctxs) {
+    fputs(Diag ? Diag : "qcc: out of memory\n", stderr);
+    free(Diag);
+    return 1;
+  }
+  pthread_mutex_init(&S.lock, NULL);
+
+  // 停止信号由 signalfd 接收，须在创建工作线程前屏蔽，使其继承屏蔽字
+  sigset_t Mask, OldMask;
+  sigemptyset(&Mask);
+  sigaddset(&Mask, SIGINT);
+  sigaddset(&Mask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &Mask, &OldMask);
+
+  int Ret = 1;
+  S.listenFd = listenOn(Path);
+  if (S.listenFd >= 0) {
+    S.sigFd = signalfd(-1, &Mask, 0);
+    S.epfd = epoll_create1(0);
+    struct epoll_event Ev = {.events = EPOLLIN, .data.ptr = &S.sigFd};
+    if (S.sigFd < 0 || S.epfd < 0 ||
+        !arm(&S, S.listenFd, &S.listenFd, EPOLLIN, EPOLL_CTL_ADD) ||
+        epoll_ctl(S.epfd, EPOLL_CTL_ADD, S.sigFd, &Ev)) {
+      fprintf(stderr, "qcc: cannot start server: %s\n", strerror(errno));
+    } else {
+      parallelFor(Jobs, Jobs, serveWorker, &S);
+      // 取走停止信号，否则恢复屏蔽字时它仍会按默认方式终止进程
+      struct signalfd_siginfo Info;
+      if (read(S.sigFd, &Info, sizeof(Info)) == sizeof(Info))
+        Ret = 0;
+    }
+
+    // 工作线程均已退出，关闭仍未断开的客户端连接
+    while (S.conns)
+      closeConn(&S, S.conns);
+    close(S.listenFd);
+    unlink(Path);
+    if (S.sigFd >= 0)
+      close(S.sigFd);
+    if (S.epfd >= 0)
+      close(S.epfd);
+  }
+
+  pthread_sigmask(SIG_SETMASK, &OldMask, NULL);
+  pthread_mutex_destroy(&S.lock);
+  freeContexts(S.ctxs, Jobs);
+  return Ret;
+}
+
+/************************客户端************************/
+
+// 编译服务的客户端，保存最近一次应答
+struct QccClient {
+  int fd;      // 与服务端的连接
+  StrBuf out;  // 汇编
+  StrBuf diag; // 诊断信息
+};
+
+QccClient *qccConnect(const char *Path) {
+  struct sockaddr_un Addr = {.sun_family = AF_UNIX};
+  if (strlen(Path) >= sizeof(Addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  strcpy(Addr.sun_path, Path);
+
+  int Fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Fd < 0)
+    return NULL;
+  if (connect(Fd, (struct sockaddr *)&Addr, sizeof(Addr))) {
+    int Err = errno;
+    close(Fd);
+    errno = Err;
+    return NULL;
+  }
+
+  QccClient *Client = calloc(1, sizeof(QccClient));
+  if (!Client) {
+    close(Fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+  Client->fd = Fd;
+  return Client;
+}
+
+/**
+ * @brief 从连接读满 Len 字节，追加到缓冲区
+ *
+ * @param Fd 连接
+ * @param B 缓冲区
+ * @param Len 字节数
+ * @return true 读满
+ * @return false 连接关闭或出错
+ */
+static bool readBuf(int Fd, StrBuf *B, size_t Len) {
+  char *P = strBufReserve(B, Len);
+  if (!readAll(Fd, P, Len))
+    return false;
+  B->len += Len;
+  B->buf[B->len] = '\0';
+  return true;
+}
+
+QccStatus qccRemoteCompile(QccClient *Client, const char *Name,
+                           const char *Src, size_t Len) {
+  strBufClear(&Client->out);
+  strBufClear(&Client->diag);
+
+  size_t NameLen = strlen(Name);
+  if (NameLen > MAX_NAME || Len > MAX_SOURCE) {
+    strBufPrintf(&Client->diag, "%s: source too large for compile server\n",
+                 Name);
+    return QCC_ERROR;
+  }
+
+  uint32_t Head[2] = {NameLen, Len};
+  struct iovec Iov[3] = {
+      {Head, sizeof(Head)},
+      {(char *)Name, NameLen},
+      {(char *)Src, Len},
+  };
+  uint32_t Reply[3];
+  // 对端关闭时 errno 不变，先清零以区分
+  errno = 0;
+  if (!sendAll(Client->fd, Iov, 3) ||
+      !readAll(Client->fd, Reply, sizeof(Reply)) ||
+      !readBuf(Client->fd, &Client->out, Reply[1]) ||
+      !readBuf(Client->fd, &Client->diag, Reply[2])) {
+    strBufClear(&Client->out);
+    strBufClear(&Client->diag);
+    strBufPrintf(&Client->diag, "lost connection to compile server: %s\n",
+                 errno ? strerror(errno) : "closed by server");
+    return QCC_ERROR;
+  }
+  return Reply[0];
+}
+
+const char *qccRemoteOutput(const QccClient *Client, size_t *Len) {
+  if (Len)
+    *Len = Client->out.len;
+  return Client->out.buf ? Client->out.buf : "";
+}
+
+const char *qccRemoteDiagnostics(const QccClient *Client) {
+  return Client->diag.buf ? Client->diag.buf : "";
+}
+
+void qccDisconnect(QccClient *Client) {
+  if (!Client)
+    return;
+  close(Client->fd);
+  strBufFree(&Client->out);
+  strBufFree(&Client->diag);
+  free(Client);
+}
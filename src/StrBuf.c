@@ -0,0 +1,65 @@
+#include "Compiler.h"
+
+char *strBufReserve(StrBuf *B, size_t Size) {
+  if (B->len + Size < B->cap)
+    return B->buf + B->len;
+  size_t Cap = B->cap ? B->cap : 4096;
+  while (Cap <= B->len + Size)
+    Cap *= 2;
+  char *Buf = realloc(B->buf, Cap);
+  if (!Buf)
+    error("out of memory");
+  B->buf = Buf;
+  B->cap = Cap;
+  return B->buf + B->len;
+}
+
+void strBufAppend(StrBuf *B, const char *Str, size_t Len) {
+  strBufReserve(B, Len);
+  memcpy(B->buf + B->len, Str, Len);
+  B->len += Len;
+  B->buf[B->len] = '\0';
+  if (B->sink && B->len >= STRBUF_FLUSH)
+    strBufFlush(B);
+}
+
+int strBufVPrintf(StrBuf *B, const char *Fmt, va_list VA) {
+  // 先按剩余空间格式化，放不下时扩容后再格式化一次
+  va_list Copy;
+  va_copy(Copy, VA);
+  size_t Left = B->cap - B->len;
+  int N = vsnprintf(B->buf ? B->buf + B->len : NULL, Left, Fmt, Copy);
+  va_end(Copy);
+  if (N < 0)
+    return N;
+  if ((size_t)N >= Left) {
+    strBufReserve(B, N);
+    vsnprintf(B->buf + B->len, N + 1, Fmt, VA);
+  }
+  B->len += N;
+  if (B->sink && B->len >= STRBUF_FLUSH)
+    strBufFlush(B);
+  return N;
+}
+
+int strBufPrintf(StrBuf *B, const char *Fmt, ...) {
+  va_list VA;
+  va_start(VA, Fmt);
+  int N = strBufVPrintf(B, Fmt, VA);
+  va_end(VA);
+  return N;
+}
+
+void strBufFlush(StrBuf *B) {
+  if (!B->sink || !B->len)
+    return;
+  if (fwrite(B->buf, 1, B->len, B->sink) != B->len)
+    error("cannot write output: %s", strerror(errno));
+  B->flushed += B->len;
+  strBufClear(B);
+}
+
+void strBufFree(StrBuf *B) {
+  free(B->buf);
+  *B = (StrBuf){0};
+}
@@ -1,47 +1,112 @@
 #include "Compiler.h"
 
-static char *keywords[] = {
+// 关键字文本，下标为 TokenId - KW_IF
+static const char *keywords[] = {
     "if",     "else",     "goto",     "switch",   "case",   "default", "for",
     "do",     "while",    "break",    "continue", "return", "sizeof",  "void",
     "char",   "short",    "int",      "long",     "float",  "double",  "union",
-    "enum",   "struct",   "typdef",   "auto",     "extern", "const",   "static",
+    "enum",   "struct",   "typedef",  "auto",     "extern", "const",   "static",
     "signed", "unsigned", "register", "volatile"};
 
-Token *newToken(TokenKind kind, const char *text, const char *fpath,
-                const char *context, int row, int col) {
-  //分配1个Token空间
-  Token *token = calloc(1, sizeof(Token));
+// 标点符号文本，下标为 TokenId - P_LBRACKET，双连符取其对应的标点符号
+static const char *punctuators[] = {
+    "[",   "]",   "(",   ")",   "{",   "}",   ".",   "->",  "++",  "--",
+    "&",   "*",   "+",   "-",   "~",   "!",   "/",   "%",   "<<",  ">>",
+    "<",   ">",   "<=",  ">=",  "==",  "!=",  "^",   "|",   "&&",  "||",
+    "?",   ":",   ";",   "...", "=",   "*=",  "/=",  "%=",  "+=",  "-=",
+    "<<=", ">>=", "&=",  "^=",  "|=",  ",",   "#",   "##"};
+
+// 关键字最短、最长长度
+#define KEYWORD_MIN_LEN 2
+#define KEYWORD_MAX_LEN 8
+
+// 关键字完美哈希表，槽位为 keywordHash 的结果，空槽为 TK_NONE
+// 系数由穷举搜索得出，保证上面32个关键字两两不冲突，增删关键字时需重新搜索
+static const unsigned char KeywordTable[64] = {
+    KW_RETURN,   KW_CONST,    TK_NONE,     KW_VOLATILE, // 0
+    KW_SIGNED,   TK_NONE,     TK_NONE,     KW_FLOAT,    // 4
+    KW_CHAR,     KW_LONG,     KW_IF,       KW_AUTO,     // 8
+    KW_WHILE,    TK_NONE,     TK_NONE,     TK_NONE,     // 12
+    KW_SWITCH,   KW_CASE,     TK_NONE,     TK_NONE,     // 16
+    KW_BREAK,    KW_ELSE,     TK_NONE,     KW_GOTO,     // 20
+    TK_NONE,     TK_NONE,     TK_NONE,     TK_NONE,     // 24
+    TK_NONE,     KW_CONTINUE, TK_NONE,     TK_NONE,     // 28
+    TK_NONE,     KW_SHORT,    TK_NONE,     TK_NONE,     // 32
+    KW_VOID,     TK_NONE,     KW_EXTERN,   KW_INT,      // 36
+    TK_NONE,     KW_DEFAULT,  KW_SIZEOF,   KW_DO,       // 40
+    TK_NONE,     KW_ENUM,     KW_UNSIGNED, TK_NONE,     // 44
+    TK_NONE,     KW_STATIC,   KW_REGISTER, KW_UNION,    // 48
+    KW_STRUCT,   TK_NONE,     TK_NONE,     TK_NONE,     // 52
+    TK_NONE,     KW_DOUBLE,   TK_NONE,     KW_FOR,      // 56
+    TK_NONE,     TK_NONE,     TK_NONE,     KW_TYPEDEF,  // 60
+};
+
+/**
+ * @brief 关键字完美哈希 (2 * 首字符 + 19 * (尾字符 + 长度)) % 64
+ *
+ * @param Str 标识符文本
+ * @param Len 标识符长度
+ * @return unsigned int 哈希槽位
+ */
+static inline unsigned int keywordHash(const char *Str, unsigned int Len) {
+  unsigned int First = (unsigned char)Str[0];
+  unsigned int Last = (unsigned char)Str[Len - 1];
+  return (2 * First + 19 * (Last + Len)) & 63;
+}
+
+Token *newToken(TokenChunk *chunk, TokenKind kind, unsigned int offset) {
+  //从块中分配1个Token空间
+  Token *token = &chunk->toks[chunk->len++];
 
   //初始化变量
+  token->offset = offset;
+  token->len = 0;
   token->kind = kind;
-  token->text = text;
-  token->fpath = fpath;
-  token->context = context;
-  token->row = row;
-  token->col = col;
+  token->id = TK_NONE;
+  token->symId = 0;
 
   //返回新生成token
   return token;
 }
 
-bool equal(const Token *Tok, const char *Str) {
-  // memcmp(s1, s2, n)比较s1和s2的前n位，s2长度应该大于n，
-  // 比较按照字典序，相同则返回0
+void setTokInt(Token *Tok, long Val) {
+  TokenChunk *chunk = tokenChunkOf(Tok);
+  long *End = (long *)((uintptr_t)chunk + TOKEN_CHUNK_BYTES);
+  Tok->valIdx = chunk->valLen++;
+  End[-1 - (long)Tok->valIdx] = Val;
+}
+
+bool equalText(const Token *Tok, const char *Str) {
+  // strncmp(s1, s2, n)比较s1和s2的前n位，遇到s2结尾即停止，
+  // 不会越过较短的Str读取，相同则返回0
   // 确保长度相同
-  return memcmp(Tok->text, Str, Tok->len) == 0 && Str[Tok->len] == '\0';
+  return strncmp(tokText(Tok), Str, Tok->len) == 0 && Str[Tok->len] == '\0';
 }
 
-Token *skip(Token *Tok, char *Str) {
-  if (!equal(Tok, Str)) {
-    errorTok(Tok, "expect '%s'", Str);
+const char *tokIdText(TokenId Id) {
+  if (Id >= KW_IF && Id < P_LBRACKET)
+    return keywords[Id - KW_IF];
+  if (Id >= P_LBRACKET && Id < TK_ID_NUM)
+    return punctuators[Id - P_LBRACKET];
+  return "";
+}
+
+Token *skip(Token *Tok, TokenId Id) {
+  if (!equal(Tok, Id)) {
+    errorTok(Tok, "expect '%s'", tokIdText(Id));
   }
-  return Tok->nextTok;
+  return nextTok(Tok);
 }
 
 void convert(Token *tok) {
-  for (int i = 0; i < 32; i++) {
-    if (equal(tok, keywords[i])) {
-      tok->kind = KEYWORD;
-    }
+  // 长度不符的标识符不可能是关键字
+  if (tok->len < KEYWORD_MIN_LEN || tok->len > KEYWORD_MAX_LEN)
+    return;
+
+  // 每个槽位至多一个候选关键字，只需比较一次
+  TokenId Id = KeywordTable[keywordHash(tokText(tok), tok->len)];
+  if (Id != TK_NONE && equalText(tok, keywords[Id - KW_IF])) {
+    tok->kind = KEYWORD;
+    tok->id = Id;
   }
 }
\ No newline at end of file
@@ -1,27 +1,215 @@
-#include "Compiler.h"
+#include "qcc.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief 读入整个文件
+ *
+ * @param fpath 文件路径，为 - 时读取标准输入
+ * @param Len 返回文件长度
+ * @return char* 文件内容，失败时为 NULL
+ */
+static char *readFile(const char *fpath, size_t *Len) {
+  FILE *FP = strcmp(fpath, "-") ? fopen(fpath, "rb") : stdin;
+  if (!FP)
+    return NULL;
+
+  size_t Cap = 4096, N = 0;
+  char *Buf = malloc(Cap);
+  while (Buf) {
+    N += fread(Buf + N, 1, Cap - N, FP);
+    if (N < Cap)
+      break;
+    char *New = realloc(Buf, Cap *= 2);
+    if (!New)
+      free(Buf);
+    Buf = New;
+  }
+  if (Buf && ferror(FP)) {
+    free(Buf);
+    Buf = NULL;
+  }
+  if (FP != stdin)
+    fclose(FP);
+  *Len = N;
+  return Buf;
+}
+
+/**
+ * @brief 把源文件交给编译服务编译，输出同直接编译
+ *
+ * @param Socket 编译服务的套接字路径
+ * @param fpath 源文件路径，为 - 时读取标准输入
+ * @return int 退出码
+ */
+static int runClient(const char *Socket, const char *fpath) {
+  size_t Len;
+  char *Src = readFile(fpath, &Len);
+  if (!Src) {
+    fprintf(stderr, "cannot open %s: %s\n", fpath, strerror(errno));
+    return 1;
+  }
+  QccClient *Client = qccConnect(Socket);
+  if (!Client) {
+    fprintf(stderr, "cannot connect to %s: %s\n", Socket, strerror(errno));
+    free(Src);
+    return 1;
+  }
+
+  QccStatus Status = qccRemoteCompile(Client, fpath, Src, Len);
+  size_t OutLen;
+  const char *Asm = qccRemoteOutput(Client, &OutLen);
+  fwrite(Asm, 1, OutLen, stdout);
+  fflush(stdout);
+  fputs(qccRemoteDiagnostics(Client), stderr);
+
+  qccDisconnect(Client);
+  free(Src);
+  return Status == QCC_OK ? 0 : 1;
+}
 
 int main(int args, char **argv) {
 
-  // 检查传入参数是否为2个，arg[0]为程序名称，argv[1]为传入的第一个参数
+  // 用法: qcc [-ftime-report] [-fmem-report] [-fscan=<name>]
+  //           [-flex-mode=stream|eager|thread|parallel] [-flex-jobs=<n>]
+  //           [-fno-fold] [-fno-peephole] [-fverbose-asm] [-fverify-ir]
+  //           [--emit-ir] [-dump-tokens] [-o <out>] <file>
+  //       qcc -c [-j <n>] [选项] <file>...
+  //       qcc --server <socket> [-j <n>] [选项]
+  //       qcc --client <socket> <file>
+  // file 为 - 时从标准输入读取；汇编写入 -o 指定的文件，默认为标准输出；
+  // --emit-ir 时输出 SSA 中间表示代替汇编；
+  // -c 时 a.c 的汇编写入 a.s
+  // 编译由 libqcc 完成，这里只解析参数并输出结果
+  const char *Server = NULL, *Client = NULL, *Output = NULL;
+  unsigned Jobs = 0;
+  bool Separate = false;
+  const char **Opts = calloc(args, sizeof(char *));
+  const char **Files = calloc(args, sizeof(char *));
+  int NOpts = 0, NFiles = 0;
+  if (!Opts || !Files) {
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    return 1;
+  }
+
+  for (int i = 1; i < args; i++) {
+    // 带参数的选项，参数为下一个命令行参数
+    if (!strcmp(argv[i], "--server") || !strcmp(argv[i], "--client") ||
+        !strcmp(argv[i], "-j") || !strcmp(argv[i], "-o")) {
+      if (i + 1 == args) {
+        fprintf(stderr, "%s: missing argument to %s\n", argv[0], argv[i]);
+        return 1;
+      }
+      const char *Arg = argv[++i];
+      if (argv[i - 1][1] == 'j') {
+        char *End;
+        Jobs = strtoul(Arg, &End, 10);
+        if (*End || !Jobs) {
+          fprintf(stderr, "%s: invalid jobs: %s\n", argv[0], Arg);
+          return 1;
+        }
+      } else if (argv[i - 1][1] == 'o') {
+        Output = Arg;
+      } else if (argv[i - 1][2] == 's') {
+        Server = Arg;
+      } else {
+        Client = Arg;
+      }
+      continue;
+    }
+    if (!strcmp(argv[i], "-c")) {
+      Separate = true;
+      continue;
+    }
+    // 其余以 - 开头的参数为编译选项，单独的 - 为标准输入
+    if (argv[i][0] == '-' && argv[i][1]) {
+      Opts[NOpts++] = argv[i];
+      continue;
+    }
+    Files[NFiles++] = argv[i];
+  }
+
+  // 编译服务一直运行到收到 SIGINT 或 SIGTERM
+  if (Server) {
+    if (NFiles || Client || Separate || Output) {
+      fprintf(stderr, "%s: invalid number of aruguments\n", argv[0]);
+      return 1;
+    }
+    return qccServe(Server, Jobs, Opts, NOpts);
+  }
+
+  // 各源文件分别编译到自己的汇编文件
+  if (Separate) {
+    for (int i = 0; i < NFiles; i++) {
+      if (!strcmp(Files[i], "-")) {
+        fprintf(stderr, "%s: cannot use - with -c\n", argv[0]);
+        return 1;
+      }
+    }
+    if (!NFiles || Client) {
+      fprintf(stderr, "%s: invalid number of aruguments\n", argv[0]);
+      return 1;
+    }
+    if (Output) {
+      fprintf(stderr, "%s: cannot use -o with -c\n", argv[0]);
+      return 1;
+    }
+    char *Diag;
+    int Ret = qccCompileFiles(Files, NFiles, Jobs, Opts, NOpts, &Diag);
+    if (Diag)
+      fputs(Diag, stderr);
+    free(Diag);
+    return Ret;
+  }
+
+  // 检查是否只传入了一个文件
   // fprintf，格式化文件输出，向文件流stream中写入格式化字符串
   // stderr，异常文件，向屏幕输出异常信息
   // %s，字符串通配符号
-  if (args != 2) {
+  if (NFiles != 1) {
     fprintf(stderr, "%s: invalid number of aruguments\n", argv[0]);
     return 1;
   }
+  const char *fpath = Files[0];
 
-  //词法分析
-  Lexer *lexer = newLexer(argv[1]);
-  Token *toklist = analysis(lexer);
+  // 编译选项在启动编译服务时指定
+  if (Client) {
+    if (NOpts) {
+      fprintf(stderr, "%s: options must be given to --server\n", argv[0]);
+      return 1;
+    }
+    if (Output) {
+      fprintf(stderr, "%s: cannot use -o with --client\n", argv[0]);
+      return 1;
+    }
+    return runClient(Client, fpath);
+  }
 
-  //语法分析
-  Parser *parser = newParser(toklist);
-  Function *func = parse(parser);
+  QccContext *Ctx = qccNew();
+  if (!Ctx) {
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    return 1;
+  }
+  for (int i = 0; i < NOpts; i++) {
+    if (qccSetOption(Ctx, Opts[i]) != QCC_OK) {
+      fputs(qccDiagnostics(Ctx), stderr);
+      return 1;
+    }
+  }
 
-  //目标代码生成
-  Codegener *codegener = newCodegener(func);
-  codegen(codegener);
+  // 有 -o 时汇编全部生成后一次写入文件，否则边生成边写到标准输出
+  // 警告、报错与报告输出到标准错误
+  QccStatus Status = qccCompileFile(Ctx, fpath, Output ? NULL : stdout);
+  if (Output && Status == QCC_OK)
+    Status = qccWriteOutput(Ctx, Output);
+  fflush(stdout);
+  fputs(qccDiagnostics(Ctx), stderr);
 
-  return 0;
-}
\ No newline at end of file
+  qccFree(Ctx);
+  free(Opts);
+  free(Files);
+  return Status == QCC_OK ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+#ifndef QCC_H
+#define QCC_H
+
+// libqcc 对外接口
+// 编译上下文持有一次编译所需的全部状态，不同上下文可在不同线程中同时使用；
+// 同一上下文依次编译多个源程序时，内存区、词法单元块与输出缓冲区都会重用
+
+#include <stddef.h>
+#include <stdio.h>
+
+// 共享库只导出以下接口
+#define QCC_API __attribute__((visibility("default")))
+
+// 编译结果
+typedef enum {
+  QCC_OK,      // 成功
+  QCC_ERROR,   // 编译失败或选项无效，原因由 qccDiagnostics 获取
+  QCC_NOSPACE, // 输出缓冲区不足，汇编仍可由 qccOutput 获取
+} QccStatus;
+
+// 编译上下文
+typedef struct QccContext QccContext;
+
+/**
+ * @brief 生成编译上下文
+ *
+ * @return QccContext* 编译上下文，内存不足时为 NULL
+ */
+QCC_API QccContext *qccNew(void);
+
+/**
+ * @brief 释放编译上下文及其持有的全部内存
+ *
+ * @param Ctx 编译上下文
+ */
+QCC_API void qccFree(QccContext *Ctx);
+
+/**
+ * @brief 设置编译选项，对之后的每次编译生效
+ * 选项同 qcc 命令行：-ftime-report -fmem-report -fscan=<name>
+ * -flex-mode=stream|eager|thread|parallel -flex-jobs=<n> -fno-fold
+ * -fno-peephole -fverbose-asm -fverify-ir --emit-ir -dump-tokens
+ *
+ * @param Ctx 编译上下文
+ * @param Opt 选项
+ * @return QccStatus 未知或无效的选项返回 QCC_ERROR
+ */
+QCC_API QccStatus qccSetOption(QccContext *Ctx, const char *Opt);
+
+/**
+ * @brief 编译内存中的源程序，汇编写入调用方的缓冲区
+ *
+ * @param Ctx 编译上下文
+ * @param Name 报错时使用的文件名
+ * @param Src 源程序，无需以 '\0' 结尾
+ * @param Len 源程序长度
+ * @param Out 输出缓冲区，可为 NULL，放得下时在汇编之后补 '\0'
+ * @param OutCap 输出缓冲区容量
+ * @param OutLen 返回汇编长度，可为 NULL
+ * @return QccStatus 编译结果
+ */
+QCC_API QccStatus qccCompile(QccContext *Ctx, const char *Name,
+                             const char *Src, size_t Len, char *Out,
+                             size_t OutCap, size_t *OutLen);
+
+/**
+ * @brief 编译源文件
+ * 给出输出流时汇编边生成边分块写出，不在内存中保留整个汇编，
+ * 编译失败时输出流中可能已有部分汇编；否则汇编由 qccOutput 获取
+ *
+ * @param Ctx 编译上下文
+ * @param Path 源文件路径，为 - 时从标准输入读取
+ * @param Out 汇编输出流，可为 NULL
+ * @return QccStatus 编译结果
+ */
+QCC_API QccStatus qccCompileFile(QccContext *Ctx, const char *Path,
+                                 FILE *Out);
+
+/**
+ * @brief 以多个线程编译多个源文件，a.c 的汇编写入 a.s，其余后缀追加 .s
+ * 每个线程持有一个编译上下文，按文件大小降序领取源文件；
+ * 各文件的输出与线程数无关，诊断信息全部完成后按输入顺序拼接返回，
+ * 编译失败的文件不留下汇编文件；指向同一汇编文件的源文件不编译，直接失败
+ *
+ * @param Paths 源文件路径
+ * @param NPaths 源文件个数
+ * @param Jobs 线程数，0 为全部处理器
+ * @param Opts 编译选项，同 qccSetOption
+ * @param NOpts 编译选项个数
+ * @param Diag 返回诊断信息，含失败原因，由调用方 free，没有时为 NULL
+ * @return int 全部成功为 0，否则为 1
+ */
+QCC_API int qccCompileFiles(const char *const *Paths, int NPaths,
+                            unsigned Jobs, const char *const *Opts, int NOpts,
+                            char **Diag);
+
+/**
+ * @brief 获取最近一次编译产生的汇编，下次编译前有效
+ * 编译时给出了输出流的，汇编已写出，这里为空串
+ *
+ * @param Ctx 编译上下文
+ * @param Len 返回汇编长度，可为 NULL
+ * @return const char* 汇编，以 '\0' 结尾
+ */
+QCC_API const char *qccOutput(const QccContext *Ctx, size_t *Len);
+
+/**
+ * @brief 将最近一次编译的汇编一次写入文件，编译时给出了输出流的不适用
+ *
+ * @param Ctx 编译上下文
+ * @param Path 文件路径
+ * @return QccStatus 无法写入时为 QCC_ERROR，原因追加到诊断信息，不留下文件
+ */
+QCC_API QccStatus qccWriteOutput(QccContext *Ctx, const char *Path);
+
+/**
+ * @brief 获取最近一次编译或设置选项产生的诊断信息，含警告与报告
+ *
+ * @param Ctx 编译上下文
+ * @return const char* 诊断信息，以 '\0' 结尾，没有时为空串
+ */
+QCC_API const char *qccDiagnostics(const QccContext *Ctx);
+
+/**
+ * @brief 运行编译服务，在 Unix 套接字 Path 上接受编译请求
+ * 每个工作线程持有一个编译上下文，请求之间重用其内存；
+ * 客户端连接为非阻塞的，请求完整后才编译，慢客户端不会占住工作线程；
+ * 收到 SIGINT 或 SIGTERM 后处理完正在编译的请求，删除套接字文件并返回。
+ * 出错信息输出到标准错误
+ *
+ * @param Path 套接字路径
+ * @param Jobs 工作线程数，0 为全部处理器
+ * @param Opts 编译选项，同 qccSetOption
+ * @param NOpts 编译选项个数
+ * @return int 正常退出为 0，选项无效或无法监听为 1
+ */
+QCC_API int qccServe(const char *Path, unsigned Jobs, const char *const *Opts,
+                     int NOpts);
+
+// 编译服务的客户端
+typedef struct QccClient QccClient;
+
+/**
+ * @brief 连接编译服务
+ *
+ * @param Path 套接字路径
+ * @return QccClient* 客户端，连接失败时为 NULL，原因见 errno
+ */
+QCC_API QccClient *qccConnect(const char *Path);
+
+/**
+ * @brief 请求编译服务编译源程序，同一连接上可依次请求多次
+ *
+ * @param Client 客户端
+ * @param Name 报错时使用的文件名
+ * @param Src 源程序，无需以 '\0' 结尾
+ * @param Len 源程序长度
+ * @return QccStatus 编译结果，连接出错时为 QCC_ERROR
+ */
+QCC_API QccStatus qccRemoteCompile(QccClient *Client, const char *Name,
+                                   const char *Src, size_t Len);
+
+/**
+ * @brief 获取最近一次请求返回的汇编，下次请求前有效
+ *
+ * @param Client 客户端
+ * @param Len 返回汇编长度，可为 NULL
+ * @return const char* 汇编，以 '\0' 结尾
+ */
+QCC_API const char *qccRemoteOutput(const QccClient *Client, size_t *Len);
+
+/**
+ * @brief 获取最近一次请求返回的诊断信息，含连接出错的原因
+ *
+ * @param Client 客户端
+ * @return const char* 诊断信息，以 '\0' 结尾，没有时为空串
+ */
+QCC_API const char *qccRemoteDiagnostics(const QccClient *Client);
+
+/**
+ * @brief 断开连接并释放客户端
+ *
+ * @param Client 客户端
+ */
+QCC_API void qccDisconnect(QccClient *Client);
+
+#endif
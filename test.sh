@@ -21,6 +21,264 @@ rebuild() {
 
 #############################################################################
 
+# 生成随机输入，混合长短不一的空白符、标识符、数字和标点符号
+# 参数1为随机数种子，参数2为生成文件路径
+genFuzz() {
+  awk -v seed="$1" 'BEGIN {
+    srand(seed)
+    split(" |\t|\n|\r|\f|\v", Space, "|")
+    Alpha = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_"
+    Alnum = Alpha "0123456789"
+    Punct = "!#%&()*+,-./:;<=>?[]^{|}~"
+    for (i = 0; i < 2000; i++) {
+      r = int(rand() * 4)
+      if (r == 0) {
+        n = int(rand() * 70)
+        for (j = 0; j < n; j++) printf "%s", Space[int(rand() * 6) + 1]
+      } else if (r == 1) {
+        printf "%s", substr(Alpha, int(rand() * 53) + 1, 1)
+        n = int(rand() * 80)
+        for (j = 0; j < n; j++) printf "%s", substr(Alnum, int(rand() * 63) + 1, 1)
+      } else if (r == 2) {
+        # 不超过 19 位，避免字面量超出 64 位而提前报错
+        n = int(rand() * 19) + 1
+        for (j = 0; j < n; j++) printf "%d", int(rand() * 10)
+      } else {
+        printf "%s", substr(Punct, int(rand() * 25) + 1, 1)
+      }
+    }
+    # 以无法识别的字符结尾，同时对比报错位置
+    if (seed % 2) printf "\001"
+  }' > "$2"
+}
+
+# 对比各字符扫描器与标量实现的词法分析结果
+# 参数1为随机输入个数
+checkScan() {
+  for seed in $(seq 1 "$1"); do
+    genFuzz "$seed" ./tmp/fuzz.c
+    ./bin/qcc -fscan=scalar -dump-tokens ./tmp/fuzz.c > ./tmp/fuzz.scalar 2>&1
+    for scan in sse2 avx2; do
+      # 跳过当前CPU不支持的扫描器
+      ./bin/qcc -fscan=$scan -dump-tokens - < /dev/null > /dev/null 2>&1 || continue
+      ./bin/qcc -fscan=$scan -dump-tokens ./tmp/fuzz.c > ./tmp/fuzz.$scan 2>&1
+      if ! cmp -s ./tmp/fuzz.scalar ./tmp/fuzz.$scan; then
+        echo "scanner $scan differs from scalar on seed $seed"
+        exit 1
+      fi
+    done
+  done
+  echo "scanner check OK"
+}
+
+# 对比并行与顺序词法分析的结果，输入超过 1MB 才会被切分
+# 参数1为拼接的随机输入个数
+checkParallel() {
+  : > ./tmp/par.c
+  # 偶数种子的随机输入不以无法识别的字符结尾，可直接拼接
+  for seed in $(seq 2 2 $(($1 * 2))); do
+    genFuzz "$seed" ./tmp/fuzz.c
+    cat ./tmp/fuzz.c >> ./tmp/par.c
+  done
+  ./bin/qcc -dump-tokens ./tmp/par.c > ./tmp/par.seq 2>&1
+  for jobs in 1 2 3 8; do
+    ./bin/qcc -flex-mode=parallel -flex-jobs=$jobs -dump-tokens ./tmp/par.c > ./tmp/par.out 2>&1
+    if ! cmp -s ./tmp/par.seq ./tmp/par.out; then
+      echo "parallel lex with $jobs jobs differs from sequential"
+      exit 1
+    fi
+  done
+  echo "parallel lex check OK"
+}
+
+# 大小恰为整页的源文件不能映射，否则末尾之后的 0 字节落在下一页，读取即 SIGBUS
+checkPageFile() {
+  echo '{ return 1; }' | ./bin/qcc - > ./tmp/page.expect
+  for size in 4096 8192; do
+    printf '{ return 1; }%*s\n' $((size - 14)) '' > ./tmp/page.c
+    for mode in stream eager thread parallel; do
+      if ! ./bin/qcc -flex-mode=$mode ./tmp/page.c > ./tmp/page.s ||
+        ! cmp -s ./tmp/page.expect ./tmp/page.s; then
+        echo "$size-byte source fails with -flex-mode=$mode"
+        exit 1
+      fi
+    done
+  done
+  echo "page-sized file check OK"
+}
+
+# 生成深度嵌套的输入
+# 参数1为嵌套种类 unary|paren|block|cond|assign|sum，参数2为嵌套深度，参数3为生成文件路径
+genDeep() {
+  awk -v kind="$1" -v n="$2" 'BEGIN {
+    if (kind == "unary") {
+      printf "{ return "
+      for (i = 0; i < n; i++) printf "- "
+      print "1; }"
+    } else if (kind == "paren") {
+      printf "{ return "
+      for (i = 0; i < n; i++) printf "("
+      printf "1"
+      for (i = 0; i < n; i++) printf ")"
+      print "; }"
+    } else if (kind == "block") {
+      for (i = 0; i < n; i++) printf "{"
+      printf " return 1; "
+      for (i = 0; i < n; i++) printf "}"
+      print ""
+    } else if (kind == "cond") {
+      printf "{ return "
+      for (i = 0; i < n; i++) printf "1?"
+      printf "1"
+      for (i = 0; i < n; i++) printf ":0"
+      print "; }"
+    } else if (kind == "assign") {
+      printf "{ "
+      for (i = 0; i < n; i++) printf "a="
+      print "1; return a; }"
+    } else if (kind == "sum") {
+      printf "{ a=1; return a"
+      for (i = 1; i < n; i++) printf "+a"
+      print "; }"
+    }
+  }' > "$3"
+}
+
+# 深度嵌套的输入应能正常编译，不耗尽 C 栈
+# 参数1为嵌套深度
+checkDeep() {
+  for kind in unary paren block cond assign sum; do
+    genDeep $kind "$1" ./tmp/deep.c
+    if ! ./bin/qcc ./tmp/deep.c > ./tmp/deep.s; then
+      echo "$kind nesting of depth $1 failed"
+      exit 1
+    fi
+  done
+  echo "deep nesting check OK"
+}
+
+# 从 test.sh 提取小程序，每行一个
+# 参数1为生成文件路径
+genSnippets() {
+  sed -n "s/^assert [0-9]* '\(.*\)'$/\1/p" ./test.sh > "$1"
+}
+
+# 启动编译服务，等到能连上为止
+# 参数1为套接字路径，其余参数传给 qcc --server
+startServer() {
+  sock="$1"
+  shift
+  ./bin/qcc --server "$sock" "$@" &
+  serverPid=$!
+  until echo '{ return 0; }' | ./bin/qcc --client "$sock" - > /dev/null 2>&1; do
+    kill -0 $serverPid 2> /dev/null || exit 1
+    sleep 0.05
+  done
+}
+
+# 停止编译服务
+stopServer() {
+  kill $serverPid
+  wait $serverPid
+}
+
+# 对比经编译服务与直接编译的输出与退出码，含一个出错的程序
+checkServer() {
+  genSnippets ./tmp/snippets.txt
+  echo '{ return 1+; }' >> ./tmp/snippets.txt
+  startServer ./tmp/qcc.sock -j 2
+  while IFS= read -r input; do
+    echo "$input" | ./bin/qcc - > ./tmp/direct.out 2>&1
+    direct=$?
+    echo "$input" | ./bin/qcc --client ./tmp/qcc.sock - > ./tmp/server.out 2>&1
+    server=$?
+    if [ $direct != $server ] || ! cmp -s ./tmp/direct.out ./tmp/server.out; then
+      echo "server differs from direct compile on: $input"
+      stopServer
+      exit 1
+    fi
+  done < ./tmp/snippets.txt
+  stopServer
+  echo "server check OK"
+}
+
+# 多文件并行编译的输出应与线程数无关，且与逐个编译相同，含一个出错的程序
+checkMulti() {
+  rm -rf ./tmp/multi
+  mkdir -p ./tmp/multi
+  genSnippets ./tmp/snippets.txt
+  echo '{ return 1+; }' >> ./tmp/snippets.txt
+  n=0
+  while IFS= read -r input; do
+    echo "$input" > ./tmp/multi/$n.c
+    n=$((n + 1))
+  done < ./tmp/snippets.txt
+
+  for jobs in 1 8; do
+    rm -f ./tmp/multi/*.s
+    if ./bin/qcc -c -j $jobs ./tmp/multi/*.c 2> ./tmp/multi.err$jobs; then
+      echo "multi-file compile should fail on the bad program"
+      exit 1
+    fi
+    cat ./tmp/multi/*.s > ./tmp/multi.out$jobs
+  done
+  if ! cmp -s ./tmp/multi.out1 ./tmp/multi.out8 || ! cmp -s ./tmp/multi.err1 ./tmp/multi.err8; then
+    echo "multi-file compile differs between 1 and 8 jobs"
+    exit 1
+  fi
+  for f in ./tmp/multi/*.c; do
+    ./bin/qcc "$f" > ./tmp/single.s 2> /dev/null || continue
+    if ! cmp -s ./tmp/single.s "${f%.c}.s"; then
+      echo "multi-file compile differs from single compile on $f"
+      exit 1
+    fi
+  done
+  # 同一汇编文件的不同写法也算重名，不能由两个线程同时写入
+  if ./bin/qcc -c -j 2 ./tmp/multi/0.c ./tmp/multi/../multi/0.c 2> /dev/null; then
+    echo "multi-file compile should reject outputs that name the same file"
+    exit 1
+  fi
+  echo "multi-file check OK"
+}
+
+# -fverbose-asm 只增加注释行，-o 写出的汇编与标准输出相同
+checkEmit() {
+  genSnippets ./tmp/snippets.txt
+  while IFS= read -r input; do
+    echo "$input" | ./bin/qcc - > ./tmp/plain.s
+    echo "$input" | ./bin/qcc -fverbose-asm - | grep -v '^    # ' > ./tmp/verbose.s
+    echo "$input" | ./bin/qcc -o ./tmp/out.s -
+    if ! cmp -s ./tmp/plain.s ./tmp/verbose.s || ! cmp -s ./tmp/plain.s ./tmp/out.s; then
+      echo "assembly output differs on: $input"
+      exit 1
+    fi
+  done < ./tmp/snippets.txt
+  echo "emit check OK"
+}
+
+# 各小程序的中间表示都应通过检查，深度嵌套的输入不折叠时分支与 φ 最多
+# 参数1为嵌套深度
+checkIr() {
+  genSnippets ./tmp/snippets.txt
+  while IFS= read -r input; do
+    for opt in "" -fno-fold; do
+      if ! echo "$input" | ./bin/qcc --emit-ir $opt - > ./tmp/ir.out 2>&1; then
+        echo "invalid IR on: $input"
+        cat ./tmp/ir.out
+        exit 1
+      fi
+    done
+  done < ./tmp/snippets.txt
+  for kind in unary cond assign sum; do
+    genDeep $kind "$1" ./tmp/deep.c
+    if ! ./bin/qcc -fno-fold -fverify-ir ./tmp/deep.c > ./tmp/deep.s; then
+      echo "invalid IR on $kind nesting of depth $1"
+      exit 1
+    fi
+  done
+  echo "IR check OK"
+}
+
 # 声明测试函数
 assert() {
   #################################################
@@ -31,9 +289,9 @@ assert() {
 
 
   #################################################
-  # 运行程序，传入期待值，将生成结果写入tmp.s汇编文件。
+  # 运行程序，输入值经管道从标准输入传入，将生成结果写入tmp.s汇编文件。
   # 如果运行不成功，则会执行exit退出。成功时会短路exit操作
-  ./bin/qcc "$input" > ./tmp/tmp.s || exit
+  echo "$input" | ./bin/qcc - > ./tmp/tmp.s || exit
 
 
   #################################################
@@ -74,10 +332,50 @@ assert() {
 
 }
 
+# assertError 报错信息 输入值，编译应失败并给出该报错信息
+assertError() {
+  expected="$1"
+  input="$2"
+  if echo "$input" | ./bin/qcc - > ./tmp/tmp.s 2> ./tmp/tmp.err; then
+    echo "$input => should fail with '$expected'"
+    exit 1
+  fi
+  if ! grep -qF "$expected" ./tmp/tmp.err; then
+    echo "$input => '$expected' expected, but got:"
+    cat ./tmp/tmp.err
+    exit 1
+  fi
+  echo "$input => $expected"
+}
+
 
 # 构建文件
 rebuild
 
+# 字符扫描器随机对比测试
+checkScan 200
+
+# 并行词法分析随机对比测试
+checkParallel 80
+
+# 整页大小的源文件测试
+checkPageFile
+
+# 深度嵌套测试
+checkDeep 1000000
+
+# 编译服务对比测试
+checkServer
+
+# 多文件并行编译对比测试
+checkMulti
+
+# 汇编注释与输出文件测试
+checkEmit
+
+# 中间表示检查
+checkIr 100000
+
 # assert 期待值 输入值
 # [1] 返回指定数值
 assert 0 '{ return 0; }'
@@ -98,7 +396,7 @@ assert 17 '{ return 1-8/(2*2)+3*6; }'
 assert 10 '{ return -10+20; }'
 assert 10 '{ return - -10; }'
 assert 10 '{ return - - +10; }'
-assert 48 '{ return ------12*+++++----++++++++++4; }'
+assert 48 '{ return - - - - - -12*+ + + + + - - - - + + + + + + + + + +4; }'
 
 # [1] 支持条件运算符
 assert 0 '{ return 0==1; }'
@@ -142,5 +440,125 @@ assert 3 '{ 1; 2; return 3; }'
 assert 3 '{ {1; {2;} return 3;} }'
 assert 5 '{ ;;; return 5; }'
 
+# [8] 支持变量声明与块作用域
+assert 3 '{ int a=3; return a; }'
+assert 7 '{ int a=3, b=4; return a+b; }'
+assert 5 '{ int a; a=5; return a; }'
+assert 1 '{ a=1; { int a=2; } return a; }'
+assert 3 '{ int a=1; { int a=2; b=a; } return a+b; }'
+assert 6 '{ x=1; { int x=2; { int x=3; y=x; } z=x; } return x+y+z; }'
+assert 4 '{ { int a=1; } { int a=3; b=a; } return b+1; }'
+
+# [9] 支持全部二元、赋值与条件运算符
+assert 2 '{ return 17%5; }'
+assert 40 '{ return 5<<3; }'
+assert 5 '{ return 40>>3; }'
+assert 1 '{ return -8>>2==-2; }'
+assert 2 '{ return 6&3; }'
+assert 7 '{ return 6|3; }'
+assert 5 '{ return 6^3; }'
+assert 1 '{ return 1|2&0; }'
+assert 3 '{ return 1^2|1; }'
+assert 1 '{ return 1<<2==4; }'
+assert 1 '{ return 1+2<<1==6; }'
+assert 1 '{ return 2&&3; }'
+assert 0 '{ return 2&&0; }'
+assert 1 '{ return 0||3; }'
+assert 0 '{ return 0||0; }'
+assert 5 '{ a=5; 0&&(a=1); return a; }'
+assert 5 '{ a=5; 1||(a=1); return a; }'
+assert 1 '{ return 1||0&&0; }'
+assert 4 '{ return 1?4:5; }'
+assert 5 '{ return 0?4:5; }'
+assert 3 '{ return 0?1:0?2:3; }'
+assert 2 '{ a=1; return a>0?a+1:a-1; }'
+assert 3 '{ return (1,2,3); }'
+assert 4 '{ a=(b=1,b+3); return a; }'
+assert 9 '{ a=6; a+=3; return a; }'
+assert 3 '{ a=6; a-=3; return a; }'
+assert 18 '{ a=6; a*=3; return a; }'
+assert 2 '{ a=6; a/=3; return a; }'
+assert 1 '{ a=7; a%=3; return a; }'
+assert 24 '{ a=6; a<<=2; return a; }'
+assert 3 '{ a=12; a>>=2; return a; }'
+assert 4 '{ a=6; a&=12; return a; }'
+assert 14 '{ a=6; a|=12; return a; }'
+assert 10 '{ a=6; a^=12; return a; }'
+assert 12 '{ a=b=2; a+=b*=5; return a; }'
+assert 1 '{ return !0; }'
+assert 0 '{ return !5; }'
+assert 250 '{ return ~5&255; }'
+assertError 'increment/decrement not supported' '{ a=5; return --a; }'
+assertError 'increment/decrement not supported' '{ a=5; a++; return a; }'
+assertError 'integer literal too large' '{ return 99999999999999999999; }'
+assertError 'integer literal too large' '{ return 0x10000000000000000; }'
+assert 255 '{ return 18446744073709551615 & 255; }'
+
+# [10] 支持任意深度的嵌套
+assert 1 '{ return ((((((1)))))); }'
+assert 7 '{ return -(-(-(-7))); }'
+assert 6 '{ {{{ a=6; }}} return a; }'
+assert 2 '{ return 1?0?1:2:3; }'
+assert 4 '{ a=b=c=d=4; return a; }'
+
+# [11] 支持常量折叠与代数化简
+assert 0 '{ a=5; return a-a; }'
+assert 5 '{ a=5; return a*1+0; }'
+assert 3 '{ a=3; return - -a; }'
+assert 0 '{ a=7; return a*0; }'
+assert 4 '{ a=4; return a&a|0^0; }'
+assert 1 '{ a=4; return a==a; }'
+assert 6 '{ a=2; return (a, 3)*2; }'
+assert 7 '{ return 1<2 ? 7 : 8; }'
+assert 5 '{ a=5; return 0&&(a=1) ? 0 : a; }'
+assert 1 '{ return 9223372036854775807+1 < 0; }'
+assert 255 '{ return -1>>70; }'
+
+# [12] 按词法单元编号分析语法，双连符与对应的标点符号等价
+assert 3 '<% return 3; %>'
+assert 5 '<% <% int a=5; %> return 5; %>'
+assert 2 '{ a=-(1-3); return a; }'
+
+# [13] 表达式的临时值分配到寄存器，寄存器不足时溢出到栈帧
+assert 30 '{ a=1; return a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a; }'
+assert 32 '{ a=1; b=1; return (b+=2)+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a; }'
+assert 30 '{ a=1; b=2; return (a&&b)+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a; }'
+assert 31 '{ a=1; b=2; return (a?b:0)+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a; }'
+assert 29 '{ a=1; return (!a)+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a; }'
+assert 30 '{ a=1; return (0||a)+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a+a; }'
+assert 5 '{ a=1; b=(a+(a+(a+(a+a)))); return b; }'
+
+# [14] 先对需要更深的一侧求值，读写变量的顺序不变
+assert 13 '{ a=2; return a*a*a+a*a+1; }'
+assert 15 '{ a=1; return (a+a)+(a=5); }'
+assert 12 '{ a=1; return (a+(a+a))*(a=2); }'
+assert 4 '{ a=1; b=1; return (b+(b+b))+(a=1); }'
+
+# [15] 窥孔优化改写相邻的指令，结果与不优化时相同
+assert 4 '{ a=3; b=a+1; return b; }'
+assert 6 '{ a=3; b=2; return !(a<b) ? a+3 : b; }'
+assert 2 '{ a=0; return !!a ? 1 : 2; }'
+assert 64 '{ a=1; return a<<70; }'
+assert 1 '{ a=2048; return a-2048+(a+-2048<1); }'
+assert 7 '{ a=5; b=a; a=b+2; return a; }'
+
+# [16] 变量的值为 SSA 值，分支中改写的变量在汇合处合并，没有 return 时返回 0
+assert 2 '{ a=1; b=2; a>b ? (c=a) : (c=b); return c; }'
+assert 5 '{ a=0; b=5; a && (b=7); return b; }'
+assert 7 '{ a=0; b=5; a || (b=7); return b; }'
+assert 21 '{ a=1; b=2; a<b ? (t=a, a=b, b=t) : 0; return a*10+b; }'
+assert 8 '{ a=3; b=a ? (a ? (a=4) : (a=5)) : (a=6); return a+b; }'
+assert 5 '{ a=1; b=(a=2) && (a=a+3) || (a=9); return a*b; }'
+assert 0 '{ a=5; }'
+assert 70 '{ a=1; b=2; c=3; d=4; e=5; f=6; g=7; h=8; i=9; j=10; k=11; l=12; m=13; n=14; o=15; p=16; q=17; r=18; s=19; t=20; u=21; v=22; w=23; x=24; y=25; z=26; a ? (z=a, a=b, b=c, c=z) : 0; return a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z; }'
+
+# [17] 一侧为常数的运算使用立即数形式，大常数由 lui、addi、slli 或常数池装入
+assert 1 '{ a=7; return (a+0x123456789abcdef0)>>60; }'
+assert 128 '{ a=9223372036854775807; return (a>>56)+(a==9223372036854775807); }'
+assert 14 '{ a=0x7ffff800; b=-2049; return (a>>28)+(b==-2049)+(a-2048==0x7ffff000)*3+(a+2048==0x80000000)*3; }'
+assert 3 '{ a=-5; return (a<-4)+(-6<a)+(a<=-5)+(3<=a)+(a==5); }'
+assert 42 '{ a=5; b=a*8; c=b-2048; return b+(c==-2008)+(c<-2000); }'
+assert 3 '{ a=4096; b=a*4096*4096; return (b>>35)+(b==68719476736)+(a!=4096); }'
+
 # 如果运行正常未提前退出，程序将显示OK
 echo OK